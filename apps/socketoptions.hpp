@@ -208,6 +208,7 @@ const SocketOption srt_options [] {
     { "oheadbw", 0, SRTO_OHEADBW, SocketOption::POST, SocketOption::INT, nullptr},
     { "latency", 0, SRTO_LATENCY, SocketOption::PRE, SocketOption::INT, nullptr},
     { "tsbpddelay", 0, SRTO_TSBPDDELAY, SocketOption::PRE, SocketOption::INT, nullptr},
+    { "tsbpdshared", 0, SRTO_TSBPDSHARED, SocketOption::PRE, SocketOption::BOOL, nullptr},
     { "tlpktdrop", 0, SRTO_TLPKTDROP, SocketOption::PRE, SocketOption::BOOL, nullptr},
     { "nakreport", 0, SRTO_NAKREPORT, SocketOption::PRE, SocketOption::BOOL, nullptr},
     { "conntimeo", 0, SRTO_CONNTIMEO, SocketOption::PRE, SocketOption::INT, nullptr},
@@ -221,7 +222,19 @@ const SocketOption srt_options [] {
     { "payloadsize", 0, SRTO_PAYLOADSIZE, SocketOption::PRE, SocketOption::INT, nullptr},
     { "transtype", 0, SRTO_TRANSTYPE, SocketOption::PRE, SocketOption::ENUM, &enummap_transtype },
     { "kmrefreshrate", 0, SRTO_KMREFRESHRATE, SocketOption::PRE, SocketOption::INT, nullptr },
-    { "kmpreannounce", 0, SRTO_KMPREANNOUNCE, SocketOption::PRE, SocketOption::INT, nullptr }
+    { "kmpreannounce", 0, SRTO_KMPREANNOUNCE, SocketOption::PRE, SocketOption::INT, nullptr },
+    { "rcvbatch", 0, SRTO_UDP_RCVBATCH, SocketOption::PRE, SocketOption::INT, nullptr },
+    { "sndbatch", 0, SRTO_UDP_SNDBATCH, SocketOption::PRE, SocketOption::INT, nullptr },
+    { "sndworkers", 0, SRTO_UDP_SNDWORKERS, SocketOption::PRE, SocketOption::INT, nullptr },
+    { "sndspin", 0, SRTO_UDP_SNDSPIN, SocketOption::PRE, SocketOption::INT, nullptr },
+    { "rcvhugepages", 0, SRTO_UDP_RCVHUGEPAGES, SocketOption::PRE, SocketOption::BOOL, nullptr },
+    { "rcvborrowmax", 0, SRTO_RCVBORROWMAX, SocketOption::POST, SocketOption::INT, nullptr },
+    { "gso", 0, SRTO_UDP_GSO, SocketOption::PRE, SocketOption::BOOL, nullptr },
+    { "gro", 0, SRTO_UDP_GRO, SocketOption::PRE, SocketOption::BOOL, nullptr },
+    { "iouring", 0, SRTO_UDP_IOURING, SocketOption::PRE, SocketOption::BOOL, nullptr },
+    { "shards", 0, SRTO_UDP_SHARDS, SocketOption::PRE, SocketOption::INT, nullptr },
+    { "rcvtimestamp", 0, SRTO_UDP_RCVTIMESTAMP, SocketOption::PRE, SocketOption::BOOL, nullptr },
+    { "impair", 0, SRTO_UDP_IMPAIR, SocketOption::PRE, SocketOption::STRING, nullptr }
 };
 }
 
@@ -128,6 +128,9 @@ void PrintSrtStats(int sid, const PerfMonType& mon)
         output << "\"packetsRetransmitted\":" << mon.pktRetrans << ",";        
         output << "\"bytes\":" << mon.byteSent << ",";
         output << "\"bytesDropped\":" << mon.byteSndDrop << ",";
+        output << "\"batchAvg\":" << mon.pktSndBatchAvg << ",";
+        output << "\"wakeupErrAvg\":" << mon.usSndWakeupErrAvg << ",";
+        output << "\"wakeupErrMax\":" << mon.usSndWakeupErrMax << ",";
         output << "\"mbitRate\":" << mon.mbpsSendRate;
         output << "},";
         output << "\"recv\": {";
@@ -139,6 +142,11 @@ void PrintSrtStats(int sid, const PerfMonType& mon)
         output << "\"bytes\":" << mon.byteRecv << ",";
         output << "\"bytesLost\":" << mon.byteRcvLoss << ",";
         output << "\"bytesDropped\":" << mon.byteRcvDrop << ",";
+        output << "\"batchAvg\":" << mon.pktRcvBatchAvg << ",";
+        output << "\"bufferCapacity\":" << mon.pktRcvBufCapacity << ",";
+        output << "\"bufferHighWater\":" << mon.pktRcvBufHighWater << ",";
+        output << "\"packetsShed\":" << mon.pktRcvShedTotal << ",";
+        output << "\"bufferMemory\":" << mon.byteBufMem << ",";
         output << "\"mbitRate\":" << mon.mbpsRecvRate;
         output << "}";
         output << "}" << endl;
@@ -153,9 +161,13 @@ void PrintSrtStats(int sid, const PerfMonType& mon)
         output << "RATE     SENDING: " << setw(11) << mon.mbpsSendRate       << "  RECEIVING:  " << setw(11) << mon.mbpsRecvRate         << endl;
         output << "BELATED RECEIVED: " << setw(11) << mon.pktRcvBelated      << "  AVG TIME:   " << setw(11) << mon.pktRcvAvgBelatedTime << endl;
         output << "REORDER DISTANCE: " << setw(11) << mon.pktReorderDistance << endl;
+        output << "UDP BATCH   SENT: " << setw(11) << mon.pktSndBatchAvg     << "  RECEIVED:   " << setw(11) << mon.pktRcvBatchAvg       << endl;
+        output << "SND WAKEUP   AVG: " << setw(9)  << mon.usSndWakeupErrAvg  << "us  MAX:        " << setw(9)  << mon.usSndWakeupErrMax  << "us" << endl;
         output << "WINDOW      FLOW: " << setw(11) << mon.pktFlowWindow      << "  CONGESTION: " << setw(11) << mon.pktCongestionWindow  << "  FLIGHT: " << setw(11) << mon.pktFlightSize << endl;
         output << "LINK         RTT: " << setw(9)  << mon.msRTT            << "ms  BANDWIDTH:  " << setw(7)  << mon.mbpsBandwidth    << "Mb/s " << endl;
         output << "BUFFERLEFT:  SND: " << setw(11) << mon.byteAvailSndBuf    << "  RCV:        " << setw(11) << mon.byteAvailRcvBuf      << endl;
+        output << "RCV BUFFER  SIZE: " << setw(11) << mon.pktRcvBufCapacity  << "  HIGH WATER: " << setw(11) << mon.pktRcvBufHighWater   << endl;
+        output << "BUFFER    MEMORY: " << setw(11) << mon.byteBufMem         << "  SHED PKT:   " << setw(11) << mon.pktRcvShedTotal      << endl;
     }
 
     cerr << output.str() << std::flush;
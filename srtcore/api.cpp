@@ -61,6 +61,7 @@ modified by
 #include "core.h"
 #include "logging.h"
 #include "threadname.h"
+#include "inproc.h"
 #include "srt.h"
 
 #ifdef WIN32
@@ -92,7 +93,7 @@ m_uiBackLog(0),
 m_iMuxID(-1)
 {
       pthread_mutex_init(&m_AcceptLock, NULL);
-      pthread_cond_init(&m_AcceptCond, NULL);
+      CGuard::createCond(m_AcceptCond);
       pthread_mutex_init(&m_ControlLock, NULL);
 }
 
@@ -204,13 +205,15 @@ int CUDTUnited::startup()
    if (m_bGCStatus)
       return true;
 
+   CSndBlockPool::setReleaseHook(&CUDT::sndPoolReleased);
+
    m_bClosing = false;
    pthread_mutex_init(&m_GCStopLock, NULL);
-   pthread_cond_init(&m_GCStopCond, NULL);
+   CGuard::createCond(m_GCStopCond);
 
    {
        ThreadName tn("SRT:GC");
-       pthread_create(&m_GCThread, NULL, garbageCollect, this);
+       CThreadConfig::create(&m_GCThread, SRT_THREAD_GC, garbageCollect, this);
    }
 
    m_bGCStatus = true;
@@ -233,6 +236,10 @@ int CUDTUnited::cleanup()
    m_bClosing = true;
    pthread_cond_signal(&m_GCStopCond);
    pthread_join(m_GCThread, NULL);
+
+   // All sockets are closed now.
+   m_TsbPdQueue.stop();
+   CSndBlockPool::cleanup();
    
    // XXX There's some weird bug here causing this
    // to hangup on Windows. This might be either something
@@ -323,7 +330,7 @@ SRTSOCKET CUDTUnited::newSocket(int af, int)
    return ns->m_SocketID;
 }
 
-int CUDTUnited::newConnection(const SRTSOCKET listen, const sockaddr* peer, CHandShake* hs, const CPacket& hspkt)
+int CUDTUnited::newConnection(const SRTSOCKET listen, const sockaddr* peer, CHandShake* hs, const CPacket& hspkt, const CRcvQueue* rq)
 {
    CUDTSocket* ns = NULL;
 
@@ -434,7 +441,7 @@ int CUDTUnited::newConnection(const SRTSOCKET listen, const sockaddr* peer, CHan
 
        // bind to the same addr of listening socket
        ns->m_pUDT->open();
-       updateListenerMux(ns, ls);
+       updateListenerMux(ns, ls, rq);
        ns->m_pUDT->acceptAndRespond(peer, hs, hspkt);
    }
    catch (...)
@@ -582,6 +589,11 @@ int CUDTUnited::bind(const SRTSOCKET u, const sockaddr* name, int namelen)
    // copy address information of local node
    s->m_pUDT->m_pSndQueue->m_pChannel->getSockAddr(s->m_pSelfAddr);
 
+   // The other shards bind to the port just obtained. An in-process
+   // port has no use for them, as it costs no system calls.
+   if (s->m_pUDT->m_iUDPShards > 1 && !CInprocRing::isInprocAddr(name))
+      createShards(s);
+
    return 0;
 }
 
@@ -682,6 +694,15 @@ int CUDTUnited::listen(const SRTSOCKET u, int backlog)
 
    s->m_pUDT->setListenState();  // propagates CUDTException,
                                  // if thrown, remains in OPENED state if so.
+
+   // Connection requests may come through any of the shards.
+   if (!s->m_vShardMuxIDs.empty())
+   {
+      CGuard manager_cg(m_ControlLock);
+      for (vector<int>::iterator i = s->m_vShardMuxIDs.begin(); i != s->m_vShardMuxIDs.end(); ++ i)
+         m_mMultiplexer[*i].m_pRcvQueue->setListener(s->m_pUDT);
+   }
+
    s->m_Status = SRTS_LISTENING;
 
    return 0;
@@ -813,9 +834,21 @@ int CUDTUnited::connect(const SRTSOCKET u, const sockaddr* name, int namelen, in
       if (!s->m_pUDT->m_bRendezvous)
       {
          s->m_pUDT->open(); // XXX here use the AF_* family value from 'name'
-         updateMux(s);  // <<---- updateMux
-                        // -> C(Snd|Rcv)Queue::init
-                        // -> pthread_create(...C(Snd|Rcv)Queue::worker...)
+
+         // An in-process peer can only be reached from an in-process port.
+         if (CInprocRing::isInprocAddr(name))
+         {
+            sockaddr_in self;
+            memcpy(&self, name, sizeof self);
+            self.sin_port = 0;
+            updateMux(s, (sockaddr*)&self);
+         }
+         else
+         {
+            updateMux(s);  // <<---- updateMux
+                           // -> C(Snd|Rcv)Queue::init
+                           // -> pthread_create(...C(Snd|Rcv)Queue::worker...)
+         }
          s->m_Status = SRTS_OPENED;
       }
       else
@@ -921,6 +954,17 @@ int CUDTUnited::close(const SRTSOCKET u)
           CGuard cg(s->m_pUDT->m_ConnectionLock);
           s->m_pUDT->m_bListening = false;
           s->m_pUDT->m_pRcvQueue->removeListener(s->m_pUDT);
+
+          // The shard queues are removed from outside m_ControlLock because
+          // their workers take it (in newConnection) while holding m_LSLock.
+          vector<CRcvQueue*> shards;
+          {
+             CGuard manager_cg(m_ControlLock);
+             for (vector<int>::iterator i = s->m_vShardMuxIDs.begin(); i != s->m_vShardMuxIDs.end(); ++ i)
+                shards.push_back(m_mMultiplexer[*i].m_pRcvQueue);
+          }
+          for (vector<CRcvQueue*>::iterator i = shards.begin(); i != shards.end(); ++ i)
+             (*i)->removeListener(s->m_pUDT);
       }
 
       // broadcast all "accept" waiting
@@ -1088,6 +1132,13 @@ int CUDTUnited::getsockname(const SRTSOCKET u, sockaddr* name, int* namelen)
    return 0;
 }
 
+// The receiver buffer is resized under the socket's m_RecvLock.
+bool CUDTUnited::isRcvDataReady(CUDTSocket* s)
+{
+   CGuard recvguard(s->m_pUDT->m_RecvLock);
+   return s->m_pUDT->m_pRcvBuffer->isRcvDataReady();
+}
+
 int CUDTUnited::select(
    ud_set* readfds, ud_set* writefds, ud_set* exceptfds, const timeval* timeout)
 {
@@ -1157,7 +1208,7 @@ int CUDTUnited::select(
          s = *j1;
 
          if ((s->m_pUDT->m_bConnected
-               && s->m_pUDT->m_pRcvBuffer->isRcvDataReady()
+               && isRcvDataReady(s)
             )
             || (!s->m_pUDT->m_bListening
                && (s->m_pUDT->m_bBroken || !s->m_pUDT->m_bConnected))
@@ -1254,7 +1305,7 @@ int CUDTUnited::selectEx(
          if (readfds)
          {
             if ((s->m_pUDT->m_bConnected
-                  && s->m_pUDT->m_pRcvBuffer->isRcvDataReady()
+                  && isRcvDataReady(s)
                )
                || (s->m_pUDT->m_bListening
                   && (s->m_pQueuedSockets->size() > 0)))
@@ -1573,6 +1624,28 @@ void CUDTUnited::removeSocket(const SRTSOCKET u)
    m_EPoll.update_events(u, i->second->m_pUDT->m_sPollID,
       UDT_EPOLL_IN|UDT_EPOLL_OUT|UDT_EPOLL_ERR, false);
 
+   // A sharded listener still may be registered in the other shards.
+   // This is called with m_ControlLock held, which the shard workers take
+   // (in newConnection) while holding m_LSLock, so it's released for the
+   // time of removeListener(). The shard multiplexers are still referenced
+   // by this socket, and m_ClosedSockets is erased only by this thread.
+   vector<int> shards;
+   shards.swap(i->second->m_vShardMuxIDs);
+   vector<CRcvQueue*> shard_queues;
+   for (vector<int>::iterator k = shards.begin(); k != shards.end(); ++ k)
+   {
+      map<int, CMultiplexer>::iterator m = m_mMultiplexer.find(*k);
+      if (m != m_mMultiplexer.end())
+         shard_queues.push_back(m->second.m_pRcvQueue);
+   }
+   if (!shard_queues.empty())
+   {
+      CGuard::leaveCS(m_ControlLock);
+      for (vector<CRcvQueue*>::iterator k = shard_queues.begin(); k != shard_queues.end(); ++ k)
+         (*k)->removeListener(i->second->m_pUDT);
+      CGuard::enterCS(m_ControlLock);
+   }
+
    // delete this one
    HLOGC(mglog.Debug, log << "GC/removeSocket: closing associated UDT %" << u);
    i->second->m_pUDT->close();
@@ -1580,21 +1653,31 @@ void CUDTUnited::removeSocket(const SRTSOCKET u)
    delete i->second;
    m_ClosedSockets.erase(i);
 
-   map<int, CMultiplexer>::iterator m;
-   m = m_mMultiplexer.find(mid);
-   if (m == m_mMultiplexer.end())
+   if (m_mMultiplexer.find(mid) == m_mMultiplexer.end())
    {
       LOGC(mglog.Fatal, log << "IPE: For socket %" << u << " MUXER id=" << mid << " NOT FOUND!");
       return;
    }
 
+   unrefMux(mid);
+   for (vector<int>::iterator k = shards.begin(); k != shards.end(); ++ k)
+      unrefMux(*k);
+}
+
+void CUDTUnited::unrefMux(int mid)
+{
+   map<int, CMultiplexer>::iterator m;
+   m = m_mMultiplexer.find(mid);
+   if (m == m_mMultiplexer.end())
+      return;
+
    m->second.m_iRefCount --;
    // HLOGF(mglog.Debug, "unrefing underlying socket for %u: %u\n",
    //    u, m->second.m_iRefCount);
    if (0 == m->second.m_iRefCount)
    {
-       HLOGC(mglog.Debug, log << "MUXER id=" << mid << " lost last socket %"
-           << u << " - deleting muxer bound to port "
+       HLOGC(mglog.Debug, log << "MUXER id=" << mid << " lost last socket"
+           << " - deleting muxer bound to port "
            << m->second.m_pChannel->bindAddressAny().hport());
       m->second.m_pChannel->close();
       delete m->second.m_pSndQueue;
@@ -1624,6 +1707,8 @@ void CUDTUnited::updateMux(
 {
    CGuard cg(m_ControlLock);
 
+   bool inproc = CInprocRing::isInprocAddr(addr);
+
    if ((s->m_pUDT->m_bReuseAddr) && (addr))
    {
       int port = (AF_INET == s->m_pUDT->m_iIPversion)
@@ -1640,6 +1725,7 @@ void CUDTUnited::updateMux(
             &&  (i->second.m_iIpTTL == s->m_pUDT->m_iIpTTL)
             && (i->second.m_iIpToS == s->m_pUDT->m_iIpToS)
 #endif
+            &&  i->second.m_bInproc == inproc
             &&  i->second.m_bReusable)
          {
             if (i->second.m_iPort == port)
@@ -1658,6 +1744,18 @@ void CUDTUnited::updateMux(
    }
 
    // a new multiplexer is needed
+   bool reuseport = addr && !udpsock && !inproc && s->m_pUDT->m_iUDPShards > 1;
+   CMultiplexer& m = createMux(s->m_SocketID, s, addr, udpsock, reuseport);
+
+   s->m_pUDT->m_pSndQueue = m.m_pSndQueue;
+   s->m_pUDT->m_pRcvQueue = m.m_pRcvQueue;
+   s->m_iMuxID = m.m_iID;
+}
+
+// Create a multiplexer with the settings of the socket 's', bound to 'addr'
+// or attached to 'udpsock', and add it to the multiplexer map under 'id'.
+CMultiplexer& CUDTUnited::createMux(int id, CUDTSocket* s, const sockaddr* addr, const UDPSOCKET* udpsock, bool reuseport)
+{
    CMultiplexer m;
    m.m_iMSS = s->m_pUDT->m_iMSS;
    m.m_iIPversion = s->m_pUDT->m_iIPversion;
@@ -1665,9 +1763,20 @@ void CUDTUnited::updateMux(
    m.m_iIpTTL = s->m_pUDT->m_iIpTTL;
    m.m_iIpToS = s->m_pUDT->m_iIpToS;
 #endif
+   m.m_iRcvBatch = s->m_pUDT->m_iUDPRcvBatch;
+   m.m_iSndBatch = s->m_pUDT->m_iUDPSndBatch;
+   m.m_iSndWorkers = s->m_pUDT->m_iUDPSndWorkers;
+   m.m_iSndSpin = s->m_pUDT->m_iUDPSndSpin;
+   m.m_bGSO = s->m_pUDT->m_bUDPGSO;
+   m.m_bGRO = s->m_pUDT->m_bUDPGRO;
+   m.m_bIoUring = s->m_pUDT->m_bUDPIoUring;
+   m.m_bRcvTimestamp = s->m_pUDT->m_bUDPRcvTimestamp;
+   m.m_bRcvHugePages = s->m_pUDT->m_bUDPRcvHugePages;
+   m.m_bInproc = !udpsock && CInprocRing::isInprocAddr(addr);
+   m.m_sImpair = s->m_pUDT->m_sUDPImpair;
    m.m_iRefCount = 1;
    m.m_bReusable = s->m_pUDT->m_bReuseAddr;
-   m.m_iID = s->m_SocketID;
+   m.m_iID = id;
 
    m.m_pChannel = new CChannel(s->m_pUDT->m_iIPversion);
 #ifdef SRT_ENABLE_IPOPTS
@@ -1676,6 +1785,12 @@ void CUDTUnited::updateMux(
 #endif
    m.m_pChannel->setSndBufSize(s->m_pUDT->m_iUDPSndBufSize);
    m.m_pChannel->setRcvBufSize(s->m_pUDT->m_iUDPRcvBufSize);
+   m.m_pChannel->setGSO(m.m_bGSO);
+   m.m_pChannel->setGRO(m.m_bGRO);
+   m.m_pChannel->setIoUring(m.m_bIoUring);
+   m.m_pChannel->setRcvTimestamp(m.m_bRcvTimestamp);
+   m.m_pChannel->setImpairment(m.m_sImpair);
+   m.m_pChannel->setReusePort(reuseport);
 
    try
    {
@@ -1706,22 +1821,58 @@ void CUDTUnited::updateMux(
       delete (sockaddr_in6*)sa;
 
    m.m_pTimer = new CTimer;
+   m.m_pTimer->setSpinThreshold(m.m_iSndSpin);
 
    m.m_pSndQueue = new CSndQueue;
-   m.m_pSndQueue->init(m.m_pChannel, m.m_pTimer);
    m.m_pRcvQueue = new CRcvQueue;
-   m.m_pRcvQueue->init(
-      32, s->m_pUDT->maxPayloadSize(), m.m_iIPversion, 1024,
-      m.m_pChannel, m.m_pTimer);
-
-   m_mMultiplexer[m.m_iID] = m;
-
-   s->m_pUDT->m_pSndQueue = m.m_pSndQueue;
-   s->m_pUDT->m_pRcvQueue = m.m_pRcvQueue;
-   s->m_iMuxID = m.m_iID;
+   try
+   {
+      m.m_pSndQueue->init(m.m_pChannel, m.m_pTimer, m.m_iSndBatch, m.m_iSndWorkers);
+      m.m_pRcvQueue->init(
+         32, s->m_pUDT->maxPayloadSize(), m.m_iIPversion, 1024,
+         m.m_pChannel, m.m_pTimer, m.m_iRcvBatch, m.m_bRcvHugePages);
+   }
+   catch (CUDTException& e)
+   {
+      // Like in unrefMux(), with the queues not started or stopped.
+      m.m_pChannel->close();
+      delete m.m_pSndQueue;
+      delete m.m_pRcvQueue;
+      delete m.m_pTimer;
+      delete m.m_pChannel;
+      throw e;
+   }
 
    HLOGF(mglog.Debug, 
       "creating new multiplexer for port %i\n", m.m_iPort);
+
+   CMultiplexer& r = m_mMultiplexer[m.m_iID];
+   r = m;
+   return r;
+}
+
+// Open the remaining SO_REUSEPORT multiplexers on the port of the bound
+// socket 's'. The shards aren't shared with other sockets binding to that
+// port; they are only used by the connections accepted through them.
+void CUDTUnited::createShards(CUDTSocket* s)
+{
+   CGuard cg(m_ControlLock);
+
+   for (int k = 1; k < s->m_pUDT->m_iUDPShards; ++ k)
+   {
+      // Every multiplexer needs its unique ID; take one from the socket IDs.
+      int id;
+      {
+         CGuard idg(m_IDLock);
+         id = -- m_SocketIDGenerator;
+      }
+
+      CMultiplexer& m = createMux(id, s, s->m_pSelfAddr, NULL, true);
+      m.m_bReusable = false;
+      s->m_vShardMuxIDs.push_back(id);
+   }
+
+   HLOGC(mglog.Debug, log << "bind: opened " << s->m_pUDT->m_iUDPShards << " shards for %" << s->m_SocketID);
 }
 
 // XXX This functionality needs strong refactoring.
@@ -1768,10 +1919,29 @@ void CUDTUnited::updateMux(
 // When deleting, you simply "unsubscribe" yourself from the multiplexer, which
 // will unref it and remove the list element by the iterator kept by the
 // socket.
-void CUDTUnited::updateListenerMux(CUDTSocket* s, const CUDTSocket* ls)
+void CUDTUnited::updateListenerMux(CUDTSocket* s, const CUDTSocket* ls, const CRcvQueue* rq)
 {
    CGuard cg(m_ControlLock);
 
+   // With SRTO_UDP_SHARDS all of the listener's multiplexers have the same
+   // port, and the connection must stay with the one that got its handshake.
+   if (!ls->m_vShardMuxIDs.empty())
+   {
+      for (map<int, CMultiplexer>::iterator i = m_mMultiplexer.begin();
+         i != m_mMultiplexer.end(); ++ i)
+      {
+         if (i->second.m_pRcvQueue == rq)
+         {
+            HLOGC(mglog.Debug, log << "updateMux: using shard multiplexer id=" << i->second.m_iID);
+            ++ i->second.m_iRefCount;
+            s->m_pUDT->m_pSndQueue = i->second.m_pSndQueue;
+            s->m_pUDT->m_pRcvQueue = i->second.m_pRcvQueue;
+            s->m_iMuxID = i->second.m_iID;
+            return;
+         }
+      }
+   }
+
    int port = (AF_INET == ls->m_iIPversion)
       ? ntohs(((sockaddr_in*)ls->m_pSelfAddr)->sin_port)
       : ntohs(((sockaddr_in6*)ls->m_pSelfAddr)->sin6_port);
@@ -1811,14 +1981,7 @@ void* CUDTUnited::garbageCollect(void* p)
        //      self->checkTLSValue();
        //#endif
 
-       timeval now;
-       timespec timeout;
-       gettimeofday(&now, 0);
-       timeout.tv_sec = now.tv_sec + 1;
-       timeout.tv_nsec = now.tv_usec * 1000;
-
-       pthread_cond_timedwait(
-               &self->m_GCStopCond, &self->m_GCStopLock, &timeout);
+       CTimer::condTimedWaitUS(&self->m_GCStopCond, &self->m_GCStopLock, 1000000ULL);
    }
 
    // remove all sockets and multiplexers
@@ -2218,12 +2381,12 @@ int CUDT::sendmsg(
 }
 
 int CUDT::sendmsg2(
-   SRTSOCKET u, const char* buf, int len, ref_t<SRT_MSGCTRL> r_m)
+   SRTSOCKET u, const char* buf, int len, ref_t<SRT_MSGCTRL> r_m, const CSndCompletion* done)
 {
    try
    {
       CUDT* udt = s_UDTUnited.lookup(u);
-      return udt->sendmsg2(buf, len, r_m);
+      return udt->sendmsg2(buf, len, r_m, done);
    }
    catch (CUDTException e)
    {
@@ -2285,6 +2448,101 @@ int CUDT::recvmsg2(SRTSOCKET u, char* buf, int len, ref_t<SRT_MSGCTRL> r_m)
       return ERROR;
    }
 }
+int CUDT::sendmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> r_m)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->sendmsgv(segs, nsegs, r_m);
+   }
+   catch (CUDTException e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (bad_alloc&)
+   {
+      s_UDTUnited.setError(new CUDTException(MJ_SYSTEMRES, MN_MEMORY, 0));
+      return ERROR;
+   }
+   catch (std::exception& ee)
+   {
+      LOGC(mglog.Fatal, log << "sendmsgv: UNEXPECTED EXCEPTION: "
+         << typeid(ee).name() << ": " << ee.what());
+      s_UDTUnited.setError(new CUDTException(MJ_UNKNOWN, MN_NONE, 0));
+      return ERROR;
+   }
+}
+
+int CUDT::recvmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> r_m)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->recvmsgv(segs, nsegs, r_m);
+   }
+   catch (CUDTException e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (std::exception& ee)
+   {
+      LOGC(mglog.Fatal, log << "recvmsgv: UNEXPECTED EXCEPTION: "
+         << typeid(ee).name() << ": " << ee.what());
+      s_UDTUnited.setError(new CUDTException(MJ_UNKNOWN, MN_NONE, 0));
+      return ERROR;
+   }
+}
+
+int CUDT::borrowmsg(SRTSOCKET u, ref_t<SRT_BORROWED> r_m)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->borrowmsg(r_m);
+   }
+   catch (CUDTException e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (bad_alloc&)
+   {
+      s_UDTUnited.setError(new CUDTException(MJ_SYSTEMRES, MN_MEMORY, 0));
+      return ERROR;
+   }
+   catch (std::exception& ee)
+   {
+      LOGC(mglog.Fatal, log << "borrowmsg: UNEXPECTED EXCEPTION: "
+         << typeid(ee).name() << ": " << ee.what());
+      s_UDTUnited.setError(new CUDTException(MJ_UNKNOWN, MN_NONE, 0));
+      return ERROR;
+   }
+}
+
+int CUDT::releasemsg(SRTSOCKET u, ref_t<SRT_BORROWED> r_m)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      udt->releasemsg(r_m);
+      return 0;
+   }
+   catch (CUDTException e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (std::exception& ee)
+   {
+      LOGC(mglog.Fatal, log << "releasemsg: UNEXPECTED EXCEPTION: "
+         << typeid(ee).name() << ": " << ee.what());
+      s_UDTUnited.setError(new CUDTException(MJ_UNKNOWN, MN_NONE, 0));
+      return ERROR;
+   }
+}
+
 int64_t CUDT::sendfile(
    SRTSOCKET u, fstream& ifs, int64_t& offset, int64_t size, int block)
 {
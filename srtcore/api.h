@@ -98,6 +98,7 @@ public:
    unsigned int m_uiBackLog;                 //< maximum number of connections in queue
 
    int m_iMuxID;                             //< multiplexer ID
+   std::vector<int> m_vShardMuxIDs;          //< IDs of the other multiplexers on the same port (SRTO_UDP_SHARDS)
 
    pthread_mutex_t m_ControlLock;            //< lock this socket exclusively for control APIs: bind/listen/connect
 
@@ -126,6 +127,10 @@ public:
    CUDTUnited();
    ~CUDTUnited();
 
+      /// Upper limit for SRTO_UDP_SHARDS.
+
+   static const int MAX_SHARDS = 64;
+
 public:
 
    static std::string CONID(SRTSOCKET sock);
@@ -151,9 +156,10 @@ public:
       /// @param [in] listen the listening UDT socket;
       /// @param [in] peer peer address.
       /// @param [in,out] hs handshake information from peer side (in), negotiated value (out);
+      /// @param [in] rq the receiver queue that got the handshake, which the new connection will use.
       /// @return If the new connection is successfully created: 1 success, 0 already exist, -1 error.
 
-   int newConnection(const SRTSOCKET listen, const sockaddr* peer, CHandShake* hs, const CPacket& hspkt);
+   int newConnection(const SRTSOCKET listen, const sockaddr* peer, CHandShake* hs, const CPacket& hspkt, const CRcvQueue* rq);
 
       /// look up the UDT entity according to its ID.
       /// @param [in] u the UDT socket ID.
@@ -221,7 +227,11 @@ private:
    CUDTSocket* locate(const SRTSOCKET u);
    CUDTSocket* locate(const sockaddr* peer, const SRTSOCKET id, int32_t isn);
    void updateMux(CUDTSocket* s, const sockaddr* addr = NULL, const UDPSOCKET* = NULL);
-   void updateListenerMux(CUDTSocket* s, const CUDTSocket* ls);
+   CMultiplexer& createMux(int id, CUDTSocket* s, const sockaddr* addr, const UDPSOCKET* udpsock, bool reuseport);
+   void createShards(CUDTSocket* s);
+   void updateListenerMux(CUDTSocket* s, const CUDTSocket* ls, const CRcvQueue* rq);
+   void unrefMux(int mid);
+   static bool isRcvDataReady(CUDTSocket* s);
 
 private:
    std::map<int, CMultiplexer> m_mMultiplexer;		// UDP multiplexer
@@ -248,6 +258,7 @@ private:
    void removeSocket(const SRTSOCKET u);
 
    CEPoll m_EPoll;                                     // handling epoll data structures and events
+   CTsbPdQueue m_TsbPdQueue;                           // shared TSBPD workers (SRTO_TSBPDSHARED)
 
 private:
    CUDTUnited(const CUDTUnited&);
@@ -52,6 +52,8 @@ modified by
 
 #include <cstring>
 #include <cmath>
+#include <limits>
+#include <new>
 #include "buffer.h"
 #include "packet.h"
 #include "core.h" // provides some constants
@@ -64,12 +66,17 @@ extern logging::Logger mglog, dlog, tslog;
 CSndBuffer::CSndBuffer(int size, int mss):
 m_BufLock(),
 m_pBlock(NULL),
-m_pFirstBlock(NULL),
-m_pCurrBlock(NULL),
-m_pLastBlock(NULL),
-m_pBuffer(NULL),
+m_iFirstPos(0),
+m_iCurrPos(0),
+m_iLastPos(0),
+m_pPool(CSndBlockPool::get(mss)),
+m_vReserved(),
+m_vFreed(),
+m_iAcquired(0),
+m_iReleased(0),
 m_iNextMsgNo(1),
 m_iSize(size),
+m_iIncrement(size),
 m_iMSS(mss),
 m_iCount(0)
 ,m_iBytesCount(0)
@@ -86,68 +93,94 @@ m_iCount(0)
 ,m_InRatePeriod(CUDT::SND_INPUTRATE_FAST_START_US)   // 0.5 sec (fast start)
 ,m_iInRateBps(CUDT::SND_INPUTRATE_INITIAL_BPS)
 ,m_iAvgPayloadSz(SRT_LIVE_DEF_PLSIZE)
+,m_vRetired()
 {
-   // initial physical buffer of "size"
-   m_pBuffer = new Buffer;
-   m_pBuffer->m_pcData = new char [m_iSize * m_iMSS];
-   m_pBuffer->m_iSize = m_iSize;
-   m_pBuffer->m_pNext = NULL;
-
-   // circular linked list for out bound packets
-   m_pBlock = new Block;
-   Block* pb = m_pBlock;
-   for (int i = 1; i < m_iSize; ++ i)
-   {
-      pb->m_pNext = new Block;
-      pb->m_iMsgNoBitset = 0;
-      pb = pb->m_pNext;
-   }
-   pb->m_pNext = m_pBlock;
-
-   pb = m_pBlock;
-   char* pc = m_pBuffer->m_pcData;
+   // circular array for out bound packets; the memory
+   // for the payload is taken from m_pPool when they are used
+   m_pBlock = new Block[m_iSize];
    for (int i = 0; i < m_iSize; ++ i)
    {
-      pb->m_pcData = pc;
-      pb = pb->m_pNext;
-      pc += m_iMSS;
+      m_pBlock[i].m_pcData = NULL;
+      m_pBlock[i].m_pcRef = NULL;
+      m_pBlock[i].m_iMsgNoBitset = 0;
+      m_pBlock[i].m_pDone = NULL;
    }
 
-   m_pFirstBlock = m_pCurrBlock = m_pLastBlock = m_pBlock;
-
    pthread_mutex_init(&m_BufLock, NULL);
 }
 
 CSndBuffer::~CSndBuffer()
 {
-   Block* pb = m_pBlock->m_pNext;
-   while (pb != m_pBlock)
+   // Give back the memory of the packets not retired yet, and the
+   // buffers of the zero-copy messages.
+   while (m_iFirstPos != m_iLastPos)
    {
-      Block* temp = pb;
-      pb = pb->m_pNext;
-      delete temp;
+      retireFirst();
+      m_iFirstPos = nextPos(m_iFirstPos);
    }
-   delete m_pBlock;
+   for (size_t i = 0; i < m_vRetired.size(); ++ i)
+      m_vRetired[i].run();
 
-   while (m_pBuffer != NULL)
-   {
-      Buffer* temp = m_pBuffer;
-      m_pBuffer = m_pBuffer->m_pNext;
-      delete [] temp->m_pcData;
-      delete temp;
-   }
+   releaseFreed();
+   if (!m_vReserved.empty())
+      m_pPool->release(&m_vReserved[0], m_vReserved.size());
+
+   delete [] m_pBlock;
 
    pthread_mutex_destroy(&m_BufLock);
 }
 
-void CSndBuffer::addBuffer(const char* data, int len, int ttl, bool order, uint64_t srctime, ref_t<int32_t> r_msgno)
+bool CSndBuffer::addBuffer(const char* data, int len, int ttl, bool order, uint64_t srctime, ref_t<int32_t> r_msgno)
+{
+    SRT_SEGMENT seg;
+    seg.data = const_cast<char*>(data);
+    seg.len = len;
+    return insert(&seg, len, ttl, order, srctime, NULL, *r_msgno);
+}
+
+void CSndBuffer::addBufferRef(const char* data, int len, int ttl, bool order, uint64_t srctime,
+        const CSndCompletion& done, ref_t<int32_t> r_msgno)
 {
-    int32_t& msgno = *r_msgno;
+    SRT_SEGMENT seg;
+    seg.data = const_cast<char*>(data);
+    seg.len = len;
+    insert(&seg, len, ttl, order, srctime, &done, *r_msgno);
+}
+
+bool CSndBuffer::addBufferV(const SRT_SEGMENT* segs, int len, int ttl, bool order, uint64_t srctime, ref_t<int32_t> r_msgno)
+{
+    return insert(segs, len, ttl, order, srctime, NULL, *r_msgno);
+}
+
+bool CSndBuffer::reserve(int len, uint64_t timeout_us)
+{
+    int size = (len + m_iMSS - 1) / m_iMSS;
+    int have = m_vReserved.size();
+    if (have >= size)
+        return true;
+
+    m_vReserved.resize(size);
+    if (!m_pPool->acquire(&m_vReserved[have], size - have, timeout_us))
+    {
+        m_vReserved.resize(have);
+        return false;
+    }
+    m_iAcquired += size - have;
+    return true;
+}
 
+// With done, segs is a single segment.
+bool CSndBuffer::insert(const SRT_SEGMENT* segs, int len, int ttl, bool order, uint64_t srctime,
+        const CSndCompletion* done, int32_t& msgno)
+{
     int size = len / m_iMSS;
     if ((len % m_iMSS) != 0)
         size ++;
 
+    // The user's buffer is sent as is, without the memory of the pool.
+    if (!done && !reserve(len, 0))
+        return false;
+
     HLOGC(mglog.Debug, log << "addBuffer: size=" << m_iCount << " reserved=" << m_iSize << " needs=" << size << " buffers for " << len << " bytes");
 
     // dynamically increase sender buffer
@@ -164,16 +197,41 @@ void CSndBuffer::addBuffer(const char* data, int len, int ttl, bool order, uint6
         << size << " packets (" << len << " bytes) to send, msgno=" << m_iNextMsgNo
         << (inorder ? "" : " NOT") << " in order");
 
-    Block* s = m_pLastBlock;
+    int pos = m_iLastPos;
     msgno = m_iNextMsgNo;
+    int seg = 0, segpos = 0; // where the next packet starts in segs
     for (int i = 0; i < size; ++ i)
     {
         int pktlen = len - i * m_iMSS;
         if (pktlen > m_iMSS)
             pktlen = m_iMSS;
 
-        HLOGC(dlog.Debug, log << "addBuffer: spreading from=" << (i*m_iMSS) << " size=" << pktlen << " TO BUFFER:" << (void*)s->m_pcData);
-        memcpy(s->m_pcData, data + i * m_iMSS, pktlen);
+        Block* s = &m_pBlock[pos];
+        if (done)
+        {
+            s->m_pcRef = segs[0].data + i * m_iMSS;
+        }
+        else
+        {
+            s->m_pcData = m_vReserved.back();
+            m_vReserved.pop_back();
+            HLOGC(dlog.Debug, log << "addBuffer: spreading from=" << (i*m_iMSS) << " size=" << pktlen << " TO BUFFER:" << (void*)s->m_pcData);
+            char* dst = s->m_pcData;
+            for (int left = pktlen; left > 0; )
+            {
+                int chunk = min(left, segs[seg].len - segpos);
+                memcpy(dst, segs[seg].data + segpos, chunk);
+                dst += chunk;
+                left -= chunk;
+                segpos += chunk;
+                if (segpos == segs[seg].len)
+                {
+                    ++ seg;
+                    segpos = 0;
+                }
+            }
+            s->m_pcRef = NULL;
+        }
         s->m_iLength = pktlen;
 
         s->m_iMsgNoBitset = m_iNextMsgNo | inorder;
@@ -192,11 +250,13 @@ void CSndBuffer::addBuffer(const char* data, int len, int ttl, bool order, uint6
         s->m_ullOriginTime_us = time;
         s->m_iTTL = ttl;
 
-        // XXX unchecked condition: s->m_pNext == NULL.
-        // Should never happen, as the call to increase() should ensure enough buffers.
-        s = s->m_pNext;
+        // The last packet to be retired gives the user's buffer back.
+        if (done && i == size - 1)
+            s->m_pDone = new CSndCompletion(*done);
+
+        pos = nextPos(pos);
     }
-    m_pLastBlock = s;
+    m_iLastPos = pos;
 
     CGuard::enterCS(m_BufLock);
     m_iCount += size;
@@ -222,6 +282,8 @@ void CSndBuffer::addBuffer(const char* data, int len, int ttl, bool order, uint6
     m_iNextMsgNo ++;
     if (m_iNextMsgNo == int32_t(MSGNO_SEQ::mask))
         m_iNextMsgNo = 1;
+
+    return true;
 }
 
 void CSndBuffer::setInputRateSmpPeriod(int period)
@@ -301,11 +363,17 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
       increase();
    }
 
+   if (!reserve(len, 0))
+      return -1;
+
    HLOGC(dlog.Debug, log << CONID() << "addBufferFromFile: adding "
        << size << " packets (" << len << " bytes) to send, msgno=" << m_iNextMsgNo);
 
-   Block* s = m_pLastBlock;
+   // A block is taken only for a packet that was read; if the file ends
+   // earlier, the rest stay reserved for the next packets.
+   int pos = m_iLastPos;
    int total = 0;
+   int pkts = 0;
    for (int i = 0; i < size; ++ i)
    {
       if (ifs.bad() || ifs.fail() || ifs.eof())
@@ -315,11 +383,16 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
       if (pktlen > m_iMSS)
          pktlen = m_iMSS;
 
-      HLOGC(dlog.Debug, log << "addBufferFromFile: reading from=" << (i*m_iMSS) << " size=" << pktlen << " TO BUFFER:" << (void*)s->m_pcData);
-      ifs.read(s->m_pcData, pktlen);
+      Block* s = &m_pBlock[pos];
+      char* data = m_vReserved.back();
+      HLOGC(dlog.Debug, log << "addBufferFromFile: reading from=" << (i*m_iMSS) << " size=" << pktlen << " TO BUFFER:" << (void*)data);
+      ifs.read(data, pktlen);
       if ((pktlen = int(ifs.gcount())) <= 0)
          break;
 
+      m_vReserved.pop_back();
+      s->m_pcData = data;
+
       // currently file transfer is only available in streaming mode, message is always in order, ttl = infinite
       s->m_iMsgNoBitset = m_iNextMsgNo | MSGNO_PACKET_INORDER::mask;
       if (i == 0)
@@ -331,14 +404,15 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
 
       s->m_iLength = pktlen;
       s->m_iTTL = -1;
-      s = s->m_pNext;
+      pos = nextPos(pos);
 
       total += pktlen;
+      ++ pkts;
    }
-   m_pLastBlock = s;
+   m_iLastPos = pos;
 
    CGuard::enterCS(m_BufLock);
-   m_iCount += size;
+   m_iCount += pkts;
    m_iBytesCount += total;
 
    CGuard::leaveCS(m_BufLock);
@@ -352,13 +426,18 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
 
 int CSndBuffer::readData(char** data, int32_t& msgno_bitset, uint64_t& srctime, int kflgs)
 {
+   // The array may be reallocated by increase() in the meantime.
+   CGuard bufferguard(m_BufLock);
+
    // No data to read
-   if (m_pCurrBlock == m_pLastBlock)
+   if (m_iCurrPos == m_iLastPos)
       return 0;
 
+   Block* p = &m_pBlock[m_iCurrPos];
+
    // Make the packet REFLECT the data stored in the buffer.
-   *data = m_pCurrBlock->m_pcData;
-   int readlen = m_pCurrBlock->m_iLength;
+   *data = p->m_pcRef ? const_cast<char*>(p->m_pcRef) : p->m_pcData;
+   int readlen = p->m_iLength;
 
    // XXX This is probably done because the encryption should happen
    // just once, and so this sets the encryption flags to both msgno bitset
@@ -391,15 +470,15 @@ int CSndBuffer::readData(char** data, int32_t& msgno_bitset, uint64_t& srctime,
    }
    else
    {
-       m_pCurrBlock->m_iMsgNoBitset |= MSGNO_ENCKEYSPEC::wrap(kflgs);
+       p->m_iMsgNoBitset |= MSGNO_ENCKEYSPEC::wrap(kflgs);
    }
-   msgno_bitset = m_pCurrBlock->m_iMsgNoBitset;
+   msgno_bitset = p->m_iMsgNoBitset;
 
    srctime =
-      m_pCurrBlock->m_ullSourceTime_us ? m_pCurrBlock->m_ullSourceTime_us :
-      m_pCurrBlock->m_ullOriginTime_us;
+      p->m_ullSourceTime_us ? p->m_ullSourceTime_us :
+      p->m_ullOriginTime_us;
 
-   m_pCurrBlock = m_pCurrBlock->m_pNext;
+   m_iCurrPos = nextPos(m_iCurrPos);
 
    HLOGC(dlog.Debug, log << CONID() << "CSndBuffer: extracting packet size=" << readlen << " to send");
 
@@ -410,17 +489,16 @@ int CSndBuffer::readData(char** data, const int offset, int32_t& msgno_bitset, u
 {
    CGuard bufferguard(m_BufLock);
 
-   Block* p = m_pFirstBlock;
+   // The block is found by its position in the array.
+   int pos = m_iFirstPos + offset;
+   if (pos >= m_iSize)
+      pos -= m_iSize;
+   Block* p = &m_pBlock[pos];
 
-   // XXX Suboptimal procedure to keep the blocks identifiable
-   // by sequence number. Consider using some circular buffer.
-   for (int i = 0; i < offset; ++ i)
-      p = p->m_pNext;
-
-   // Check if the block that is the next candidate to send (m_pCurrBlock pointing) is stale.
+   // Check if the block that is the next candidate to send (at m_iCurrPos) is stale.
 
    // If so, then inform the caller that it should first take care of the whole
-   // message (all blocks with that message id). Shift the m_pCurrBlock pointer
+   // message (all blocks with that message id). Shift m_iCurrPos
    // to the position past the last of them. Then return -1 and set the
    // msgno_bitset return reference to the message id that should be dropped as
    // a whole.
@@ -435,15 +513,15 @@ int CSndBuffer::readData(char** data, const int offset, int32_t& msgno_bitset, u
    {
       int32_t msgno = p->getMsgSeq();
       msglen = 1;
-      p = p->m_pNext;
+      pos = nextPos(pos);
       bool move = false;
-      while (msgno == p->getMsgSeq())
+      while (msgno == m_pBlock[pos].getMsgSeq())
       {
-         if (p == m_pCurrBlock)
+         if (pos == m_iCurrPos)
             move = true;
-         p = p->m_pNext;
+         pos = nextPos(pos);
          if (move)
-            m_pCurrBlock = p;
+            m_iCurrPos = pos;
          msglen ++;
       }
 
@@ -456,7 +534,7 @@ int CSndBuffer::readData(char** data, const int offset, int32_t& msgno_bitset, u
       return -1;
    }
 
-   *data = p->m_pcData;
+   *data = p->m_pcRef ? const_cast<char*>(p->m_pcRef) : p->m_pcData;
    int readlen = p->m_iLength;
 
    // XXX Here the value predicted to be applied to PH_MSGNO field is extracted.
@@ -483,13 +561,14 @@ void CSndBuffer::ackData(int offset)
    bool move = false;
    for (int i = 0; i < offset; ++ i)
    {
-      m_iBytesCount -= m_pFirstBlock->m_iLength;
-      if (m_pFirstBlock == m_pCurrBlock)
+      m_iBytesCount -= m_pBlock[m_iFirstPos].m_iLength;
+      if (m_iFirstPos == m_iCurrPos)
           move = true;
-      m_pFirstBlock = m_pFirstBlock->m_pNext;
+      retireFirst();
+      m_iFirstPos = nextPos(m_iFirstPos);
    }
    if (move)
-       m_pCurrBlock = m_pFirstBlock;
+       m_iCurrPos = m_iFirstPos;
 
    m_iCount -= offset;
 
@@ -500,6 +579,48 @@ void CSndBuffer::ackData(int offset)
    CTimer::triggerEvent();
 }
 
+void CSndBuffer::retireFirst()
+{
+   Block* b = &m_pBlock[m_iFirstPos];
+   b->m_pcRef = NULL;
+   if (b->m_pcData)
+   {
+      m_vFreed.push_back(b->m_pcData);
+      b->m_pcData = NULL;
+   }
+   if (b->m_pDone)
+   {
+      m_vRetired.push_back(*b->m_pDone);
+      delete b->m_pDone;
+      b->m_pDone = NULL;
+   }
+}
+
+// At the destruction, when nothing is sent from this buffer anymore.
+void CSndBuffer::releaseFreed()
+{
+   if (m_vFreed.empty())
+      return;
+
+   m_pPool->release(&m_vFreed[0], m_vFreed.size());
+   m_iReleased += m_vFreed.size();
+   m_vFreed.clear();
+}
+
+bool CSndBuffer::takeRetired(std::vector<CSndCompletion>& w_done, std::vector<char*>& w_freed)
+{
+   CGuard bufferguard(m_BufLock);
+   if (m_vRetired.empty() && m_vFreed.empty())
+      return false;
+
+   w_done.insert(w_done.end(), m_vRetired.begin(), m_vRetired.end());
+   m_vRetired.clear();
+   w_freed.insert(w_freed.end(), m_vFreed.begin(), m_vFreed.end());
+   m_iReleased += m_vFreed.size();
+   m_vFreed.clear();
+   return true;
+}
+
 int CSndBuffer::getCurrBufSize() const
 {
    return m_iCount;
@@ -531,7 +652,7 @@ void CSndBuffer::updAvgBufSize(uint64_t now)
    if (1000000 < elapsed)
    {
       /* No sampling in last 1 sec, initialize average */
-      m_iCountMAvg = getCurrBufSize(Ref(m_iBytesCountMAvg), Ref(m_TimespanMAvg));
+      m_iCountMAvg = getCurrBufSizeNoLock(m_iBytesCountMAvg, m_TimespanMAvg);
       m_LastSamplingTime = now;
    } 
    else //((1000000 / SRT_MAVG_SAMPLING_RATE) / 1000 <= elapsed)
@@ -545,7 +666,7 @@ void CSndBuffer::updAvgBufSize(uint64_t now)
       */
       int instspan;
       int bytescount;
-      int count = getCurrBufSize(Ref(bytescount), Ref(instspan));
+      int count = getCurrBufSizeNoLock(bytescount, instspan);
 
       HLOGF(dlog.Debug, "updAvgBufSize: %6llu: %6d %6d %6d ms\n",
               (unsigned long long)elapsed, count, bytescount, instspan);
@@ -561,13 +682,19 @@ void CSndBuffer::updAvgBufSize(uint64_t now)
 
 int CSndBuffer::getCurrBufSize(ref_t<int> bytes, ref_t<int> timespan)
 {
-   *bytes = m_iBytesCount;
+   CGuard bufferguard(m_BufLock);
+   return getCurrBufSizeNoLock(*bytes, *timespan);
+}
+
+int CSndBuffer::getCurrBufSizeNoLock(int& bytes, int& timespan)
+{
+   bytes = m_iBytesCount;
    /* 
    * Timespan can be less then 1000 us (1 ms) if few packets. 
    * Also, if there is only one pkt in buffer, the time difference will be 0.
    * Therefore, always add 1 ms if not empty.
    */
-   *timespan = 0 < m_iCount ? int((m_ullLastOriginTime_us - m_pFirstBlock->m_ullOriginTime_us) / 1000) + 1 : 0;
+   timespan = 0 < m_iCount ? int((m_ullLastOriginTime_us - m_pBlock[m_iFirstPos].m_ullOriginTime_us) / 1000) + 1 : 0;
 
    return m_iCount;
 }
@@ -579,15 +706,16 @@ int CSndBuffer::dropLateData(int &bytes, uint64_t latetime)
    bool move = false;
 
    CGuard bufferguard(m_BufLock);
-   for (int i = 0; i < m_iCount && m_pFirstBlock->m_ullOriginTime_us < latetime; ++ i)
+   for (int i = 0; i < m_iCount && m_pBlock[m_iFirstPos].m_ullOriginTime_us < latetime; ++ i)
    {
       dpkts++;
-      dbytes += m_pFirstBlock->m_iLength;
+      dbytes += m_pBlock[m_iFirstPos].m_iLength;
 
-      if (m_pFirstBlock == m_pCurrBlock) move = true;
-      m_pFirstBlock = m_pFirstBlock->m_pNext;
+      if (m_iFirstPos == m_iCurrPos) move = true;
+      retireFirst();
+      m_iFirstPos = nextPos(m_iFirstPos);
    }
-   if (move) m_pCurrBlock = m_pFirstBlock;
+   if (move) m_iCurrPos = m_iFirstPos;
    m_iCount -= dpkts;
 
    m_iBytesCount -= dbytes;
@@ -603,64 +731,50 @@ int CSndBuffer::dropLateData(int &bytes, uint64_t latetime)
 
 void CSndBuffer::increase()
 {
-   int unitsize = m_pBuffer->m_iSize;
-
-   // new physical buffer
-   Buffer* nbuf = NULL;
-   try
-   {
-      nbuf  = new Buffer;
-      nbuf->m_pcData = new char [unitsize * m_iMSS];
-   }
-   catch (...)
-   {
-      delete nbuf;
-      throw CUDTException(MJ_SYSTEMRES, MN_MEMORY, 0);
-   }
-   nbuf->m_iSize = unitsize;
-   nbuf->m_pNext = NULL;
-
-   // insert the buffer at the end of the buffer list
-   Buffer* p = m_pBuffer;
-   while (p->m_pNext != NULL)
-      p = p->m_pNext;
-   p->m_pNext = nbuf;
+   // Grown at least twice, so that the blocks are copied only a few times.
+   int unitsize = max(m_iIncrement, m_iSize);
 
-   // new packet blocks
+   // new packet blocks; their memory is taken from m_pPool when used
    Block* nblk = NULL;
    try
    {
-      nblk = new Block;
+      nblk = new Block[m_iSize + unitsize];
    }
    catch (...)
    {
-      delete nblk;
       throw CUDTException(MJ_SYSTEMRES, MN_MEMORY, 0);
    }
-   Block* pb = nblk;
-   for (int i = 1; i < unitsize; ++ i)
-   {
-      pb->m_pNext = new Block;
-      pb = pb->m_pNext;
-   }
 
-   // insert the new blocks onto the existing one
-   pb->m_pNext = m_pLastBlock->m_pNext;
-   m_pLastBlock->m_pNext = nblk;
+   CGuard bufferguard(m_BufLock);
 
-   pb = nblk;
-   char* pc = nbuf->m_pcData;
-   for (int i = 0; i < unitsize; ++ i)
+   // The blocks in use are moved to the beginning of the new array.
+   int used = m_iLastPos - m_iFirstPos;
+   if (used < 0)
+      used += m_iSize;
+   int sent = m_iCurrPos - m_iFirstPos;
+   if (sent < 0)
+      sent += m_iSize;
+
+   int tail = min(used, m_iSize - m_iFirstPos);
+   memcpy(nblk, m_pBlock + m_iFirstPos, tail * sizeof(Block));
+   memcpy(nblk + tail, m_pBlock, (used - tail) * sizeof(Block));
+   for (int i = used; i < m_iSize + unitsize; ++ i)
    {
-      pb->m_pcData = pc;
-      pb = pb->m_pNext;
-      pc += m_iMSS;
+      nblk[i].m_pcData = NULL;
+      nblk[i].m_pcRef = NULL;
+      nblk[i].m_iMsgNoBitset = 0;
+      nblk[i].m_pDone = NULL;
    }
 
+   delete [] m_pBlock;
+   m_pBlock = nblk;
+   m_iFirstPos = 0;
+   m_iCurrPos = sent;
+   m_iLastPos = used;
    m_iSize += unitsize;
 
-   HLOGC(dlog.Debug, log << "CSndBuffer: BUFFER FULL - adding " << (unitsize*m_iMSS) << " bytes spread to " << unitsize << " blocks"
-       << " (total size: " << m_iSize << " bytes)");
+   HLOGC(dlog.Debug, log << "CSndBuffer: BUFFER FULL - adding " << unitsize << " blocks"
+       << " (total size: " << m_iSize << " blocks)");
 
 }
 
@@ -681,6 +795,7 @@ void CSndBuffer::increase()
 *             \___ m_iStartPos: first message to read
 *                      
 *   m_pUnit[i]->m_iFlag: 0:free, 1:good, 2:passack, 3:dropped
+*   m_pSlot[i]: the flag and the header fields of m_pUnit[i] that the scans use
 * 
 *   thread safety:
 *    m_iStartPos:   CUDT::m_RecvLock 
@@ -699,12 +814,22 @@ void CSndBuffer::increase()
 
 CRcvBuffer::CRcvBuffer(CUnitQueue* queue, int bufsize):
 m_pUnit(NULL),
-m_iSize(bufsize),
+m_pSlot(NULL),
+m_iSize(std::min(bufsize, int(INITIAL_SIZE))),
+m_iMaxSize(bufsize),
 m_pUnitQueue(queue),
+m_iHighWater(0),
+m_iPeriodPeak(0),
+m_ullPeriodStart(CTimer::getTime()),
 m_iStartPos(0),
 m_iLastAckPos(0),
 m_iMaxPos(0),
 m_iNotch(0)
+,m_vBorrowed()
+,m_vSpareBorrowed()
+,m_iBorrowedUnits(0)
+,m_iUnitsIn(0)
+,m_iUnitsOut(0)
 ,m_BytesCountLock()
 ,m_iBytesCount(0)
 ,m_iAckedPktsCount(0)
@@ -725,8 +850,12 @@ m_iNotch(0)
 #endif
 {
    m_pUnit = new CUnit* [m_iSize];
+   m_pSlot = new Slot [m_iSize];
    for (int i = 0; i < m_iSize; ++ i)
+   {
       m_pUnit[i] = NULL;
+      m_pSlot[i].m_iFlag = CUnit::FREE;
+   }
 
 #ifdef SRT_DEBUG_TSBPD_DRIFT
    memset(m_TsbPdDriftHisto100us, 0, sizeof(m_TsbPdDriftHisto100us));
@@ -734,10 +863,13 @@ m_iNotch(0)
 #endif
 
    pthread_mutex_init(&m_BytesCountLock, NULL);
+   CMemBudget::addReceiver();
 }
 
 CRcvBuffer::~CRcvBuffer()
 {
+   CMemBudget::removeReceiver();
+
    for (int i = 0; i < m_iSize; ++ i)
    {
       if (m_pUnit[i] != NULL)
@@ -747,7 +879,15 @@ CRcvBuffer::~CRcvBuffer()
       }
    }
 
+   // The messages still lent are gone with the socket.
+   for (size_t i = 0; i < m_vBorrowed.size(); ++ i)
+   {
+      releaseMsg(i);
+      delete m_vBorrowed[i];
+   }
+
    delete [] m_pUnit;
+   delete [] m_pSlot;
 
    pthread_mutex_destroy(&m_BytesCountLock);
 }
@@ -792,12 +932,118 @@ int CRcvBuffer::addData(CUnit* unit, int offset)
    m_pUnit[pos] = unit;
    countBytes(1, unit->m_Packet.getLength());
 
+   // The crypto flags are cleared later, when the packet is decrypted.
+   const CPacket& pkt = unit->m_Packet;
+   Slot& slot = m_pSlot[pos];
+   slot.m_iSeqNo = pkt.m_iSeqNo;
+   slot.m_iMsgNoBitset = pkt.m_iMsgNo & ~MSGNO_ENCKEYSPEC::mask;
+   slot.m_uTimestamp = pkt.getMsgTimeStamp();
+   slot.m_iLength = pkt.getLength();
+
    unit->m_iFlag = CUnit::GOOD;
+   slot.m_iFlag = CUnit::GOOD;
    ++ m_pUnitQueue->m_iCount;
+   ++ m_iUnitsIn;
+
+   int used = getRcvDataSize() + m_iMaxPos;
+   if (used > m_iPeriodPeak)
+   {
+      m_iPeriodPeak = used;
+      if (used > m_iHighWater)
+         m_iHighWater = used;
+   }
 
    return 0;
 }
 
+bool CRcvBuffer::grow(int offset)
+{
+   int need = getRcvDataSize() + offset + 2;
+   if (need <= m_iSize)
+      return true;
+
+   int size = std::min(std::max(m_iSize * 2, need), m_iMaxSize);
+   if (size < need)
+      return false;
+
+   HLOGC(dlog.Debug, log << "CRcvBuffer: growing from " << m_iSize << " to " << size << " for offset " << offset);
+   return resize(size);
+}
+
+bool CRcvBuffer::isShrinkDue(uint64_t now)
+{
+   if (now - m_ullPeriodStart < SHRINK_PERIOD_US)
+      return false;
+
+   // Halve it only when a quarter of it was enough for the whole period,
+   // so that it doesn't grow back right away.
+   bool due = m_iSize > INITIAL_SIZE && m_iPeriodPeak < m_iSize / 4;
+   m_ullPeriodStart = now;
+   m_iPeriodPeak = getRcvDataSize() + m_iMaxPos;
+   return due;
+}
+
+void CRcvBuffer::shrink()
+{
+   int size = std::max(m_iSize / 2, int(INITIAL_SIZE));
+   if (getRcvDataSize() + m_iMaxPos + 1 >= size)
+      return;
+
+   HLOGC(dlog.Debug, log << "CRcvBuffer: shrinking from " << m_iSize << " to " << size);
+   resize(size);
+}
+
+// The positions in use are moved to the beginning.
+bool CRcvBuffer::resize(int size)
+{
+   CUnit** units = new (std::nothrow) CUnit* [size];
+   Slot* slots = new (std::nothrow) Slot [size];
+   if (!units || !slots)
+   {
+      delete [] units;
+      delete [] slots;
+      return false;
+   }
+
+   int acked = getRcvDataSize();
+   int used = acked + m_iMaxPos;
+   for (int i = 0; i < used; ++ i)
+   {
+      int pos = (m_iStartPos + i) % m_iSize;
+      units[i] = m_pUnit[pos];
+      slots[i] = m_pSlot[pos];
+   }
+   for (int i = used; i < size; ++ i)
+   {
+      units[i] = NULL;
+      slots[i].m_iFlag = CUnit::FREE;
+   }
+
+   delete [] m_pUnit;
+   delete [] m_pSlot;
+   m_pUnit = units;
+   m_pSlot = slots;
+   m_iSize = size;
+   m_iStartPos = 0;
+   m_iLastAckPos = acked;
+   return true;
+}
+
+void CRcvBuffer::setFlag(int pos, CUnit::Flag flag)
+{
+   m_pUnit[pos]->m_iFlag = flag;
+   m_pSlot[pos].m_iFlag = flag;
+}
+
+// The unit is removed from the position; its own flag is left to the caller.
+CUnit* CRcvBuffer::takeUnit(int pos)
+{
+   CUnit* unit = m_pUnit[pos];
+   m_pUnit[pos] = NULL;
+   m_pSlot[pos].m_iFlag = CUnit::FREE;
+   return unit;
+}
+
 int CRcvBuffer::readBuffer(char* data, int len)
 {
    int p = m_iStartPos;
@@ -814,8 +1060,8 @@ int CRcvBuffer::readBuffer(char* data, int len)
    {
       if (m_bTsbPdMode)
       {
-          HLOGC(dlog.Debug, log << CONID() << "readBuffer: chk if time2play: NOW=" << now << " PKT TS=" << getPktTsbPdTime(m_pUnit[p]->m_Packet.getMsgTimeStamp()));
-          if ((getPktTsbPdTime(m_pUnit[p]->m_Packet.getMsgTimeStamp()) > now))
+          HLOGC(dlog.Debug, log << CONID() << "readBuffer: chk if time2play: NOW=" << now << " PKT TS=" << getPktTsbPdTime(m_pSlot[p].m_uTimestamp));
+          if ((getPktTsbPdTime(m_pSlot[p].m_uTimestamp) > now))
               break; /* too early for this unit, return whatever was copied */
       }
 
@@ -830,10 +1076,10 @@ int CRcvBuffer::readBuffer(char* data, int len)
 
       if ((rs > unitsize) || (rs == int(m_pUnit[p]->m_Packet.getLength()) - m_iNotch))
       {
-         CUnit* tmp = m_pUnit[p];
-         m_pUnit[p] = NULL;
+         CUnit* tmp = takeUnit(p);
          tmp->m_iFlag = CUnit::FREE;
          -- m_pUnitQueue->m_iCount;
+         ++ m_iUnitsOut;
 
          if (++ p == m_iSize)
             p = 0;
@@ -871,10 +1117,10 @@ int CRcvBuffer::readBufferToFile(fstream& ofs, int len)
 
       if ((rs > unitsize) || (rs == int(m_pUnit[p]->m_Packet.getLength()) - m_iNotch))
       {
-         CUnit* tmp = m_pUnit[p];
-         m_pUnit[p] = NULL;
+         CUnit* tmp = takeUnit(p);
          tmp->m_iFlag = CUnit::FREE;
          -- m_pUnitQueue->m_iCount;
+         ++ m_iUnitsOut;
 
          if (++ p == m_iSize)
             p = 0;
@@ -901,10 +1147,10 @@ void CRcvBuffer::ackData(int len)
       int bytes = 0;
       for (int i = m_iLastAckPos, n = (m_iLastAckPos + len) % m_iSize; i != n; i = (i + 1) % m_iSize)
       {
-          if (m_pUnit[i] != NULL)
+          if (m_pSlot[i].m_iFlag != CUnit::FREE)
           {
               pkts++;
-              bytes += m_pUnit[i]->m_Packet.getLength();
+              bytes += m_pSlot[i].m_iLength;
           }
       }
       if (pkts > 0) countBytes(pkts, bytes, true);
@@ -1000,8 +1246,7 @@ bool CRcvBuffer::getRcvFirstMsg(ref_t<uint64_t> r_tsbpdtime, ref_t<bool> r_passa
 
     for (int i = m_iLastAckPos, n = (m_iLastAckPos + m_iMaxPos) % m_iSize; i != n; i = (i + 1) % m_iSize)
     {
-        if ( !m_pUnit[i]
-                || m_pUnit[i]->m_iFlag != CUnit::GOOD )
+        if (m_pSlot[i].m_iFlag != CUnit::GOOD)
         {
             /* There are packets in the sequence not received yet */
             haslost = true;
@@ -1009,7 +1254,7 @@ bool CRcvBuffer::getRcvFirstMsg(ref_t<uint64_t> r_tsbpdtime, ref_t<bool> r_passa
         else
         {
             /* We got the 1st valid packet */
-            *r_tsbpdtime = getPktTsbPdTime(m_pUnit[i]->m_Packet.getMsgTimeStamp());
+            *r_tsbpdtime = getPktTsbPdTime(m_pSlot[i].m_uTimestamp);
             if (*r_tsbpdtime <= CTimer::getTime())
             {
                 /* Packet ready to play */
@@ -1019,7 +1264,7 @@ bool CRcvBuffer::getRcvFirstMsg(ref_t<uint64_t> r_tsbpdtime, ref_t<bool> r_passa
                      * Packet stuck on non-acked side because of missing packets.
                      * Tell 1st valid packet seqno so caller can skip (drop) the missing packets.
                      */
-                    skipseqno = m_pUnit[i]->m_Packet.m_iSeqNo;
+                    skipseqno = m_pSlot[i].m_iSeqNo;
                     *r_curpktseq = skipseqno;
                 }
 
@@ -1054,22 +1299,22 @@ bool CRcvBuffer::getRcvReadyMsg(ref_t<uint64_t> tsbpdtime, ref_t<int32_t> curpkt
         bool freeunit = false;
 
         /* Skip any invalid skipped/dropped packets */
-        if (m_pUnit[i] == NULL)
+        if (m_pSlot[i].m_iFlag == CUnit::FREE)
         {
             if (++ m_iStartPos == m_iSize)
                 m_iStartPos = 0;
             continue;
         }
 
-        *curpktseq = m_pUnit[i]->m_Packet.getSeqNo();
+        *curpktseq = m_pSlot[i].m_iSeqNo;
 
-        if (m_pUnit[i]->m_iFlag != CUnit::GOOD)
+        if (m_pSlot[i].m_iFlag != CUnit::GOOD)
         {
             freeunit = true;
         }
         else
         {
-            *tsbpdtime = getPktTsbPdTime(m_pUnit[i]->m_Packet.getMsgTimeStamp());
+            *tsbpdtime = getPktTsbPdTime(m_pSlot[i].m_uTimestamp);
             int64_t towait = (*tsbpdtime - CTimer::getTime());
             if (towait > 0)
             {
@@ -1091,12 +1336,12 @@ bool CRcvBuffer::getRcvReadyMsg(ref_t<uint64_t> tsbpdtime, ref_t<int32_t> curpkt
 
         if (freeunit)
         {
-            CUnit* tmp = m_pUnit[i];
-            m_pUnit[i] = NULL;
+            CUnit* tmp = takeUnit(i);
             rmpkts++;
-            rmbytes += tmp->m_Packet.getLength();
+            rmbytes += m_pSlot[i].m_iLength;
             tmp->m_iFlag = CUnit::FREE;
             --m_pUnitQueue->m_iCount;
+            ++ m_iUnitsOut;
 
             if (++m_iStartPos == m_iSize)
                 m_iStartPos = 0;
@@ -1125,16 +1370,16 @@ bool CRcvBuffer::isRcvDataReady(ref_t<uint64_t> tsbpdtime, ref_t<int32_t> curpkt
 
    if (m_bTsbPdMode)
    {
-       CPacket* pkt = getRcvReadyPacket();
-       if ( pkt )
+       int pos = getRcvReadyPos();
+       if (pos != -1)
        {
             /* 
             * Acknowledged data is available,
             * Only say ready if time to deliver.
             * Report the timestamp, ready or not.
             */
-            *curpktseq = pkt->getSeqNo();
-            *tsbpdtime = getPktTsbPdTime(pkt->getMsgTimeStamp());
+            *curpktseq = m_pSlot[pos].m_iSeqNo;
+            *tsbpdtime = getPktTsbPdTime(m_pSlot[pos].m_uTimestamp);
             if (*tsbpdtime <= CTimer::getTime())
                return true;
        }
@@ -1147,17 +1392,23 @@ bool CRcvBuffer::isRcvDataReady(ref_t<uint64_t> tsbpdtime, ref_t<int32_t> curpkt
 // XXX This function may be called only after checking
 // if m_bTsbPdMode.
 CPacket* CRcvBuffer::getRcvReadyPacket()
+{
+    int pos = getRcvReadyPos();
+    return pos != -1 ? &m_pUnit[pos]->m_Packet : 0;
+}
+
+int CRcvBuffer::getRcvReadyPos()
 {
     for (int i = m_iStartPos, n = m_iLastAckPos; i != n; i = (i + 1) % m_iSize)
     {
         /* 
          * Skip missing packets that did not arrive in time.
          */
-        if ( m_pUnit[i] && m_pUnit[i]->m_iFlag == CUnit::GOOD )
-            return &m_pUnit[i]->m_Packet;
+        if (m_pSlot[i].m_iFlag == CUnit::GOOD)
+            return i;
     }
 
-    return 0;
+    return -1;
 }
 
 bool CRcvBuffer::isRcvDataReady()
@@ -1171,7 +1422,7 @@ bool CRcvBuffer::isRcvDataReady()
 int CRcvBuffer::getAvailBufSize() const
 {
    // One slot must be empty in order to tell the difference between "empty buffer" and "full buffer"
-   return m_iSize - getRcvDataSize() - 1;
+   return m_iMaxSize - getRcvDataSize() - 1;
 }
 
 int CRcvBuffer::getRcvDataSize() const
@@ -1268,7 +1519,7 @@ int CRcvBuffer::getRcvDataSize(int &bytes, int &timespan)
       int i,n;
       for (i = m_iStartPos, n = m_iLastAckPos; i != n; i = (i + 1) % m_iSize)
       {
-         if ((NULL != m_pUnit[i]) && (CUnit::GOOD == m_pUnit[i]->m_iFlag))
+         if (CUnit::GOOD == m_pSlot[i].m_iFlag)
              break;
       }
 
@@ -1292,16 +1543,15 @@ int CRcvBuffer::getRcvDataSize(int &bytes, int &timespan)
          * Favor m_pUnits[m_iLastAckPos] if valid over [m_iLastAckPos-1] to include the whole acked interval.
          */
          if ((m_iMaxPos <= 0)
-                 || (!m_pUnit[m_iLastAckPos])
-                 || (m_pUnit[m_iLastAckPos]->m_iFlag != CUnit::GOOD))
+                 || (m_pSlot[m_iLastAckPos].m_iFlag != CUnit::GOOD))
          {
             endpos = (m_iLastAckPos == 0 ? m_iSize - 1 : m_iLastAckPos - 1);
          }
 
-         if ((NULL != m_pUnit[endpos]) && (NULL != m_pUnit[startpos]))
+         if ((CUnit::FREE != m_pSlot[endpos].m_iFlag) && (CUnit::FREE != m_pSlot[startpos].m_iFlag))
          {
-            uint64_t startstamp = getPktTsbPdTime(m_pUnit[startpos]->m_Packet.getMsgTimeStamp());
-            uint64_t endstamp = getPktTsbPdTime(m_pUnit[endpos]->m_Packet.getMsgTimeStamp());
+            uint64_t startstamp = getPktTsbPdTime(m_pSlot[startpos].m_uTimestamp);
+            uint64_t endstamp = getPktTsbPdTime(m_pSlot[endpos].m_uTimestamp);
             /* 
             * There are sampling conditions where spantime is < 0 (big unsigned value).
             * It has been observed after changing the SRT latency from 450 to 200 on the sender.
@@ -1342,9 +1592,12 @@ int CRcvBuffer::getRcvAvgPayloadSize() const
 void CRcvBuffer::dropMsg(int32_t msgno, bool using_rexmit_flag)
 {
    for (int i = m_iStartPos, n = (m_iLastAckPos + m_iMaxPos) % m_iSize; i != n; i = (i + 1) % m_iSize)
-      if ((m_pUnit[i] != NULL) 
-              && (m_pUnit[i]->m_Packet.getMsgSeq(using_rexmit_flag) == msgno))
-         m_pUnit[i]->m_iFlag = CUnit::DROPPED;
+   {
+      int32_t seq = using_rexmit_flag ? MSGNO_SEQ::unwrap(m_pSlot[i].m_iMsgNoBitset)
+         : MSGNO_SEQ_OLD::unwrap(m_pSlot[i].m_iMsgNoBitset);
+      if ((m_pSlot[i].m_iFlag != CUnit::FREE) && (seq == msgno))
+         setFlag(i, CUnit::DROPPED);
+   }
 }
 
 uint64_t CRcvBuffer::getTsbPdTimeBase(uint32_t timestamp)
@@ -1489,7 +1742,7 @@ void CRcvBuffer::printDriftOffset(int tsbPdOffset, int tsbPdDriftAvg)
 }
 #endif /* SRT_DEBUG_TSBPD_DRIFT */
 
-void CRcvBuffer::addRcvTsbPdDriftSample(uint32_t timestamp, pthread_mutex_t& mutex_to_lock)
+void CRcvBuffer::addRcvTsbPdDriftSample(uint32_t timestamp, pthread_mutex_t& mutex_to_lock, uint64_t arrival_time)
 {
     if (!m_bTsbPdMode) // Not checked unless in TSBPD mode
         return;
@@ -1511,7 +1764,12 @@ void CRcvBuffer::addRcvTsbPdDriftSample(uint32_t timestamp, pthread_mutex_t& mut
     // from the CONTROL domain, not DATA domain (timestamps from DATA domain may be
     // either schedule time or a time supplied by the application).
 
-    int64_t iDrift = CTimer::getTime() - (getTsbPdTimeBase(timestamp) + timestamp);
+    // The kernel receive timestamp, if available, isn't burdened with
+    // the delay in the receiver queue.
+    if (arrival_time == 0)
+        arrival_time = CTimer::getTime();
+
+    int64_t iDrift = arrival_time - (getTsbPdTimeBase(timestamp) + timestamp);
 
     CGuard::enterCS(mutex_to_lock);
 
@@ -1541,6 +1799,68 @@ int CRcvBuffer::readMsg(char* data, int len)
 
 
 int CRcvBuffer::readMsg(char* data, int len, ref_t<SRT_MSGCTRL> r_msgctl)
+{
+    SRT_SEGMENT seg;
+    seg.data = data;
+    seg.len = len;
+    return extractMsg(&seg, len, r_msgctl, NULL);
+}
+
+int CRcvBuffer::readMsgV(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> r_msgctl)
+{
+    return extractMsg(segs, len, r_msgctl, NULL);
+}
+
+CRcvBorrowed* CRcvBuffer::borrowMsg(ref_t<SRT_MSGCTRL> r_msgctl)
+{
+    CRcvBorrowed* msg;
+    if (m_vSpareBorrowed.empty())
+    {
+        msg = new CRcvBorrowed;
+        msg->m_iIndex = m_vBorrowed.size();
+        msg->m_bLent = false;
+        m_vBorrowed.push_back(msg);
+    }
+    else
+    {
+        msg = m_vBorrowed[m_vSpareBorrowed.back()];
+        m_vSpareBorrowed.pop_back();
+    }
+
+    msg->m_iLength = extractMsg(NULL, std::numeric_limits<int>::max(), r_msgctl, msg);
+    if (msg->m_vUnits.empty())
+    {
+        m_vSpareBorrowed.push_back(msg->m_iIndex);
+        return NULL;
+    }
+
+    msg->m_bLent = true;
+    m_iBorrowedUnits += msg->m_vUnits.size();
+    return msg;
+}
+
+bool CRcvBuffer::releaseMsg(int index)
+{
+    if (index < 0 || index >= int(m_vBorrowed.size()) || !m_vBorrowed[index]->m_bLent)
+        return false;
+
+    CRcvBorrowed* msg = m_vBorrowed[index];
+    for (size_t i = 0; i < msg->m_vUnits.size(); ++ i)
+    {
+        msg->m_vUnits[i]->m_iFlag = CUnit::FREE;
+        -- m_pUnitQueue->m_iCount;
+    }
+    m_iUnitsOut += msg->m_vUnits.size();
+
+    m_iBorrowedUnits -= msg->m_vUnits.size();
+    msg->m_vUnits.clear();
+    msg->m_vSegments.clear();
+    msg->m_bLent = false;
+    m_vSpareBorrowed.push_back(index);
+    return true;
+}
+
+int CRcvBuffer::extractMsg(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> r_msgctl, CRcvBorrowed* borrowed)
 {
     SRT_MSGCTRL& msgctl = *r_msgctl;
     int p, q;
@@ -1583,7 +1903,9 @@ int CRcvBuffer::readMsg(char* data, int len, ref_t<SRT_MSGCTRL> r_msgctl)
 
     }
 
-    if (empty)
+    // A message read out of order stays in the buffer until it's acknowledged,
+    // which can't be done with a message that is lent.
+    if (empty || (borrowed && passack))
         return 0;
 
     // This should happen just once. By 'empty' condition
@@ -1596,16 +1918,42 @@ int CRcvBuffer::readMsg(char* data, int len, ref_t<SRT_MSGCTRL> r_msgctl)
     msgctl.msgno = pkt1.getMsgSeq();
 
     int rs = len;
+    int seg = 0, segpos = 0; // where the next unit goes in segs
     while (p != (q + 1) % m_iSize)
     {
-        int unitsize = m_pUnit[p]->m_Packet.getLength();
+        int unitsize = m_pSlot[p].m_iLength;
         if ((rs >= 0) && (unitsize > rs))
             unitsize = rs;
 
+        if (borrowed)
+            borrowed->m_vUnits.push_back(m_pUnit[p]);
+
         if (unitsize > 0)
         {
-            memcpy(data, m_pUnit[p]->m_Packet.m_pcData, unitsize);
-            data += unitsize;
+            if (borrowed)
+            {
+                SRT_SEGMENT seg;
+                seg.data = m_pUnit[p]->m_Packet.m_pcData;
+                seg.len = unitsize;
+                borrowed->m_vSegments.push_back(seg);
+            }
+            else
+            {
+                const char* src = m_pUnit[p]->m_Packet.m_pcData;
+                for (int left = unitsize; left > 0; )
+                {
+                    int chunk = min(left, segs[seg].len - segpos);
+                    memcpy(segs[seg].data + segpos, src, chunk);
+                    src += chunk;
+                    left -= chunk;
+                    segpos += chunk;
+                    if (segpos == segs[seg].len)
+                    {
+                        ++ seg;
+                        segpos = 0;
+                    }
+                }
+            }
             rs -= unitsize;
             /* we removed bytes form receive buffer */
             countBytes(-1, -unitsize, true);
@@ -1635,15 +1983,20 @@ int CRcvBuffer::readMsg(char* data, int len, ref_t<SRT_MSGCTRL> r_msgctl)
 #endif
         }
 
-        if (!passack)
+        if (borrowed)
+        {
+            // Still counted as used in the unit queue, until releaseMsg().
+            takeUnit(p)->m_iFlag = CUnit::BORROWED;
+        }
+        else if (!passack)
         {
-            CUnit* tmp = m_pUnit[p];
-            m_pUnit[p] = NULL;
+            CUnit* tmp = takeUnit(p);
             tmp->m_iFlag = CUnit::FREE;
             -- m_pUnitQueue->m_iCount;
+            ++ m_iUnitsOut;
         }
         else
-            m_pUnit[p]->m_iFlag = CUnit::PASSACK;
+            setFlag(p, CUnit::PASSACK);
 
         if (++ p == m_iSize)
             p = 0;
@@ -1674,7 +2027,7 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
     while (m_iStartPos != m_iLastAckPos)
     {
         // Roll up to the first valid unit
-        if (!m_pUnit[m_iStartPos])
+        if (m_pSlot[m_iStartPos].m_iFlag == CUnit::FREE)
         {
             if (++ m_iStartPos == m_iSize)
                 m_iStartPos = 0;
@@ -1683,8 +2036,8 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
 
         // Note: PB_FIRST | PB_LAST == PB_SOLO.
         // testing if boundary() & PB_FIRST tests if the msg is first OR solo.
-        if ( m_pUnit[m_iStartPos]->m_iFlag == CUnit::GOOD
-                && m_pUnit[m_iStartPos]->m_Packet.getMsgBoundary() & PB_FIRST )
+        if ( m_pSlot[m_iStartPos].m_iFlag == CUnit::GOOD
+                && MSGNO_PACKET_BOUNDARY::unwrap(m_pSlot[m_iStartPos].m_iMsgNoBitset) & PB_FIRST )
         {
             bool good = true;
 
@@ -1704,14 +2057,14 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
             // will be interrupted.
             for (int i = m_iStartPos; i != m_iLastAckPos;)
             {
-                if (!m_pUnit[i] || m_pUnit[i]->m_iFlag != CUnit::GOOD)
+                if (m_pSlot[i].m_iFlag != CUnit::GOOD)
                 {
                     good = false;
                     break;
                 }
 
                 // Likewise, boundary() & PB_LAST will be satisfied for last OR solo.
-                if ( m_pUnit[i]->m_Packet.getMsgBoundary() & PB_LAST )
+                if ( MSGNO_PACKET_BOUNDARY::unwrap(m_pSlot[i].m_iMsgNoBitset) & PB_LAST )
                     break;
 
                 if (++ i == m_iSize)
@@ -1722,12 +2075,12 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
                 break;
         }
 
-        CUnit* tmp = m_pUnit[m_iStartPos];
-        m_pUnit[m_iStartPos] = NULL;
         rmpkts++;
-        rmbytes += tmp->m_Packet.getLength();
+        rmbytes += m_pSlot[m_iStartPos].m_iLength;
+        CUnit* tmp = takeUnit(m_iStartPos);
         tmp->m_iFlag = CUnit::FREE;
         -- m_pUnitQueue->m_iCount;
+        ++ m_iUnitsOut;
 
         if (++ m_iStartPos == m_iSize)
             m_iStartPos = 0;
@@ -1764,7 +2117,7 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
 
     for (int i = 0, n = m_iMaxPos + getRcvDataSize(); i < n; ++ i)
     {
-        if (m_pUnit[q] && m_pUnit[q]->m_iFlag == CUnit::GOOD)
+        if (m_pSlot[q].m_iFlag == CUnit::GOOD)
         {
             // Equivalent pseudocode:
             // PacketBoundary bound = m_pUnit[q]->m_Packet.getMsgBoundary();
@@ -1776,7 +2129,7 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
             // Not implemented this way because it uselessly check p for -1
             // also after setting it explicitly.
 
-            switch (m_pUnit[q]->m_Packet.getMsgBoundary())
+            switch (MSGNO_PACKET_BOUNDARY::unwrap(m_pSlot[q].m_iMsgNoBitset))
             {
             case PB_SOLO: // 11
                 p = q;
@@ -1807,7 +2160,7 @@ bool CRcvBuffer::scanMsg(ref_t<int> r_p, ref_t<int> r_q, ref_t<bool> passack)
         if (found)
         {
             // the msg has to be ack'ed or it is allowed to read out of order, and was not read before
-            if (!*passack || !m_pUnit[q]->m_Packet.getMsgOrderFlag())
+            if (!*passack || !MSGNO_PACKET_INORDER::unwrap(m_pSlot[q].m_iMsgNoBitset))
             {
                 HLOGC(mglog.Debug, log << "scanMsg: found next-to-broken message, delivering OUT OF ORDER.");
                 break;
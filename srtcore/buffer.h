@@ -58,7 +58,9 @@ modified by
 #include "list.h"
 #include "queue.h"
 #include "utilities.h"
+#include "mempool.h"
 #include <fstream>
+#include <vector>
 
 class CSndBuffer
 {
@@ -78,16 +80,50 @@ public:
       /// @param [in] len size of the block.
       /// @param [in] ttl time to live in milliseconds
       /// @param [in] order if the block should be delivered in order, for DGRAM only
+      /// @return false if the block pool can't supply the memory (see reserve()).
 
-   void addBuffer(const char* data, int len, int ttl, bool order, uint64_t srctime, ref_t<int32_t> r_msgno);
+   bool addBuffer(const char* data, int len, int ttl, bool order, uint64_t srctime, ref_t<int32_t> r_msgno);
+
+      /// Insert a user buffer without copying it: the packets point into it
+      /// until they are retired by ackData() or dropLateData(). Not for the
+      /// packets that are going to be encrypted, which happens in place.
+      /// @param [in] done what gives the buffer back, see takeRetired().
+
+   void addBufferRef(const char* data, int len, int ttl, bool order, uint64_t srctime,
+         const CSndCompletion& done, ref_t<int32_t> r_msgno);
+
+      /// Insert a user buffer given in pieces; the packets are filled from
+      /// the segments in turn.
+      /// @param [in] segs the segments, together at least len bytes.
+      /// @param [in] len size of the block.
+      /// @return false if the block pool can't supply the memory (see reserve()).
+
+   bool addBufferV(const SRT_SEGMENT* segs, int len, int ttl, bool order, uint64_t srctime, ref_t<int32_t> r_msgno);
 
       /// Read a block of data from file and insert it into the sending list.
       /// @param [in] ifs input file stream.
       /// @param [in] len size of the block.
-      /// @return actual size of data added from the file.
+      /// @return actual size of data added from the file, -1 if the block
+      /// pool can't supply the memory (see reserve()).
 
    int addBufferFromFile(std::fstream& ifs, int len);
 
+      /// Take the memory for the next packets from the block pool shared
+      /// by all sockets, which may be limited (see srt_setsndbufpool()).
+      /// The add functions do this themselves if needed, without waiting.
+      /// @param [in] len size of the data to be added.
+      /// @param [in] timeout_us how long to wait for the other buffers to
+      /// release memory, if the limit is reached.
+      /// @return false if the memory isn't available.
+
+   bool reserve(int len, uint64_t timeout_us);
+
+      /// Query the memory of the block pool held by this buffer, counted
+      /// in the limit of srt_setmemlimit().
+      /// @return size in bytes.
+
+   int64_t getMemUsed() const { return int64_t(m_iAcquired - m_iReleased) * m_pPool->getBlockSize(); }
+
       /// Find data position to pack a DATA packet from the furthest reading point.
       /// @param [out] data the pointer to the data position.
       /// @param [out] msgno message number of the packet.
@@ -120,6 +156,18 @@ public:
 
    int dropLateData(int &bytes, uint64_t latetime);
 
+      /// Take the completions of the zero-copy messages retired so far,
+      /// and the pool blocks of the retired packets. A packet being sent
+      /// may still point into them, so they're given back by the sender
+      /// worker (see CSndUList::addCompletions()).
+      /// @param [out] w_done the completions, appended.
+      /// @param [out] w_freed the blocks of getPool(), appended.
+      /// @return false if there were none.
+
+   bool takeRetired(std::vector<CSndCompletion>& w_done, std::vector<char*>& w_freed);
+
+   CSndBlockPool* getPool() const { return m_pPool; }
+
 #ifdef SRT_ENABLE_SNDBUFSZ_MAVG
    void updAvgBufSize(uint64_t time);
    int getAvgBufSize(ref_t<int> bytes, ref_t<int> timespan);
@@ -132,13 +180,19 @@ public:
 
 private:
    void increase();
+   void retireFirst();
+   int getCurrBufSizeNoLock(int& bytes, int& timespan);
+   bool insert(const SRT_SEGMENT* segs, int len, int ttl, bool order, uint64_t srctime,
+         const CSndCompletion* done, int32_t& msgno);
+   void releaseFreed();
 
 private:
    pthread_mutex_t m_BufLock;           // used to synchronize buffer operation
 
    struct Block
    {
-      char* m_pcData;                   // pointer to the data block
+      char* m_pcData;                   // pointer to the data block, from m_pPool while in use
+      const char* m_pcRef;              // the user's data, if not copied to m_pcData
       int m_iLength;                    // length of the block
 
       int32_t m_iMsgNoBitset;                 // message number
@@ -146,7 +200,7 @@ private:
       uint64_t m_ullSourceTime_us;
       int m_iTTL;                       // time to live (milliseconds)
 
-      Block* m_pNext;                   // next block
+      CSndCompletion* m_pDone;          // on the last block of a message that isn't copied
 
       int32_t getMsgSeq()
       {
@@ -157,23 +211,28 @@ private:
           return m_iMsgNoBitset & MSGNO_SEQ::mask;
       }
 
-   } *m_pBlock, *m_pFirstBlock, *m_pCurrBlock, *m_pLastBlock;
+   } *m_pBlock;                         // circular array of m_iSize blocks
 
-   // m_pBlock:         The head pointer
-   // m_pFirstBlock:    The first block
-   // m_pCurrBlock:	The current block
-   // m_pLastBlock:     The last block (if first == last, buffer is empty)
+   int m_iFirstPos;                     // the first block, the oldest not acknowledged
+   int m_iCurrPos;                      // the next block to send
+   int m_iLastPos;                      // past the last block (if first == last, buffer is empty)
 
-   struct Buffer
-   {
-      char* m_pcData;                   // buffer
-      int m_iSize;                      // size
-      Buffer* m_pNext;                  // next buffer
-   } *m_pBuffer;                        // physical buffer
+   // The blocks are found by position, so that a retransmission takes one
+   // of them by its offset from the ACK point. The array is reallocated by
+   // increase() under m_BufLock, which the readers of the blocks take.
+
+   int nextPos(int pos) const { return pos + 1 == m_iSize ? 0 : pos + 1; }
+
+   CSndBlockPool* m_pPool;              // where the blocks get their m_pcData
+   std::vector<char*> m_vReserved;      // taken from m_pPool for the next packets
+   std::vector<char*> m_vFreed;         // retired, not taken by takeRetired() yet
+   int m_iAcquired;                     // blocks taken from m_pPool, by the sending thread
+   int m_iReleased;                     // blocks retired and taken, under m_BufLock
 
    int32_t m_iNextMsgNo;                // next message number
 
    int m_iSize;                         // buffer size (number of packets)
+   int m_iIncrement;                    // minimum number of blocks added by increase()
    int m_iMSS;                          // maximum seqment/packet size
 
    int m_iCount;                        // number of used blocks
@@ -195,6 +254,8 @@ private:
    int m_iInRateBps;        // Input Rate in Bytes/sec
    int m_iAvgPayloadSz;     // Average packet payload size
 
+   std::vector<CSndCompletion> m_vRetired; // zero-copy messages, retired and not taken yet
+
 private:
    CSndBuffer(const CSndBuffer&);
    CSndBuffer& operator=(const CSndBuffer&);
@@ -203,6 +264,16 @@ private:
 ////////////////////////////////////////////////////////////////////////////////
 
 
+// A message lent to the application by CRcvBuffer::borrowMsg().
+struct CRcvBorrowed
+{
+   int m_iIndex;                        // identifies the message in releaseMsg()
+   bool m_bLent;
+   std::vector<CUnit*> m_vUnits;
+   std::vector<SRT_SEGMENT> m_vSegments;
+   int m_iLength;
+};
+
 class CRcvBuffer
 {
 public:
@@ -248,6 +319,32 @@ public:
 
    int getAvailBufSize() const;
 
+      /// Check if the buffer must grow before a packet is added at the offset.
+      /// The buffer starts small and grows as the packets in flight require,
+      /// up to the size given to the constructor, which is what
+      /// getAvailBufSize() is counted from.
+      /// @param [in] offset offset from last ACK point.
+
+   bool needsGrowth(int offset) const { return offset >= m_iSize - getRcvDataSize() - 1; }
+
+      /// Grow the buffer so that a packet fits at the offset. Like shrink(),
+      /// only for the receiving thread, with the readers locked out.
+      /// @param [in] offset offset from last ACK point.
+      /// @return false if there's no memory for it.
+
+   bool grow(int offset);
+
+      /// Check, at the end of every period, if the buffer has been much
+      /// bigger than needed during it, so that shrink() should be called.
+      /// @param [in] now current time in us.
+
+   bool isShrinkDue(uint64_t now);
+
+   void shrink();
+
+   int getCapacity() const { return m_iSize; }
+   int getHighWater() const { return m_iHighWater; }
+
       /// Query how many data has been continuously received (for reading) and ready to play (tsbpdtime < now).
       /// @param [out] tsbpdtime localtime-based (uSec) packet time stamp including buffering delay
       /// @return size of valid (continous) data for reading.
@@ -303,6 +400,40 @@ public:
 
    int readMsg(char* data, int len, ref_t<SRT_MSGCTRL> mctrl);
 
+      /// read a message into a buffer given in pieces.
+      /// @param [in] segs the segments, filled in turn.
+      /// @param [in] len total size of the segments.
+      /// @param [out] mctrl message control data, like in readMsg().
+      /// @return actual size of data read.
+
+   int readMsgV(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> mctrl);
+
+      /// Take the next message out of the buffer without copying it: its
+      /// units are lent to the caller until releaseMsg(). In non-TSBPD mode
+      /// only acknowledged messages are lent, so out-of-order delivery doesn't apply.
+      /// @param [out] mctrl message control data, like in readMsg().
+      /// @return the message, or NULL if no message is ready.
+
+   CRcvBorrowed* borrowMsg(ref_t<SRT_MSGCTRL> mctrl);
+
+      /// Give back the units of a message lent by borrowMsg().
+      /// @param [in] index CRcvBorrowed::m_iIndex of the message.
+      /// @return false if no such message is lent.
+
+   bool releaseMsg(int index);
+
+      /// Query the number of units lent by borrowMsg() and not released yet.
+      /// @return number of units.
+
+   int getBorrowedUnits() const { return m_iBorrowedUnits; }
+
+      /// Query the memory of the units held by this buffer, including those
+      /// lent, which is counted against its share of srt_setmemlimit().
+      /// @return size in bytes.
+
+   int64_t getMemUsed() const { return int64_t(m_iUnitsIn - m_iUnitsOut) * m_pUnitQueue->m_iMSS; }
+   int64_t getQueueFreeMem() const { return m_pUnitQueue->getFreeMem(); }
+
       /// Query if data is ready to read (tsbpdtime <= now if TsbPD is active).
       /// @param [out] tsbpdtime localtime-based (uSec) packet time stamp including buffering delay
       ///                        of next packet in recv buffer, ready or not.
@@ -329,8 +460,9 @@ public:
       /// Add packet timestamp for drift caclculation and compensation
       /// @param [in] timestamp packet time stamp
       /// @param [ref] lock Mutex that should be locked for the operation
+      /// @param [in] arrival_time time when the packet was received, 0 = now
 
-   void addRcvTsbPdDriftSample(uint32_t timestamp, pthread_mutex_t& lock);
+   void addRcvTsbPdDriftSample(uint32_t timestamp, pthread_mutex_t& lock, uint64_t arrival_time = 0);
 
 #ifdef SRT_DEBUG_TSBPD_DRIFT
    void printDriftHistogram(int64_t iDrift);
@@ -389,13 +521,38 @@ private:
    void countBytes(int pkts, int bytes, bool acked = false);
 
 private:
+   static const int INITIAL_SIZE = 128;
+   static const uint64_t SHRINK_PERIOD_US = 5000000;
+
+   bool resize(int size);
+   void setFlag(int pos, CUnit::Flag flag);
+   CUnit* takeUnit(int pos);
+   int getRcvReadyPos();
    bool scanMsg(ref_t<int> start, ref_t<int> end, ref_t<bool> passack);
+   int extractMsg(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> mctrl, CRcvBorrowed* borrowed);
 
 private:
    CUnit** m_pUnit;                     // pointer to the protocol buffer
+
+   // What the scans need of the unit at each position, kept next to each
+   // other so that they don't reach into the units. Set with m_pUnit.
+   struct Slot
+   {
+      CUnit::Flag m_iFlag;              // as of the unit, FREE if there's none
+      int32_t m_iSeqNo;
+      int32_t m_iMsgNoBitset;           // PH_MSGNO, without the crypto flags
+      uint32_t m_uTimestamp;            // PH_TIMESTAMP, for the TSBPD time
+      int m_iLength;                    // payload size
+   } *m_pSlot;
+
    int m_iSize;                         // size of the protocol buffer
+   int m_iMaxSize;                      // size it can grow to
    CUnitQueue* m_pUnitQueue;		// the shared unit queue
 
+   int m_iHighWater;                    // most positions ever in use
+   int m_iPeriodPeak;                   // most positions in use in this period
+   uint64_t m_ullPeriodStart;           // start of the period, in us
+
    int m_iStartPos;                     // the head position for I/O (inclusive)
    int m_iLastAckPos;                   // the last ACKed position (exclusive)
 					// EMPTY: m_iStartPos = m_iLastAckPos   FULL: m_iStartPos = m_iLastAckPos + 1
@@ -403,6 +560,12 @@ private:
 
    int m_iNotch;			// the starting read point of the first unit
 
+   std::vector<CRcvBorrowed*> m_vBorrowed; // messages lent to the application, and spare ones
+   std::vector<int> m_vSpareBorrowed;   // indexes of the spare ones in m_vBorrowed
+   int m_iBorrowedUnits;                // number of units lent
+   int m_iUnitsIn;                      // units added, by the receiving thread
+   int m_iUnitsOut;                     // units given back, under the readers' lock
+
    pthread_mutex_t m_BytesCountLock;    // used to protect counters operations
    int m_iBytesCount;                   // Number of payload bytes in the buffer
    int m_iAckedPktsCount;               // Number of acknowledged pkts in the buffer
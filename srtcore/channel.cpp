@@ -56,6 +56,7 @@ modified by
    #endif
    #include <sys/socket.h>
    #include <sys/ioctl.h>
+   #include <poll.h>
    #include <netdb.h>
    #include <arpa/inet.h>
    #include <unistd.h>
@@ -79,11 +80,29 @@ modified by
 #include "api.h" // SockaddrToString - possibly move it to somewhere else
 #include "logging.h"
 #include "utilities.h"
+#include "uring.h"
+#include "inproc.h"
+#include "impair.h"
 
 #ifdef WIN32
     typedef int socklen_t;
 #endif
 
+#ifdef LINUX
+   #include <netinet/udp.h>
+   #include <sys/eventfd.h>
+   // Not all system headers define it yet.
+   #ifndef UDP_SEGMENT
+      #define UDP_SEGMENT 103
+   #endif
+   #ifndef UDP_GRO
+      #define UDP_GRO 104
+   #endif
+   #ifndef SOL_UDP
+      #define SOL_UDP 17
+   #endif
+#endif
+
 #ifndef WIN32
    #define NET_ERROR errno
 #else
@@ -92,9 +111,49 @@ modified by
 
 using namespace std;
 
+// The user data of the read of the wakeup eventfd queued on the io_uring.
+static const uint64_t WAKE_TAG = uint64_t(-1);
+
+// The message header of a receive operation queued on the io_uring
+// must live until the operation completes, so it's kept per slot.
+struct CChannel::CRecvSlot
+{
+#ifndef WIN32
+   msghdr m_Header;
+   iovec m_Vector[2];
+   char m_Control[CMSG_SPACE(sizeof(timespec))];
+#endif
+   CPacket* m_pPacket;
+};
+
 
 extern logging::Logger mglog;
 
+#ifdef LINUX
+// Read the kernel receive timestamp (SO_TIMESTAMPNS) from the control
+// messages of a received datagram. The kernel stamps it with CLOCK_REALTIME,
+// while CTimer::getTime() is monotonic, so the packet's age is subtracted
+// from the current time instead. Returns 0 if there's no timestamp.
+static uint64_t kernelArrivalTime(msghdr* mh)
+{
+    for (cmsghdr* cm = CMSG_FIRSTHDR(mh); cm != NULL; cm = CMSG_NXTHDR(mh, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            timespec ts, real;
+            memcpy(&ts, CMSG_DATA(cm), sizeof ts);
+            clock_gettime(CLOCK_REALTIME, &real);
+
+            uint64_t stamp = ts.tv_sec * uint64_t(1000000) + ts.tv_nsec / 1000;
+            uint64_t realnow = real.tv_sec * uint64_t(1000000) + real.tv_nsec / 1000;
+            uint64_t age = realnow > stamp ? realnow - stamp : 0;
+            return CTimer::getTime() - age;
+        }
+    }
+    return 0;
+}
+#endif
+
 CChannel::CChannel():
 m_iIPversion(AF_INET),
 m_iSockAddrSize(sizeof(sockaddr_in)),
@@ -104,8 +163,26 @@ m_iIpTTL(-1),
 m_iIpToS(-1),
 #endif
 m_iSndBufSize(65536),
-m_iRcvBufSize(65536)
+m_iRcvBufSize(65536),
+m_bGSO(false),
+m_bGRO(false),
+m_pGROBuffer(NULL),
+m_iGROSegSize(0),
+m_bIoUring(false),
+m_pRcvRing(NULL),
+m_pSndRing(NULL),
+m_pRecvSlots(NULL),
+m_bReusePort(false),
+m_bRcvTimestamp(false),
+m_pInproc(NULL),
+m_sImpair(),
+m_pImpair(NULL),
+m_iWakeReadFd(-1),
+m_iWakeWriteFd(-1),
+m_bWakePosted(false),
+m_ullWakeValue(0)
 {
+   pthread_mutex_init(&m_SndRingLock, NULL);
 }
 
 CChannel::CChannel(int version):
@@ -117,17 +194,59 @@ m_iIpToS(-1),
 #endif
 m_iSndBufSize(65536),
 m_iRcvBufSize(65536),
+m_bGSO(false),
+m_bGRO(false),
+m_pGROBuffer(NULL),
+m_iGROSegSize(0),
+m_bIoUring(false),
+m_pRcvRing(NULL),
+m_pSndRing(NULL),
+m_pRecvSlots(NULL),
+m_bReusePort(false),
+m_bRcvTimestamp(false),
+m_pInproc(NULL),
+m_sImpair(),
+m_pImpair(NULL),
+m_iWakeReadFd(-1),
+m_iWakeWriteFd(-1),
+m_bWakePosted(false),
+m_ullWakeValue(0),
 m_BindAddr(version)
 {
    m_iSockAddrSize = (AF_INET == m_iIPversion) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+   pthread_mutex_init(&m_SndRingLock, NULL);
 }
 
 CChannel::~CChannel()
 {
+   delete [] m_pGROBuffer;
+   if (m_bIoUring)
+   {
+      delete m_pRcvRing;
+      delete m_pSndRing;
+      ::close(m_iSocket);
+   }
+   delete [] m_pRecvSlots;
+   delete m_pInproc;
+   delete m_pImpair;
+   pthread_mutex_destroy(&m_SndRingLock);
+
+#ifndef WIN32
+   if (m_iWakeWriteFd != -1 && m_iWakeWriteFd != m_iWakeReadFd)
+      ::close(m_iWakeWriteFd);
+   if (m_iWakeReadFd != -1)
+      ::close(m_iWakeReadFd);
+#endif
 }
 
 void CChannel::open(const sockaddr* addr)
 {
+   if (CInprocRing::isInprocAddr(addr))
+   {
+      openInproc(addr);
+      return;
+   }
+
    // construct an socket
    m_iSocket = ::socket(m_iIPversion, SOCK_DGRAM, 0);
 
@@ -138,6 +257,17 @@ void CChannel::open(const sockaddr* addr)
    #endif
       throw CUDTException(MJ_SETUP, MN_NONE, NET_ERROR);
 
+   if (m_bReusePort)
+   {
+#ifdef SO_REUSEPORT
+      int yes = 1;
+      if (0 != ::setsockopt(m_iSocket, SOL_SOCKET, SO_REUSEPORT, (const char*)&yes, sizeof(yes)))
+         throw CUDTException(MJ_SETUP, MN_NORES, NET_ERROR);
+#else
+      throw CUDTException(MJ_SETUP, MN_NORES, 0);
+#endif
+   }
+
    if (NULL != addr)
    {
       socklen_t namelen = m_iSockAddrSize;
@@ -175,6 +305,30 @@ void CChannel::open(const sockaddr* addr)
    setUDPSockOpt();
 }
 
+void CChannel::openInproc(const sockaddr* addr)
+{
+   // None of the socket features apply here.
+   m_bGSO = false;
+   m_bGRO = false;
+   m_bIoUring = false;
+   m_bRcvTimestamp = false;
+
+   // The ring takes the place of the system receive buffer.
+   int cells = std::max(m_iRcvBufSize / int(CInprocRing::MAX_DATAGRAM), 256);
+   m_pInproc = CInprocRing::bind(ntohs(((const sockaddr_in*)addr)->sin_port), cells, this);
+   if (!m_pInproc)
+      throw CUDTException(MJ_SETUP, MN_NORES, EADDRINUSE);
+
+   memcpy(&m_BindAddr, addr, sizeof(sockaddr_in));
+   m_BindAddr.len = sizeof(sockaddr_in);
+   m_BindAddr.sin.sin_port = htons(m_pInproc->port());
+
+   HLOGC(mglog.Debug, log << "CHANNEL: Bound to in-process address: " << SockaddrToString(&m_BindAddr));
+
+   setupWakeup();
+   setupImpairment();
+}
+
 void CChannel::attach(UDPSOCKET udpsock)
 {
    m_iSocket = udpsock;
@@ -207,6 +361,75 @@ void CChannel::setUDPSockOpt()
          throw CUDTException(MJ_SETUP, MN_NORES, NET_ERROR);
 #endif
 
+   if (m_bGSO)
+   {
+#ifdef LINUX
+      // Older kernels don't know UDP_SEGMENT; just don't use it then.
+      int segsize = 0;
+      socklen_t len = sizeof(segsize);
+      if (0 != ::getsockopt(m_iSocket, SOL_UDP, UDP_SEGMENT, (char*)&segsize, &len))
+      {
+         LOGC(mglog.Warn, log << "CHANNEL: UDP GSO not supported by the system, sending without it");
+         m_bGSO = false;
+      }
+#else
+      m_bGSO = false;
+#endif
+   }
+
+   if (m_bRcvTimestamp)
+   {
+#ifdef LINUX
+      int yes = 1;
+      if (0 != ::setsockopt(m_iSocket, SOL_SOCKET, SO_TIMESTAMPNS, (const char*)&yes, sizeof(yes)))
+      {
+         LOGC(mglog.Warn, log << "CHANNEL: kernel receive timestamps not supported by the system, using the local time");
+         m_bRcvTimestamp = false;
+      }
+#else
+      m_bRcvTimestamp = false;
+#endif
+   }
+
+   setupWakeup();
+   setupImpairment();
+
+   // The impairment sits between the reading and the receiver, which the
+   // io_uring receive operations don't leave room for.
+   if (m_bIoUring && m_pImpair)
+   {
+      LOGC(mglog.Warn, log << "CHANNEL: io_uring can't be used together with the impairment, using plain socket calls");
+      m_bIoUring = false;
+   }
+
+   if (m_bIoUring)
+      setupIoUring();
+
+   // The receive operations on the io_uring read one datagram each.
+   if (m_bGRO && m_bIoUring)
+   {
+      LOGC(mglog.Warn, log << "CHANNEL: UDP GRO can't be used together with io_uring, receiving without it");
+      m_bGRO = false;
+   }
+
+   if (m_bGRO)
+   {
+#ifdef LINUX
+      int yes = 1;
+      if (0 != ::setsockopt(m_iSocket, SOL_UDP, UDP_GRO, (const char*)&yes, sizeof(yes)))
+      {
+         LOGC(mglog.Warn, log << "CHANNEL: UDP GRO not supported by the system, receiving without it");
+         m_bGRO = false;
+      }
+      else
+      {
+         m_pGROBuffer = new char[MAX_GRO_BYTES];
+      }
+#else
+      m_bGRO = false;
+#endif
+   }
+
    timeval tv;
    tv.tv_sec = 0;
    #if defined (BSD) || defined (OSX) || (TARGET_OS_IOS == 1) || (TARGET_OS_TV == 1)
@@ -234,8 +457,168 @@ void CChannel::setUDPSockOpt()
    #endif
 }
 
+void CChannel::setupIoUring()
+{
+   // The receiving ring holds at most MAX_BATCH operations at a time,
+   // the sending one at most one per packet of a batch.
+   m_pRcvRing = new CUring;
+   m_pSndRing = new CUring;
+   if (!m_pRcvRing->init(2 * MAX_BATCH) || !m_pSndRing->init(MAX_BATCH))
+   {
+      LOGC(mglog.Warn, log << "CHANNEL: io_uring not supported by the system, using plain socket calls");
+      delete m_pRcvRing;
+      delete m_pSndRing;
+      m_pRcvRing = NULL;
+      m_pSndRing = NULL;
+      m_bIoUring = false;
+      return;
+   }
+
+   m_pRecvSlots = new CRecvSlot[MAX_BATCH];
+}
+
+void CChannel::setupWakeup()
+{
+#ifdef LINUX
+   // Blocking, so that a read queued on the io_uring waits for a value.
+   m_iWakeReadFd = m_iWakeWriteFd = ::eventfd(0, EFD_CLOEXEC);
+   if (m_iWakeReadFd == -1)
+      throw CUDTException(MJ_SETUP, MN_NORES, NET_ERROR);
+#elif !defined(WIN32)
+   int fds[2];
+   if (-1 == ::pipe(fds))
+      throw CUDTException(MJ_SETUP, MN_NORES, NET_ERROR);
+   m_iWakeReadFd = fds[0];
+   m_iWakeWriteFd = fds[1];
+   // Interrupts that nobody has read yet needn't be counted.
+   ::fcntl(m_iWakeWriteFd, F_SETFL, ::fcntl(m_iWakeWriteFd, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+void CChannel::setupImpairment()
+{
+   if (m_sImpair.empty())
+      return;
+
+   CImpairment::Config cfg;
+   if (!CImpairment::parse(m_sImpair, Ref(cfg)))
+      throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+   m_pImpair = new CImpairment(cfg);
+   HLOGC(mglog.Debug, log << "CHANNEL: impairing incoming packets: " << m_sImpair);
+}
+
+void CChannel::waitRead(int64_t timeout_us) const
+{
+   if (m_pImpair)
+   {
+      // Wake up also when the next held packet is due.
+      uint64_t due = m_pImpair->nextDue();
+      if (due != 0)
+      {
+         uint64_t now = CTimer::getTime();
+         if (due <= now)
+            return;
+         if (timeout_us < 0 || int64_t(due - now) < timeout_us)
+            timeout_us = int64_t(due - now);
+      }
+   }
+
+#ifdef LINUX
+   if (m_bIoUring)
+   {
+      // Wake up also on interrupt(), through a read of the eventfd.
+      if (!m_bWakePosted)
+         m_bWakePosted = m_pRcvRing->prepRead(m_iWakeReadFd, &m_ullWakeValue, sizeof m_ullWakeValue, WAKE_TAG);
+
+      int res = m_pRcvRing->submitAndWait(1, timeout_us);
+      if (res < 0)
+      {
+         HLOGC(mglog.Debug, log << CONID() << "(sys)io_uring_enter: " << SysStrError(-res) << " [" << -res << "]");
+      }
+      return;
+   }
+#endif
+
+#ifndef WIN32
+   // Senders to an in-process port wake the reader through interrupt().
+   if (m_pInproc && !m_pInproc->prepareWait())
+      return;
+
+   pollfd fds[2];
+   fds[0].fd = m_pInproc ? -1 : m_iSocket;
+   fds[0].events = POLLIN;
+   fds[0].revents = 0;
+   fds[1].fd = m_iWakeReadFd;
+   fds[1].events = POLLIN;
+   fds[1].revents = 0;
+
+#ifdef LINUX
+   timespec ts;
+   ts.tv_sec = timeout_us / 1000000;
+   ts.tv_nsec = (timeout_us % 1000000) * 1000;
+   int res = ::ppoll(fds, 2, timeout_us < 0 ? NULL : &ts, NULL);
+#else
+   int res = ::poll(fds, 2, timeout_us < 0 ? -1 : int((timeout_us + 999) / 1000));
+#endif
+
+   if (res > 0 && (fds[1].revents & POLLIN))
+   {
+      // Consume the interrupt; it's readable, so this doesn't block.
+      char buf[64];
+      if (-1 == ::read(m_iWakeReadFd, buf, sizeof buf))
+      {
+         HLOGC(mglog.Debug, log << CONID() << "(sys)read wakeup: " << SysStrError(NET_ERROR));
+      }
+   }
+
+   if (m_pInproc)
+      m_pInproc->endWait();
+#else
+   // On Windows the receiving itself waits for the SO_RCVTIMEO time.
+   (void)timeout_us;
+#endif
+}
+
+void CChannel::interrupt() const
+{
+#ifdef LINUX
+   uint64_t one = 1;
+   if (-1 == ::write(m_iWakeWriteFd, &one, sizeof one))
+   {
+      HLOGC(mglog.Debug, log << CONID() << "(sys)write wakeup: " << SysStrError(NET_ERROR));
+   }
+#elif !defined(WIN32)
+   char one = 1;
+   // Failure means that it's full, which wakes up the reader anyway.
+   ::write(m_iWakeWriteFd, &one, 1);
+#endif
+}
+
 void CChannel::close() const
 {
+   // The receiver sleeping in waitRead() isn't woken up here: it's
+   // interrupted when its queue is closing, so that it can tell this
+   // from an error of the closed socket.
+
+   // Operations queued on the io_uring refer to the socket by its number,
+   // so it can't be released to be reused while the workers may still run.
+   // Shutdown makes the pending ones complete right away; the descriptor
+   // is closed in the destructor.
+   if (m_bIoUring)
+   {
+      ::shutdown(m_iSocket, SHUT_RDWR);
+      return;
+   }
+
+   // The in-process ring is likewise deleted in the destructor,
+   // as the receiver may still read from it.
+   if (m_pInproc)
+   {
+      m_pInproc->unbind();
+      return;
+   }
+
    #ifndef WIN32
       ::close(m_iSocket);
    #else
@@ -245,6 +628,10 @@ void CChannel::close() const
 
 int CChannel::getSndBufSize()
 {
+   // An in-process channel has no system socket; report what was set.
+   if (m_pInproc)
+      return m_iSndBufSize;
+
    socklen_t size = sizeof(socklen_t);
    ::getsockopt(m_iSocket, SOL_SOCKET, SO_SNDBUF, (char *)&m_iSndBufSize, &size);
    return m_iSndBufSize;
@@ -252,6 +639,9 @@ int CChannel::getSndBufSize()
 
 int CChannel::getRcvBufSize()
 {
+   if (m_pInproc)
+      return m_iRcvBufSize;
+
    socklen_t size = sizeof(socklen_t);
    ::getsockopt(m_iSocket, SOL_SOCKET, SO_RCVBUF, (char *)&m_iRcvBufSize, &size);
    return m_iRcvBufSize;
@@ -270,6 +660,9 @@ void CChannel::setRcvBufSize(int size)
 #ifdef SRT_ENABLE_IPOPTS
 int CChannel::getIpTTL() const
 {
+   if (m_pInproc)
+      return m_iIpTTL;
+
    socklen_t size = sizeof(m_iIpTTL);
    ::getsockopt(m_iSocket, IPPROTO_IP, IP_TTL, (char *)&m_iIpTTL, &size);
    return m_iIpTTL;
@@ -277,6 +670,9 @@ int CChannel::getIpTTL() const
 
 int CChannel::getIpToS() const
 {
+   if (m_pInproc)
+      return m_iIpToS;
+
    socklen_t size = sizeof(m_iIpToS);
    ::getsockopt(m_iSocket, IPPROTO_IP, IP_TOS, (char *)&m_iIpToS, &size);
    return m_iIpToS;
@@ -297,6 +693,9 @@ void CChannel::setIpToS(int tos)
 int CChannel::ioctlQuery(int type) const
 {
 #ifdef unix
+    if (m_pInproc)
+        return -1;
+
     int value = 0;
     int res = ::ioctl(m_iSocket, type, &value);
     if ( res != -1 )
@@ -308,6 +707,9 @@ int CChannel::ioctlQuery(int type) const
 int CChannel::sockoptQuery(int level, int option) const
 {
 #ifdef unix
+    if (m_pInproc)
+        return -1;
+
     int value = 0;
     socklen_t len = sizeof (int);
     int res = ::getsockopt(m_iSocket, level, option, &value, &len);
@@ -319,6 +721,12 @@ int CChannel::sockoptQuery(int level, int option) const
 
 void CChannel::getSockAddr(sockaddr* addr) const
 {
+   if (m_pInproc)
+   {
+      memcpy(addr, &m_BindAddr, sizeof(sockaddr_in));
+      return;
+   }
+
    socklen_t namelen = m_iSockAddrSize;
    ::getsockname(m_iSocket, addr, &namelen);
 }
@@ -354,20 +762,16 @@ int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
         << spec.str());
 #endif
 
-   // convert control information into network order
-   // XXX USE HtoNLA!
-   if (packet.isControl())
-      for (int i = 0, n = packet.getLength() / 4; i < n; ++ i)
-         *((uint32_t *)packet.m_pcData + i) = htonl(*((uint32_t *)packet.m_pcData + i));
+   toNetworkOrder(packet);
 
-   // convert packet header into network order
-   //for (int j = 0; j < 4; ++ j)
-   //   packet.m_nHeader[j] = htonl(packet.m_nHeader[j]);
-   uint32_t* p = packet.m_nHeader;
-   for (int j = 0; j < 4; ++ j)
+   if (m_pInproc)
    {
-      *p = htonl(*p);
-      ++ p;
+      // As with UDP, the datagram is silently lost if it can't be delivered.
+      if (CInprocRing::isInprocAddr(addr))
+         CInprocRing::send(ntohs(((const sockaddr_in*)addr)->sin_port), m_pInproc->port(), packet.m_PacketVector, 2);
+
+      toHostOrder(packet);
+      return int(CPacket::HDR_SIZE + packet.getLength());
    }
 
    #ifndef WIN32
@@ -388,28 +792,226 @@ int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
       res = (0 == res) ? size : -1;
    #endif
 
-   // convert back into local host order
-   //for (int k = 0; k < 4; ++ k)
-   //   packet.m_nHeader[k] = ntohl(packet.m_nHeader[k]);
-   p = packet.m_nHeader;
-   for (int k = 0; k < 4; ++ k)
+   toHostOrder(packet);
+
+   return res;
+}
+
+int CChannel::sendto(sockaddr* const* addrs, CPacket* packets, int size) const
+{
+   if (size > MAX_BATCH)
+      size = MAX_BATCH;
+
+   // Delivery to an in-process port costs no system call anyway.
+   if (m_pInproc)
    {
-      *p = ntohl(*p);
-       ++ p;
+      for (int i = 0; i < size; ++ i)
+         sendto(addrs[i], packets[i]);
+      return size;
    }
 
-   if (packet.isControl())
+   HLOGC(mglog.Debug, log << "CChannel::sendto: SENDING BATCH of " << size << " packets");
+
+   for (int i = 0; i < size; ++ i)
+      toNetworkOrder(packets[i]);
+
+   int sent = 0;
+#ifdef LINUX
+   mmsghdr mh[MAX_BATCH];
+   iovec iov[2 * MAX_BATCH];
+   int msgpkts[MAX_BATCH];              // number of packets carried by every message
+   char cmsgbuf[MAX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+
+   int nmsgs = 0;
+   for (int i = 0; i < size; )
    {
-      for (int l = 0, n = packet.getLength() / 4; l < n; ++ l)
-         *((uint32_t *)packet.m_pcData + l) = ntohl(*((uint32_t *)packet.m_pcData + l));
+      // With GSO, a run of packets to the same destination is glued into
+      // one datagram, which the kernel then splits at the first packet's
+      // size. Only the last packet of the run may be shorter.
+      int run = 1;
+      if (m_bGSO)
+      {
+         size_t segsize = CPacket::HDR_SIZE + packets[i].getLength();
+         size_t total = segsize;
+         while (i + run < size && run < MAX_GSO_SEGMENTS)
+         {
+            size_t len = CPacket::HDR_SIZE + packets[i + run].getLength();
+            if (len > segsize || total + len > MAX_GSO_BYTES
+                  || memcmp(addrs[i + run], addrs[i], m_iSockAddrSize) != 0)
+               break;
+
+            total += len;
+            ++ run;
+            if (len < segsize)
+               break;
+         }
+      }
+
+      msghdr& h = mh[nmsgs].msg_hdr;
+      h.msg_name = addrs[i];
+      h.msg_namelen = m_iSockAddrSize;
+      h.msg_iov = iov + 2 * i;
+      h.msg_iovlen = 2 * run;
+      h.msg_control = NULL;
+      h.msg_controllen = 0;
+      h.msg_flags = 0;
+      mh[nmsgs].msg_len = 0;
+
+      for (int k = 0; k < run; ++ k)
+      {
+         iov[2 * (i + k)] = packets[i + k].m_PacketVector[CPacket::PV_HEADER];
+         iov[2 * (i + k) + 1] = packets[i + k].m_PacketVector[CPacket::PV_DATA];
+      }
+
+      if (run > 1)
+      {
+         h.msg_control = cmsgbuf[nmsgs];
+         h.msg_controllen = sizeof cmsgbuf[nmsgs];
+         cmsghdr* cm = CMSG_FIRSTHDR(&h);
+         cm->cmsg_level = SOL_UDP;
+         cm->cmsg_type = UDP_SEGMENT;
+         cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+         uint16_t segsize = CPacket::HDR_SIZE + packets[i].getLength();
+         memcpy(CMSG_DATA(cm), &segsize, sizeof segsize);
+      }
+
+      msgpkts[nmsgs ++] = run;
+      i += run;
    }
 
-   return res;
+   if (m_bIoUring)
+      sent = sendIoUring(mh, msgpkts, nmsgs);
+
+   // sendmmsg may stop early, so continue with the rest until everything
+   // is sent. It fails on the first message that can't be sent, which is
+   // then skipped: the next ones may go to another peer. Only when the
+   // socket can't take more at the moment the rest is left for the callers.
+   int msgsent = m_bIoUring ? nmsgs : 0;
+   while (msgsent < nmsgs)
+   {
+      int res = ::sendmmsg(m_iSocket, mh + msgsent, nmsgs - msgsent, 0);
+      if (res < 0)
+      {
+         int err = NET_ERROR;
+         if (err == EINTR)
+            continue;
+
+         HLOGC(mglog.Debug, log << CONID() << "(sys)sendmmsg: " << SysStrError(err) << " after " << sent << " packets");
+         if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS)
+            break;
+
+         if (checkGSOFailure(err, msgpkts[msgsent]))
+            sent += sendSegments(mh[msgsent].msg_hdr, msgpkts[msgsent]);
+         ++ msgsent;
+         continue;
+      }
+      if (res == 0)
+         break;
+
+      for (int m = msgsent; m < msgsent + res; ++ m)
+         sent += msgpkts[m];
+      msgsent += res;
+   }
+#else
+   // No batched sending on this platform, send them one by one.
+   for (int i = 0; i < size; ++ i)
+   {
+      #ifndef WIN32
+         msghdr mh;
+         mh.msg_name = addrs[i];
+         mh.msg_namelen = m_iSockAddrSize;
+         mh.msg_iov = packets[i].m_PacketVector;
+         mh.msg_iovlen = 2;
+         mh.msg_control = NULL;
+         mh.msg_controllen = 0;
+         mh.msg_flags = 0;
+
+         int res = ::sendmsg(m_iSocket, &mh, 0);
+      #else
+         DWORD bytes = CPacket::HDR_SIZE + packets[i].getLength();
+         int addrsize = m_iSockAddrSize;
+         int res = ::WSASendTo(m_iSocket, (LPWSABUF)packets[i].m_PacketVector, 2, &bytes, 0, addrs[i], addrsize, NULL, NULL);
+         res = (0 == res) ? bytes : -1;
+      #endif
+      if (res != -1)
+         ++ sent;
+   }
+#endif
+
+   for (int i = 0; i < size; ++ i)
+      toHostOrder(packets[i]);
+
+   return sent;
 }
 
 EReadStatus CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
 {
+    if (!m_pImpair)
+        return recvSocket(addr, packet);
+
+    sockaddr_any src[1] = { sockaddr_any(m_iIPversion) };
+    CPacket* pkt = &packet;
+    int count = 0;
+    EReadStatus st = recvfrom(src, &pkt, 1, Ref(count));
+    if (st != RST_OK)
+    {
+        packet.setLength(-1);
+        return st;
+    }
+
+    memcpy(addr, &src[0], m_iSockAddrSize);
+    return RST_OK;
+}
+
+EReadStatus CChannel::recvfrom(sockaddr_any* addrs, CPacket** packets, int size, ref_t<int> r_count) const
+{
+    if (!m_pImpair)
+        return recvSocket(addrs, packets, size, r_count);
+
+    // Everything read goes through the impairment model first,
+    // then the packets that are due are given out in its place.
+    if (size > MAX_BATCH)
+        size = MAX_BATCH;
+
+    int space[MAX_BATCH];
+    for (int i = 0; i < size; ++ i)
+        space[i] = packets[i]->getLength();
+
+    int count = 0;
+    EReadStatus st = recvSocket(addrs, packets, size, Ref(count));
+
+    uint64_t now = CTimer::getTime();
+    for (int i = 0; i < count; ++ i)
+    {
+        if (packets[i]->getLength() != size_t(-1))
+            m_pImpair->submit(addrs[i], *packets[i], now);
+    }
+
+    int n = 0;
+    for (; n < size; ++ n)
+    {
+        packets[n]->setLength(space[n]);
+        if (!m_pImpair->take(now, addrs + n, *packets[n]))
+            break;
+    }
+
+    *r_count = n;
+    if (n > 0)
+        return RST_OK;
+    return st == RST_ERROR ? RST_ERROR : RST_AGAIN;
+}
+
+EReadStatus CChannel::recvSocket(sockaddr* addr, CPacket& packet) const
+{
+    if (m_pInproc)
+    {
+        EReadStatus st = RST_AGAIN;
+        recvInproc(addr, packet, Ref(st));
+        return st;
+    }
+
     EReadStatus status = RST_OK;
+    uint64_t arrival_time = 0;
 
 #ifndef WIN32
     msghdr mh;   
@@ -420,18 +1022,17 @@ EReadStatus CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
     mh.msg_control = NULL;
     mh.msg_controllen = 0;
     mh.msg_flags = 0;
-
-#ifdef UNIX
-    fd_set set;
-    timeval tv;
-    FD_ZERO(&set);
-    FD_SET(m_iSocket, &set);
-    tv.tv_sec = 0;
-    tv.tv_usec = 10000;
-    ::select(m_iSocket+1, &set, NULL, &set, &tv);
+#ifdef LINUX
+    char cmsgbuf[CMSG_SPACE(sizeof(timespec))];
+    if (m_bRcvTimestamp)
+    {
+        mh.msg_control = cmsgbuf;
+        mh.msg_controllen = sizeof cmsgbuf;
+    }
 #endif
 
-    int res = ::recvmsg(m_iSocket, &mh, 0);
+    // Never block here; waiting is done by waitRead().
+    int res = ::recvmsg(m_iSocket, &mh, MSG_DONTWAIT);
     int msg_flags = mh.msg_flags;
 
 
@@ -472,6 +1073,11 @@ EReadStatus CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
         goto Return_error;
     }
 
+#ifdef LINUX
+    if (m_bRcvTimestamp)
+        arrival_time = kernelArrivalTime(&mh);
+#endif
+
 #else
     // XXX REFACTORING NEEDED!
     // This procedure uses the WSARecvFrom function that just reads
@@ -539,12 +1145,412 @@ EReadStatus CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
 #endif
 
 
+    return importPacket(packet, res, msg_flags, arrival_time);
+
+Return_error:
+    packet.setLength(-1);
+    return status;
+}
+
+EReadStatus CChannel::recvSocket(sockaddr_any* addrs, CPacket** packets, int size, ref_t<int> r_count) const
+{
+    *r_count = 0;
+
+    if (m_pInproc)
+    {
+        // Rejected packets are counted too, with length -1.
+        EReadStatus st;
+        while (*r_count < size && recvInproc(&addrs[*r_count], *packets[*r_count], Ref(st)))
+            ++ *r_count;
+        return *r_count > 0 ? RST_OK : RST_AGAIN;
+    }
+
+#ifdef LINUX
+    if (size > MAX_BATCH)
+        size = MAX_BATCH;
+
+    if (m_bGRO)
+        return recvGRO(addrs, packets, size, r_count);
+
+    mmsghdr mh[MAX_BATCH];
+    char cmsgbuf[MAX_BATCH][CMSG_SPACE(sizeof(timespec))];
+    for (int i = 0; i < size; ++ i)
+    {
+        mh[i].msg_hdr.msg_name = &addrs[i];
+        mh[i].msg_hdr.msg_namelen = m_iSockAddrSize;
+        mh[i].msg_hdr.msg_iov = packets[i]->m_PacketVector;
+        mh[i].msg_hdr.msg_iovlen = 2;
+        mh[i].msg_hdr.msg_control = m_bRcvTimestamp ? cmsgbuf[i] : NULL;
+        mh[i].msg_hdr.msg_controllen = m_bRcvTimestamp ? sizeof cmsgbuf[i] : 0;
+        mh[i].msg_hdr.msg_flags = 0;
+        mh[i].msg_len = 0;
+    }
+
+    int res = ::recvmmsg(m_iSocket, mh, size, MSG_DONTWAIT, NULL);
+    if (res == -1)
+    {
+        // Same error classification as in the single-packet version.
+        int err = NET_ERROR;
+        if (err == EAGAIN || err == EINTR)
+            return RST_AGAIN;
+
+        HLOGC(mglog.Debug, log << CONID() << "(sys)recvmmsg: " << SysStrError(err) << " [" << err << "]");
+        return RST_ERROR;
+    }
+
+    for (int i = 0; i < res; ++ i)
+    {
+        uint64_t arrival_time = m_bRcvTimestamp ? kernelArrivalTime(&mh[i].msg_hdr) : 0;
+        importPacket(*packets[i], mh[i].msg_len, mh[i].msg_hdr.msg_flags, arrival_time);
+    }
+
+    *r_count = res;
+    return res > 0 ? RST_OK : RST_AGAIN;
+#else
+    // No batched reading on this platform, just read one.
+    if (size < 1)
+        return RST_AGAIN;
+
+    EReadStatus st = recvSocket(&addrs[0], *packets[0]);
+    if (st == RST_OK)
+        *r_count = 1;
+    return st;
+#endif
+}
+
+#ifdef LINUX
+// Send the prepared messages as one sendmsg operation each, submitted
+// in one call, and wait until all of them complete, as the packets are
+// given back to the sender right after.
+int CChannel::sendIoUring(mmsghdr* mh, int* msgpkts, int nmsgs) const
+{
+    CGuard sendguard(m_SndRingLock);
+
+    for (int m = 0; m < nmsgs; ++ m)
+        m_pSndRing->prepSendMsg(m_iSocket, &mh[m].msg_hdr, m);
+
+    int sent = 0;
+    int done = 0;
+    int wait = nmsgs;
+    while (done < nmsgs)
+    {
+        int res = m_pSndRing->submitAndWait(wait, -1);
+        if (res < 0)
+        {
+            HLOGC(mglog.Debug, log << CONID() << "(sys)io_uring_enter: " << SysStrError(-res) << " after " << sent << " packets");
+            break;
+        }
+
+        uint64_t tag;
+        int opres;
+        while (m_pSndRing->reap(Ref(tag), Ref(opres)))
+        {
+            ++ done;
+            if (tag >= uint64_t(nmsgs))
+                continue;
+            if (opres >= 0)
+                sent += msgpkts[tag];
+            else if (checkGSOFailure(-opres, msgpkts[tag]))
+                sent += sendSegments(mh[tag].msg_hdr, msgpkts[tag]);
+        }
+        wait = nmsgs - done;
+    }
+
+    return sent;
+}
+
+// The UDP_SEGMENT probe at opening can't tell if the egress device does
+// the checksum offload, which GSO needs, and the route may change later.
+// If a GSO datagram fails for this reason, GSO is turned off for good.
+bool CChannel::checkGSOFailure(int err, int npkts) const
+{
+    if (npkts < 2 || (err != EIO && err != EINVAL))
+        return false;
+
+    if (m_bGSO)
+    {
+        LOGC(mglog.Warn, log << CONID() << "CHANNEL: UDP GSO failed: " << SysStrError(err) << ", sending without it");
+        m_bGSO = false;
+    }
+    return true;
+}
+
+// Send the packets glued into one GSO datagram as single datagrams.
+int CChannel::sendSegments(const msghdr& h, int npkts) const
+{
+    int sent = 0;
+    for (int k = 0; k < npkts; ++ k)
+    {
+        msghdr mh = h;
+        mh.msg_iov = h.msg_iov + 2 * k;
+        mh.msg_iovlen = 2;
+        mh.msg_control = NULL;
+        mh.msg_controllen = 0;
+        mh.msg_flags = 0;
+
+        if (::sendmsg(m_iSocket, &mh, 0) != -1)
+            ++ sent;
+    }
+    return sent;
+}
+#endif
+
+bool CChannel::postRecv(int slot, sockaddr_any* addr, CPacket* packet) const
+{
+#ifdef LINUX
+    CRecvSlot& s = m_pRecvSlots[slot];
+    s.m_pPacket = packet;
+    s.m_Vector[0] = packet->m_PacketVector[CPacket::PV_HEADER];
+    s.m_Vector[1] = packet->m_PacketVector[CPacket::PV_DATA];
+    s.m_Header.msg_name = addr;
+    s.m_Header.msg_namelen = m_iSockAddrSize;
+    s.m_Header.msg_iov = s.m_Vector;
+    s.m_Header.msg_iovlen = 2;
+    s.m_Header.msg_control = m_bRcvTimestamp ? s.m_Control : NULL;
+    s.m_Header.msg_controllen = m_bRcvTimestamp ? sizeof s.m_Control : 0;
+    s.m_Header.msg_flags = 0;
+
+    return m_pRcvRing->prepRecvMsg(m_iSocket, &s.m_Header, slot);
+#else
+    (void)slot; (void)addr; (void)packet;
+    return false;
+#endif
+}
+
+EReadStatus CChannel::reapRecv(int* slots, int size, ref_t<int> r_count) const
+{
+    *r_count = 0;
+#ifdef LINUX
+    int res = m_pRcvRing->submitAndWait(0, 0);
+    if (res < 0)
+    {
+        HLOGC(mglog.Debug, log << CONID() << "(sys)io_uring_enter: " << SysStrError(-res) << " [" << -res << "]");
+        return RST_ERROR;
+    }
+
+    uint64_t tag;
+    int opres;
+    while (*r_count < size && m_pRcvRing->reap(Ref(tag), Ref(opres)))
+    {
+        // Only waking up waitRead().
+        if (tag == WAKE_TAG)
+        {
+            m_bWakePosted = false;
+            continue;
+        }
+
+        CRecvSlot& s = m_pRecvSlots[tag];
+        if (opres < 0)
+        {
+            HLOGC(mglog.Debug, log << CONID() << "(sys)io_uring recvmsg: " << SysStrError(-opres) << " [" << -opres << "]");
+            s.m_pPacket->setLength(-1);
+        }
+        else
+        {
+            uint64_t arrival_time = m_bRcvTimestamp ? kernelArrivalTime(&s.m_Header) : 0;
+            importPacket(*s.m_pPacket, opres, s.m_Header.msg_flags, arrival_time);
+        }
+        slots[(*r_count) ++] = int(tag);
+    }
+
+    return *r_count > 0 ? RST_OK : RST_AGAIN;
+#else
+    (void)slots; (void)size;
+    return RST_ERROR;
+#endif
+}
+
+void CChannel::toNetworkOrder(CPacket& packet)
+{
+   // convert control information into network order
+   // XXX USE HtoNLA!
+   if (packet.isControl())
+      for (int i = 0, n = packet.getLength() / 4; i < n; ++ i)
+         *((uint32_t *)packet.m_pcData + i) = htonl(*((uint32_t *)packet.m_pcData + i));
+
+   // convert packet header into network order
+   //for (int j = 0; j < 4; ++ j)
+   //   packet.m_nHeader[j] = htonl(packet.m_nHeader[j]);
+   uint32_t* p = packet.m_nHeader;
+   for (int j = 0; j < 4; ++ j)
+   {
+      *p = htonl(*p);
+      ++ p;
+   }
+}
+
+void CChannel::toHostOrder(CPacket& packet)
+{
+   // convert back into local host order
+   //for (int k = 0; k < 4; ++ k)
+   //   packet.m_nHeader[k] = ntohl(packet.m_nHeader[k]);
+   uint32_t* p = packet.m_nHeader;
+   for (int k = 0; k < 4; ++ k)
+   {
+      *p = ntohl(*p);
+       ++ p;
+   }
+
+   if (packet.isControl())
+   {
+      for (int l = 0, n = packet.getLength() / 4; l < n; ++ l)
+         *((uint32_t *)packet.m_pcData + l) = ntohl(*((uint32_t *)packet.m_pcData + l));
+   }
+}
+
+#ifdef LINUX
+// With GRO the kernel may deliver several datagrams of the same size,
+// coalesced into one. The segments are read directly into consecutive
+// packets when the packets' payload buffers are set to the segment size
+// seen last time; when this guess fails, or the packets can't hold the
+// largest possible datagram, the segments are split from the linear buffer.
+EReadStatus CChannel::recvGRO(sockaddr_any* addrs, CPacket** packets, int size, ref_t<int> r_count) const
+{
+    if (m_iGROSegSize == 0)
+        m_iGROSegSize = CPacket::HDR_SIZE + packets[0]->getLength();
+
+    iovec iov[2 * MAX_BATCH];
+    size_t capacity = 0;
+    for (int i = 0; i < size; ++ i)
+    {
+        iov[2 * i] = packets[i]->m_PacketVector[CPacket::PV_HEADER];
+        iov[2 * i + 1] = packets[i]->m_PacketVector[CPacket::PV_DATA];
+        if (iov[2 * i + 1].iov_len > size_t(m_iGROSegSize) - CPacket::HDR_SIZE)
+            iov[2 * i + 1].iov_len = m_iGROSegSize - CPacket::HDR_SIZE;
+        capacity += iov[2 * i].iov_len + iov[2 * i + 1].iov_len;
+    }
+
+    bool direct = capacity >= MAX_GRO_BYTES;
+    iovec linear;
+    linear.iov_base = m_pGROBuffer;
+    linear.iov_len = MAX_GRO_BYTES;
+
+    // Room for the UDP_GRO segment size and the receive timestamp.
+    char cmsgbuf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(timespec))];
+    msghdr mh;
+    mh.msg_name = &addrs[0];
+    mh.msg_namelen = m_iSockAddrSize;
+    mh.msg_iov = direct ? iov : &linear;
+    mh.msg_iovlen = direct ? 2 * size : 1;
+    mh.msg_control = cmsgbuf;
+    mh.msg_controllen = sizeof cmsgbuf;
+    mh.msg_flags = 0;
+
+    int res = ::recvmsg(m_iSocket, &mh, MSG_DONTWAIT);
+    if (res == -1)
+    {
+        int err = NET_ERROR;
+        if (err == EAGAIN || err == EINTR)
+            return RST_AGAIN;
+
+        HLOGC(mglog.Debug, log << CONID() << "(sys)recvmsg: " << SysStrError(err) << " [" << err << "]");
+        return RST_ERROR;
+    }
+
+    if (res == 0)
+        return RST_AGAIN;
+
+    // No UDP_GRO control message means a single datagram.
+    int segsize = res;
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm))
+    {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+        {
+            memcpy(&segsize, CMSG_DATA(cm), sizeof segsize);
+            break;
+        }
+    }
+
+    int nseg = (res + segsize - 1) / segsize;
+    if (direct && (nseg > 1 ? segsize != m_iGROSegSize : res > m_iGROSegSize))
+    {
+        // The segments didn't land at the packet boundaries. Gather
+        // them back into the linear buffer to split them from there.
+        char* pos = m_pGROBuffer;
+        for (int i = 0, left = res; left > 0; ++ i)
+        {
+            size_t n = std::min(size_t(left), iov[i].iov_len);
+            memcpy(pos, iov[i].iov_base, n);
+            pos += n;
+            left -= n;
+        }
+        direct = false;
+    }
+
+    if (nseg > 1)
+        m_iGROSegSize = segsize;
+
+    // All segments arrived together.
+    uint64_t arrival_time = m_bRcvTimestamp ? kernelArrivalTime(&mh) : 0;
+
+    if (nseg > size)
+    {
+        HLOGC(mglog.Debug, log << CONID() << "GRO: only " << size << " of " << nseg << " segments fit, dropping the rest");
+        nseg = size;
+    }
+
+    for (int i = 0; i < nseg; ++ i)
+    {
+        CPacket& packet = *packets[i];
+        int seglen = std::min(segsize, res - i * segsize);
+
+        if (!direct)
+        {
+            const char* seg = m_pGROBuffer + i * segsize;
+            if (seglen < int(CPacket::HDR_SIZE) || size_t(seglen) > CPacket::HDR_SIZE + packet.getLength())
+            {
+                HLOGC(mglog.Debug, log << CONID() << "GRO: segment of " << seglen << " bytes doesn't fit, dropping");
+                packet.setLength(-1);
+                continue;
+            }
+            memcpy(packet.m_nHeader, seg, CPacket::HDR_SIZE);
+            memcpy(packet.m_pcData, seg + CPacket::HDR_SIZE, seglen - CPacket::HDR_SIZE);
+        }
+
+        if (i > 0)
+            addrs[i] = addrs[0];
+        importPacket(packet, seglen, mh.msg_flags & ~MSG_CTRUNC, arrival_time);
+    }
+
+    *r_count = nseg;
+    return RST_OK;
+}
+#endif
+
+// Take the next datagram from the in-process ring. Returns false if the ring
+// is empty; otherwise r_status is the result of the sanity check.
+bool CChannel::recvInproc(sockaddr* addr, CPacket& packet, ref_t<EReadStatus> r_status) const
+{
+    int srcport = 0;
+    int flags = 0;
+    int res = m_pInproc->recv(Ref(srcport), packet.m_PacketVector, 2, Ref(flags));
+    if (res == -1)
+    {
+        packet.setLength(-1);
+        *r_status = RST_AGAIN;
+        return false;
+    }
+
+    // The source is the in-process address with the sender's port.
+    memcpy(addr, &m_BindAddr, sizeof(sockaddr_in));
+    ((sockaddr_in*)addr)->sin_port = htons(srcport);
+
+    *r_status = importPacket(packet, res, flags, 0);
+    return true;
+}
+
+// Validate the datagram just read into the packet and convert it into
+// the local host order. A rejected packet gets the length -1.
+EReadStatus CChannel::importPacket(CPacket& packet, int res, int msg_flags, uint64_t arrival_time) const
+{
+    packet.setArrivalTime(arrival_time);
+
     // Sanity check for a case when it didn't fill in even the header
     if ( size_t(res) < CPacket::HDR_SIZE )
     {
-        status = RST_AGAIN;
         HLOGC(mglog.Debug, log << CONID() << "POSSIBLE ATTACK: received too short packet with " << res << " bytes");
-        goto Return_error;
+        packet.setLength(-1);
+        return RST_AGAIN;
     }
 
     // Fix for an issue with Linux Kernel found during tests at Tencent.
@@ -568,8 +1574,8 @@ EReadStatus CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
     {
         HLOGC(mglog.Debug, log << CONID() << "NET ERROR: packet size=" << res
             << " msg_flags=0x" << hex << msg_flags << ", possibly MSG_TRUNC (0x" << hex << int(MSG_TRUNC) << ")");
-        status = RST_AGAIN;
-        goto Return_error;
+        packet.setLength(-1);
+        return RST_AGAIN;
     }
 
     packet.setLength(res - CPacket::HDR_SIZE);
@@ -594,8 +1600,4 @@ EReadStatus CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
     }
 
     return RST_OK;
-
-Return_error:
-    packet.setLength(-1);
-    return status;
 }
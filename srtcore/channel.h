@@ -57,6 +57,14 @@ modified by
 #include "udt.h"
 #include "packet.h"
 #include "netinet_any.h"
+#include "utilities.h"
+
+class CUring;
+class CInprocRing;
+class CImpairment;
+#ifdef LINUX
+struct mmsghdr;
+#endif
 
 class CChannel
 {
@@ -68,11 +76,28 @@ public:
    // Currently just "unimplemented".
    std::string CONID() const { return ""; }
 
+      /// Upper limit for the number of datagrams transferred in one batch.
+
+   static const int MAX_BATCH = 256;
+
+      /// Limits of a single UDP GSO datagram: number of segments
+      /// and total payload (to fit in the IP packet length).
+
+   static const int MAX_GSO_SEGMENTS = 64;
+   static const size_t MAX_GSO_BYTES = 65000;
+
+      /// Limits of a coalesced UDP GRO datagram: number of segments
+      /// (UDP_GRO_CNT_MAX in the kernel) and total size.
+
+   static const int MAX_GRO_SEGMENTS = 64;
+   static const size_t MAX_GRO_BYTES = 65535;
+
    CChannel();
    CChannel(int version);
    ~CChannel();
 
-      /// Open a UDP channel.
+      /// Open a UDP channel. Bound to SRT_INPROC_ADDR, it gets
+      /// an in-process port instead of a UDP socket.
       /// @param [in] addr The local address that UDP will use.
 
    void open(const sockaddr* addr = NULL);
@@ -123,6 +148,14 @@ public:
 
    int sendto(const sockaddr* addr, CPacket& packet) const;
 
+      /// Send a batch of packets in one system call (sendmmsg where available).
+      /// @param [in] addrs array of @a size destination addresses.
+      /// @param [in] packets array of @a size packets.
+      /// @param [in] size number of packets to send.
+      /// @return Number of packets sent.
+
+   int sendto(sockaddr* const* addrs, CPacket* packets, int size) const;
+
       /// Receive a packet from the channel and record the source address.
       /// @param [in] addr pointer to the source address.
       /// @param [in] packet reference to a CPacket entity.
@@ -130,6 +163,49 @@ public:
 
    EReadStatus recvfrom(sockaddr* addr, CPacket& packet) const;
 
+      /// Receive up to @a size packets from the channel in one system call
+      /// (recvmmsg where available) and record their source addresses.
+      /// @param [out] addrs array of @a size source addresses.
+      /// @param [in] packets array of @a size packets to read into.
+      /// @param [in] size number of entries in @a addrs and @a packets.
+      /// @param [out] r_count number of leading entries that have been filled.
+      /// Those of them that did not pass the sanity check have length -1.
+      /// @return RST_OK if at least one datagram was read.
+
+   EReadStatus recvfrom(sockaddr_any* addrs, CPacket** packets, int size, ref_t<int> r_count) const;
+
+      /// Wait until there's something to read, the timeout expires or
+      /// interrupt() is called, whichever comes first. The recvfrom and
+      /// reapRecv functions never block, so the receiver calls this when
+      /// they have nothing more.
+      /// @param [in] timeout_us max time to wait in microseconds, -1 = no limit.
+
+   void waitRead(int64_t timeout_us) const;
+
+      /// Wake up the thread blocked in waitRead(), or make the next call
+      /// return immediately.
+
+   void interrupt() const;
+
+      /// Queue a receive operation on the io_uring backend. The packet and
+      /// the address must stay untouched until reapRecv() reports this slot.
+      /// @param [in] slot index of the receive slot, 0 to MAX_BATCH-1.
+      /// @param [out] addr the source address to be filled.
+      /// @param [in] packet the packet to read into.
+      /// @return false if the operation couldn't be queued.
+
+   bool postRecv(int slot, sockaddr_any* addr, CPacket* packet) const;
+
+      /// Submit the queued receive operations and collect the completed
+      /// ones, without waiting.
+      /// @param [out] slots array of @a size, filled with the completed slots.
+      /// @param [in] size max number of slots to report.
+      /// @param [out] r_count number of completed slots. The packets of those that
+      /// failed or did not pass the sanity check have length -1.
+      /// @return RST_OK if at least one slot completed.
+
+   EReadStatus reapRecv(int* slots, int size, ref_t<int> r_count) const;
+
 #ifdef SRT_ENABLE_IPOPTS
       /// Set the IP TTL.
       /// @param [in] ttl IP Time To Live.
@@ -154,6 +230,73 @@ public:
    int getIpToS() const;
 #endif
 
+      /// Enable sending runs of equal-sized packets to the same destination
+      /// as one UDP GSO (UDP_SEGMENT) datagram, where supported. Takes
+      /// effect when the channel is opened.
+      /// @param [in] gso true to enable.
+
+   void setGSO(bool gso) { m_bGSO = gso; }
+
+      /// Check if UDP GSO is in use.
+      /// @return true if the system accepted UDP GSO for this channel.
+
+   bool getGSO() const { return m_bGSO; }
+
+      /// Enable receiving coalesced UDP GRO datagrams, which the batched
+      /// recvfrom splits into the given packets. Takes effect when the
+      /// channel is opened.
+      /// @param [in] gro true to enable.
+
+   void setGRO(bool gro) { m_bGRO = gro; }
+
+      /// Check if UDP GRO is in use.
+      /// @return true if the system accepted UDP GRO for this channel.
+
+   bool getGRO() const { return m_bGRO; }
+
+      /// Enable the io_uring backend for receiving (through postRecv() and
+      /// reapRecv()) and batched sending, where supported. Takes effect
+      /// when the channel is opened.
+      /// @param [in] uring true to enable.
+
+   void setIoUring(bool uring) { m_bIoUring = uring; }
+
+      /// Check if the io_uring backend is in use.
+      /// @return true if the system accepted io_uring for this channel.
+
+   bool getIoUring() const { return m_bIoUring; }
+
+      /// Let other sockets bind to the same port (SO_REUSEPORT), so that
+      /// the system distributes the incoming flows among them. Takes
+      /// effect when the channel is opened.
+      /// @param [in] reuse true to enable.
+
+   void setReusePort(bool reuse) { m_bReusePort = reuse; }
+
+      /// Take the arrival time of the received packets from the kernel
+      /// (SO_TIMESTAMPNS), where supported, instead of the time when the
+      /// receiver gets to them. Takes effect when the channel is opened.
+      /// @param ts true to enable.
+
+   void setRcvTimestamp(bool ts) { m_bRcvTimestamp = ts; }
+
+      /// Check if the kernel receive timestamps are in use.
+      /// @return true if the system accepted SO_TIMESTAMPNS for this channel.
+
+   bool getRcvTimestamp() const { return m_bRcvTimestamp; }
+
+      /// Check if the channel uses an in-process port instead of a UDP socket.
+      /// @return true if bound to SRT_INPROC_ADDR.
+
+   bool isInproc() const { return m_pInproc != NULL; }
+
+      /// Pass the incoming packets through a network impairment model,
+      /// as described by CImpairment::parse(). Takes effect when the
+      /// channel is opened.
+      /// @param [in] spec the impairment specification, empty for none.
+
+   void setImpairment(const std::string& spec) { m_sImpair = spec; }
+
    int ioctlQuery(int type) const;
    int sockoptQuery(int level, int option) const;
 
@@ -162,6 +305,24 @@ public:
 
 private:
    void setUDPSockOpt();
+   EReadStatus recvSocket(sockaddr* addr, CPacket& packet) const;
+   EReadStatus recvSocket(sockaddr_any* addrs, CPacket** packets, int size, ref_t<int> r_count) const;
+   EReadStatus importPacket(CPacket& packet, int res, int msg_flags, uint64_t arrival_time) const;
+   EReadStatus recvGRO(sockaddr_any* addrs, CPacket** packets, int size, ref_t<int> r_count) const;
+   static void toNetworkOrder(CPacket& packet);
+   static void toHostOrder(CPacket& packet);
+   void setupIoUring();
+   void setupWakeup();
+   void openInproc(const sockaddr* addr);
+   void setupImpairment();
+   bool recvInproc(sockaddr* addr, CPacket& packet, ref_t<EReadStatus> r_status) const;
+#ifdef LINUX
+   int sendIoUring(mmsghdr* mh, int* msgpkts, int nmsgs) const;
+   int sendSegments(const msghdr& h, int npkts) const;
+   bool checkGSOFailure(int err, int npkts) const;
+#endif
+
+   struct CRecvSlot;
 
 private:
    int m_iIPversion;                    // IP version
@@ -174,6 +335,24 @@ private:
 #endif
    int m_iSndBufSize;                   // UDP sending buffer size
    int m_iRcvBufSize;                   // UDP receiving buffer size
+   mutable volatile bool m_bGSO;        // UDP generic segmentation offload for batched sending, off after a failure
+   bool m_bGRO;                         // UDP generic receive offload for batched reading
+   char* m_pGROBuffer;                  // linear buffer to split GRO datagrams from, when needed
+   mutable int m_iGROSegSize;           // the last seen GRO segment size
+   bool m_bIoUring;                     // io_uring backend in use
+   CUring* m_pRcvRing;                  // io_uring for receiving, used by the receiver worker only
+   CUring* m_pSndRing;                  // io_uring for batched sending
+   mutable pthread_mutex_t m_SndRingLock; // serializes the sender workers on m_pSndRing
+   CRecvSlot* m_pRecvSlots;             // receive operations in flight, MAX_BATCH
+   bool m_bReusePort;                   // SO_REUSEPORT before binding
+   bool m_bRcvTimestamp;                // kernel receive timestamps (SO_TIMESTAMPNS)
+   CInprocRing* m_pInproc;              // in-process port used instead of the socket, if bound to SRT_INPROC_ADDR
+   std::string m_sImpair;               // impairment specification
+   CImpairment* m_pImpair;              // impairment model of the incoming packets, used by the receiver worker only
+   int m_iWakeReadFd;                   // eventfd (or pipe) to interrupt waitRead()
+   int m_iWakeWriteFd;
+   mutable bool m_bWakePosted;          // a read of m_iWakeReadFd is pending on the io_uring
+   mutable uint64_t m_ullWakeValue;     // the value read by it
    sockaddr_any m_BindAddr;
 };
 
@@ -55,6 +55,7 @@ modified by
    #include <cstring>
    #include <cerrno>
    #include <unistd.h>
+   #include <time.h>
    #if __APPLE__
       #include "TargetConditionals.h"
    #endif
@@ -72,6 +73,7 @@ modified by
 #include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 #include "srt.h"
 #include "md5.h"
 #include "common.h"
@@ -80,19 +82,49 @@ modified by
 
 #include <srt_compat.h> // SysStrError
 
+#ifndef WIN32
+   #include <sched.h>
+#endif
+
+extern logging::Logger mglog;
+
+// Where CLOCK_MONOTONIC is available, both rdtsc() and getTime() read it:
+// it doesn't jump with the wall clock and needs no calibration. With
+// SRT_ENABLE_TSC_CLOCK the TSC is read instead, if it's invariant and the
+// CPU reports its frequency.
+#if !defined(WIN32) && !defined(OSX) && (TARGET_OS_IOS != 1) && (TARGET_OS_TV != 1) && defined(CLOCK_MONOTONIC)
+   #define SRT_MONOTONIC_CLOCK 1
+   // The timed waits on conditions then count on the same clock.
+   #define SRT_MONOTONIC_COND 1
+   #if defined(SRT_ENABLE_TSC_CLOCK) && (defined(__x86_64__) || defined(__i386__))
+      #define SRT_TSC_CLOCK 1
+      #include <cpuid.h>
+   #endif
+#endif
+
 bool CTimer::m_bUseMicroSecond = false;
+bool CTimer::s_bUseTSC = false;
 uint64_t CTimer::s_ullCPUFrequency = CTimer::readCPUFrequency();
 
 pthread_mutex_t CTimer::m_EventLock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t CTimer::m_EventCond = PTHREAD_COND_INITIALIZER;
+bool CTimer::s_bEventCondInit = CTimer::initEventCond();
+int64_t CTimer::s_llRealTimeOffset = CTimer::readRealTimeOffset();
+
+// Waking up from a sleep takes tens of microseconds, more under load.
+static const uint64_t DEFAULT_SPIN_US = 100;
 
 CTimer::CTimer():
 m_ullSchedTime(),
+m_ullSpin_tk(DEFAULT_SPIN_US * s_ullCPUFrequency),
+m_ullWakeups(0),
+m_ullWakeErrSum_tk(0),
+m_ullWakeErrMax_tk(0),
 m_TickCond(),
 m_TickLock()
 {
     pthread_mutex_init(&m_TickLock, NULL);
-    pthread_cond_init(&m_TickCond, NULL);
+    CGuard::createCond(m_TickCond);
 }
 
 CTimer::~CTimer()
@@ -109,21 +141,20 @@ void CTimer::rdtsc(uint64_t &x)
       return;
    }
 
-   #ifdef IA32
-      uint32_t lval, hval;
-      //asm volatile ("push %eax; push %ebx; push %ecx; push %edx");
-      //asm volatile ("xor %eax, %eax; cpuid");
-      asm volatile ("rdtsc" : "=a" (lval), "=d" (hval));
-      //asm volatile ("pop %edx; pop %ecx; pop %ebx; pop %eax");
-      x = hval;
-      x = (x << 32) | lval;
-   #elif defined(IA64)
-      asm ("mov %0=ar.itc" : "=r"(x) :: "memory");
-   #elif defined(AMD64)
-      uint32_t lval, hval;
-      asm ("rdtsc" : "=a" (lval), "=d" (hval));
-      x = hval;
-      x = (x << 32) | lval;
+   #if defined(SRT_MONOTONIC_CLOCK)
+      #if defined(SRT_TSC_CLOCK)
+         if (s_bUseTSC)
+         {
+            uint32_t lval, hval;
+            asm volatile ("rdtsc" : "=a" (lval), "=d" (hval));
+            x = hval;
+            x = (x << 32) | lval;
+            return;
+         }
+      #endif
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      x = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
    #elif defined(WIN32)
       //HANDLE hCurThread = ::GetCurrentThread(); 
       //DWORD_PTR dwOldMask = ::SetThreadAffinityMask(hCurThread, 1); 
@@ -139,22 +170,43 @@ void CTimer::rdtsc(uint64_t &x)
    #endif
 }
 
+#if defined(SRT_TSC_CLOCK)
+// The TSC frequency in ticks per microsecond, as reported by the CPU,
+// or 0 if the TSC can't be used as a clock.
+static uint64_t readTSCFrequency()
+{
+   unsigned eax, ebx, ecx, edx;
+
+   // The TSC must run at a constant rate in all power states.
+   if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+      return 0;
+
+   // TSC/crystal ratio and the crystal frequency.
+   if (__get_cpuid_max(0, NULL) < 0x15)
+      return 0;
+   __cpuid(0x15, eax, ebx, ecx, edx);
+   if (eax == 0 || ebx == 0 || ecx == 0)
+      return 0;
+
+   uint64_t hz = uint64_t(ecx) * ebx / eax;
+   // The time unit conversions need a whole number of ticks per microsecond.
+   if (hz % 1000000 != 0)
+      return 0;
+   return hz / 1000000;
+}
+#endif
+
 uint64_t CTimer::readCPUFrequency()
 {
    uint64_t frequency = 1;  // 1 tick per microsecond.
 
-   #if defined(IA32) || defined(IA64) || defined(AMD64)
-      uint64_t t1, t2;
-
-      rdtsc(t1);
-      timespec ts;
-      ts.tv_sec = 0;
-      ts.tv_nsec = 100000000;
-      nanosleep(&ts, NULL);
-      rdtsc(t2);
-
-      // CPU clocks per microsecond
-      frequency = (t2 - t1) / 100000;
+   #if defined(SRT_MONOTONIC_CLOCK)
+      #if defined(SRT_TSC_CLOCK)
+         frequency = readTSCFrequency();
+         s_bUseTSC = frequency > 0;
+         if (!s_bUseTSC)
+      #endif
+      frequency = 1000; // CLOCK_MONOTONIC, in nanoseconds
    #elif defined(WIN32)
       int64_t ccf;
       if (QueryPerformanceFrequency((LARGE_INTEGER *)&ccf))
@@ -198,46 +250,72 @@ void CTimer::sleepto(uint64_t nexttime)
 
    while (t < m_ullSchedTime)
    {
-#ifndef NO_BUSY_WAITING
-#ifdef IA32
-       __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
-#elif IA64
-       __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
-#elif AMD64
-       __asm__ volatile ("nop; nop; nop; nop; nop;");
-#endif
-#else
-       timeval now;
-       timespec timeout;
-       gettimeofday(&now, 0);
-       if (now.tv_usec < 990000)
+       if (m_ullSchedTime - t > m_ullSpin_tk)
        {
-           timeout.tv_sec = now.tv_sec;
-           timeout.tv_nsec = (now.tv_usec + 10000) * 1000;
+           // Sleep until the spin threshold; interrupt() wakes it up.
+           THREAD_PAUSED();
+           pthread_mutex_lock(&m_TickLock);
+           if (t < m_ullSchedTime && m_ullSchedTime - t > m_ullSpin_tk)
+               condTimedWaitUS(&m_TickCond, &m_TickLock, (m_ullSchedTime - t - m_ullSpin_tk) / s_ullCPUFrequency);
+           pthread_mutex_unlock(&m_TickLock);
+           THREAD_RESUMED();
        }
        else
        {
-           timeout.tv_sec = now.tv_sec + 1;
-           timeout.tv_nsec = (now.tv_usec + 10000 - 1000000) * 1000;
-       }
-       THREAD_PAUSED();
-       pthread_mutex_lock(&m_TickLock);
-       pthread_cond_timedwait(&m_TickCond, &m_TickLock, &timeout);
-       pthread_mutex_unlock(&m_TickLock);
-       THREAD_RESUMED();
+#ifdef IA32
+           __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
+#elif IA64
+           __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
+#elif AMD64
+           __asm__ volatile ("pause; nop; nop; nop; nop;");
 #endif
+       }
 
        rdtsc(t);
    }
+
+   if (m_ullSchedTime == nexttime)
+   {
+       uint64_t err = t - nexttime;
+       ++ m_ullWakeups;
+       m_ullWakeErrSum_tk += err;
+       if (err > m_ullWakeErrMax_tk)
+           m_ullWakeErrMax_tk = err;
+   }
 }
 
 void CTimer::interrupt()
 {
-   // schedule the sleepto time to the current CCs, so that it will stop
+   // schedule the sleepto time to the current CCs, so that it will stop;
+   // under the lock, so that it's not missed by a sleepto() going to sleep
+   CGuard tickguard(m_TickLock);
    rdtsc(m_ullSchedTime);
    tick();
 }
 
+void CTimer::setSpinThreshold(uint64_t us)
+{
+   m_ullSpin_tk = us * s_ullCPUFrequency;
+}
+
+uint64_t CTimer::getSpinThreshold() const
+{
+   return m_ullSpin_tk / s_ullCPUFrequency;
+}
+
+double CTimer::getWakeupErrAvg() const
+{
+   uint64_t n = m_ullWakeups;
+   if (n == 0)
+      return 0;
+   return double(m_ullWakeErrSum_tk) / n / s_ullCPUFrequency;
+}
+
+double CTimer::getWakeupErrMax() const
+{
+   return double(m_ullWakeErrMax_tk) / s_ullCPUFrequency;
+}
+
 void CTimer::tick()
 {
     pthread_cond_signal(&m_TickCond);
@@ -249,7 +327,17 @@ uint64_t CTimer::getTime()
     // however Cygwin platform is supported only for testing purposes.
 
     //For other systems without microsecond level resolution, add to this conditional compile
-#if defined(OSX) || (TARGET_OS_IOS == 1) || (TARGET_OS_TV == 1)
+#if defined(SRT_MONOTONIC_CLOCK)
+    if (s_bUseTSC)
+    {
+        uint64_t x;
+        rdtsc(x);
+        return x / s_ullCPUFrequency;
+    }
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#elif defined(OSX) || (TARGET_OS_IOS == 1) || (TARGET_OS_TV == 1)
     uint64_t x;
     rdtsc(x);
     return x / s_ullCPUFrequency;
@@ -261,28 +349,39 @@ uint64_t CTimer::getTime()
 #endif
 }
 
+int64_t CTimer::readRealTimeOffset()
+{
+    timeval t;
+    gettimeofday(&t, 0);
+    return int64_t(t.tv_sec * 1000000ULL + t.tv_usec) - int64_t(getTime());
+}
+
+uint64_t CTimer::toRealTime(uint64_t time_us)
+{
+    return time_us ? time_us + s_llRealTimeOffset : 0;
+}
+
+uint64_t CTimer::fromRealTime(uint64_t realtime_us)
+{
+    return realtime_us ? realtime_us - s_llRealTimeOffset : 0;
+}
+
 void CTimer::triggerEvent()
 {
     pthread_cond_signal(&m_EventCond);
 }
 
+// The static initializer can't select the clock.
+bool CTimer::initEventCond()
+{
+    CGuard::createCond(m_EventCond);
+    return true;
+}
+
 CTimer::EWait CTimer::waitForEvent()
 {
-    timeval now;
-    timespec timeout;
-    gettimeofday(&now, 0);
-    if (now.tv_usec < 990000)
-    {
-        timeout.tv_sec = now.tv_sec;
-        timeout.tv_nsec = (now.tv_usec + 10000) * 1000;
-    }
-    else
-    {
-        timeout.tv_sec = now.tv_sec + 1;
-        timeout.tv_nsec = (now.tv_usec + 10000 - 1000000) * 1000;
-    }
     pthread_mutex_lock(&m_EventLock);
-    int reason = pthread_cond_timedwait(&m_EventCond, &m_EventLock, &timeout);
+    int reason = condTimedWaitUS(&m_EventCond, &m_EventLock, 10000);
     pthread_mutex_unlock(&m_EventLock);
 
     return reason == ETIMEDOUT ? WT_TIMEOUT : reason == 0 ? WT_EVENT : WT_ERROR;
@@ -298,9 +397,15 @@ void CTimer::sleep()
 }
 
 int CTimer::condTimedWaitUS(pthread_cond_t* cond, pthread_mutex_t* mutex, uint64_t delay) {
+#if defined(SRT_MONOTONIC_COND)
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t time_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000 + delay;
+#else
     timeval now;
     gettimeofday(&now, 0);
     uint64_t time_us = now.tv_sec * 1000000ULL + now.tv_usec + delay;
+#endif
     timespec timeout;
     timeout.tv_sec = time_us / 1000000;
     timeout.tv_nsec = (time_us % 1000000) * 1000;
@@ -359,7 +464,15 @@ void CGuard::releaseMutex(pthread_mutex_t& lock)
 
 void CGuard::createCond(pthread_cond_t& cond)
 {
+#if defined(SRT_MONOTONIC_COND)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+#else
     pthread_cond_init(&cond, NULL);
+#endif
 }
 
 void CGuard::releaseCond(pthread_cond_t& cond)
@@ -367,6 +480,141 @@ void CGuard::releaseCond(pthread_cond_t& cond)
     pthread_cond_destroy(&cond);
 }
 
+namespace
+{
+
+struct CPlacement
+{
+   std::vector<int> m_viCPUs;   // affinity, empty = any CPU
+   int m_iPolicy;               // scheduling policy, -1 = inherited
+   int m_iPriority;
+};
+
+pthread_mutex_t s_ThreadConfigLock = PTHREAD_MUTEX_INITIALIZER;
+CPlacement s_aPlacement[SRT_THREAD_E_SIZE] = {
+   { std::vector<int>(), -1, 0 },
+   { std::vector<int>(), -1, 0 },
+   { std::vector<int>(), -1, 0 },
+   { std::vector<int>(), -1, 0 }
+};
+SRT_THREAD_HOOK_FN* s_pThreadHook = NULL;
+void* s_pThreadHookOpaque = NULL;
+
+}
+
+bool CThreadConfig::setAffinity(SRT_THREAD_CLASS tclass, const int* cpus, int ncpus)
+{
+   if (tclass < 0 || tclass >= SRT_THREAD_E_SIZE || ncpus < 0 || (ncpus > 0 && !cpus))
+      return false;
+
+#ifdef LINUX
+   for (int i = 0; i < ncpus; ++ i)
+   {
+      if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+         return false;
+   }
+#else
+   if (ncpus > 0)
+      return false;
+#endif
+
+   CGuard cg(s_ThreadConfigLock);
+   s_aPlacement[tclass].m_viCPUs.assign(cpus, cpus + ncpus);
+   return true;
+}
+
+bool CThreadConfig::setScheduling(SRT_THREAD_CLASS tclass, int policy, int priority)
+{
+   if (tclass < 0 || tclass >= SRT_THREAD_E_SIZE)
+      return false;
+
+   if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR)
+      return false;
+
+   if (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy))
+      return false;
+
+   CGuard cg(s_ThreadConfigLock);
+   s_aPlacement[tclass].m_iPolicy = policy;
+   s_aPlacement[tclass].m_iPriority = priority;
+   return true;
+}
+
+void CThreadConfig::setHook(void* opaque, SRT_THREAD_HOOK_FN* hook)
+{
+   CGuard cg(s_ThreadConfigLock);
+   s_pThreadHookOpaque = opaque;
+   s_pThreadHook = hook;
+}
+
+int CThreadConfig::create(pthread_t* thread, SRT_THREAD_CLASS tclass, void* (*fn)(void*), void* arg)
+{
+   CStart* st = new CStart;
+   st->m_pFn = fn;
+   st->m_pArg = arg;
+   st->m_Class = tclass;
+
+   pthread_attr_t attr;
+   pthread_attr_init(&attr);
+   bool placed = false;
+   {
+      CGuard cg(s_ThreadConfigLock);
+      st->m_pHook = s_pThreadHook;
+      st->m_pHookOpaque = s_pThreadHookOpaque;
+
+      const CPlacement& p = s_aPlacement[tclass];
+#ifdef LINUX
+      if (!p.m_viCPUs.empty())
+      {
+         cpu_set_t cpus;
+         CPU_ZERO(&cpus);
+         for (size_t i = 0; i < p.m_viCPUs.size(); ++ i)
+            CPU_SET(p.m_viCPUs[i], &cpus);
+         pthread_attr_setaffinity_np(&attr, sizeof cpus, &cpus);
+         placed = true;
+      }
+#endif
+      if (p.m_iPolicy != -1)
+      {
+         sched_param sp;
+         sp.sched_priority = p.m_iPriority;
+         pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+         pthread_attr_setschedpolicy(&attr, p.m_iPolicy);
+         pthread_attr_setschedparam(&attr, &sp);
+         placed = true;
+      }
+   }
+
+   int res = pthread_create(thread, placed ? &attr : NULL, start, st);
+   if (res != 0 && placed)
+   {
+      // Most likely no permission for the real-time policy, or no such CPU.
+      LOGC(mglog.Error, log << "Can't apply the placement of the thread class " << int(tclass)
+            << ": " << SysStrError(res) << " - starting it with the defaults");
+      res = pthread_create(thread, NULL, start, st);
+   }
+   pthread_attr_destroy(&attr);
+
+   if (res != 0)
+      delete st;
+   return res;
+}
+
+void* CThreadConfig::start(void* param)
+{
+   CStart st = *(CStart*)param;
+   delete (CStart*)param;
+
+   if (st.m_pHook)
+   {
+      char name[ThreadName::BUFSIZE] = "";
+      ThreadName::get(name);
+      st.m_pHook(st.m_pHookOpaque, st.m_Class, name);
+   }
+
+   return st.m_pFn(st.m_pArg);
+}
+
 //
 CUDTException::CUDTException(CodeMajor major, CodeMinor minor, int err):
 m_iMajor(major),
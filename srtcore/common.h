@@ -436,11 +436,25 @@ public:
 
    void sleep(uint64_t interval);
 
-      /// Seelp until CC "nexttime".
+      /// Seelp until CC "nexttime". The thread sleeps until the spin threshold
+      /// before that time and spins for the rest, so that it's woken up on time.
       /// @param [in] nexttime next time the caller is waken up.
 
    void sleepto(uint64_t nexttime);
 
+      /// Set the time before the wakeup time from which sleepto() spins.
+      /// @param [in] us the threshold in microseconds; 0 to only sleep.
+
+   void setSpinThreshold(uint64_t us);
+
+   uint64_t getSpinThreshold() const;
+
+      /// Average and maximum delay of the wakeups from sleepto() after the
+      /// requested time, not counting the interrupted ones, in microseconds.
+
+   double getWakeupErrAvg() const;
+   double getWakeupErrMax() const;
+
       /// Stop the sleep() or sleepto() methods.
 
    void interrupt();
@@ -461,11 +475,20 @@ public:
 
    static uint64_t getCPUFrequency();
 
-      /// check the current time, 64bit, in microseconds.
+      /// check the current time, 64bit, in microseconds. Where possible,
+      /// it's a monotonic clock with an arbitrary origin, not the wall clock.
       /// @return current time in microseconds.
 
    static uint64_t getTime();
 
+      /// Convert a time of getTime() into the system time, in microseconds
+      /// since epoch, as the API passes it in SRT_MSGCTRL::srctime, and
+      /// back. The offset between the clocks is taken once, at startup.
+      /// 0 (no time) stays 0.
+
+   static uint64_t toRealTime(uint64_t time_us);
+   static uint64_t fromRealTime(uint64_t realtime_us);
+
       /// trigger an event such as new connection, close, new data, etc. for "select" call.
 
    static void triggerEvent();
@@ -487,6 +510,7 @@ public:
       /// @param [in] cond Condition variable to wait for
       /// @param [in] mutex locked mutex associated with the condition variable
       /// @param [in] delay timeout in microseconds
+      /// @note The condition must be created with CGuard::createCond().
       /// @retval 0 Wait was successfull
       /// @retval ETIMEDOUT The wait timed out
 
@@ -497,17 +521,27 @@ private:
 
 private:
    uint64_t m_ullSchedTime;             // next schedulled time
+   uint64_t m_ullSpin_tk;               // spin instead of sleeping from this long before m_ullSchedTime
+
+   uint64_t m_ullWakeups;               // number of wakeups at the scheduled time
+   uint64_t m_ullWakeErrSum_tk;         // their total delay
+   uint64_t m_ullWakeErrMax_tk;         // and the longest one
 
    pthread_cond_t m_TickCond;
    pthread_mutex_t m_TickLock;
 
    static pthread_cond_t m_EventCond;
    static pthread_mutex_t m_EventLock;
+   static bool s_bEventCondInit;
+   static bool initEventCond();
+   static int64_t s_llRealTimeOffset;   // system time minus getTime()
+   static int64_t readRealTimeOffset();
 
 private:
    static uint64_t s_ullCPUFrequency;	// CPU frequency : clock cycles per microsecond
    static uint64_t readCPUFrequency();
    static bool m_bUseMicroSecond;       // No higher resolution timer available, use gettimeofday().
+   static bool s_bUseTSC;               // The TSC is read directly (SRT_ENABLE_TSC_CLOCK).
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -529,6 +563,9 @@ public:
    static void createMutex(pthread_mutex_t& lock);
    static void releaseMutex(pthread_mutex_t& lock);
 
+      /// Create a condition for CTimer::condTimedWaitUS(), on the monotonic
+      /// clock where the system can do it.
+
    static void createCond(pthread_cond_t& cond);
    static void releaseCond(pthread_cond_t& cond);
 
@@ -565,6 +602,38 @@ public:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Creates the SRT internal threads with the placement configured for their
+// class: CPU affinity, scheduling policy and priority, and the start hook
+// (see srt_setthreadaffinity(), srt_setthreadsched(), srt_setthreadhook()).
+
+class CThreadConfig
+{
+public:
+   static bool setAffinity(SRT_THREAD_CLASS tclass, const int* cpus, int ncpus);
+   static bool setScheduling(SRT_THREAD_CLASS tclass, int policy, int priority);
+   static void setHook(void* opaque, SRT_THREAD_HOOK_FN* hook);
+
+      /// Create a thread of the given class, like pthread_create(). The name
+      /// passed to the hook is the one of the calling thread, see ThreadName.
+      /// If the placement can't be applied, the thread gets the defaults.
+
+   static int create(pthread_t* thread, SRT_THREAD_CLASS tclass, void* (*fn)(void*), void* arg);
+
+private:
+   struct CStart
+   {
+      void* (*m_pFn)(void*);
+      void* m_pArg;
+      SRT_THREAD_CLASS m_Class;
+      SRT_THREAD_HOOK_FN* m_pHook;
+      void* m_pHookOpaque;
+   };
+
+   static void* start(void* param);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 // UDT Sequence Number 0 - (2^31 - 1)
 
 // seqcmp: compare two seq#, considering the wraping
@@ -63,11 +63,13 @@ modified by
 #endif
 #include <cmath>
 #include <sstream>
+#include <limits>
 #include "srt.h"
 #include "queue.h"
 #include "core.h"
 #include "logging.h"
 #include "crypto.h"
+#include "impair.h"
 #include "logging_api.h" // Required due to containing extern srt_logger_config
 
 // Again, just in case when some "smart guy" provided such a global macro
@@ -168,6 +170,7 @@ void CUDT::construct()
     m_pPeerAddr = NULL;
     m_pSNode = NULL;
     m_pRNode = NULL;
+    m_pTsbPdNode = NULL;
 
     m_ullSndHsLastTime_us = 0;
     m_iSndHsRetryCnt = SRT_MAX_HSRETRY+1; // Will be reset to 0 for HSv5, this value is important for HSv4
@@ -220,6 +223,18 @@ CUDT::CUDT()
    m_Linger.l_linger = 180;
    m_iUDPSndBufSize = 65536;
    m_iUDPRcvBufSize = m_iRcvBufSize * m_iMSS;
+   m_iUDPRcvBatch = 1;
+   m_iUDPSndBatch = 1;
+   m_iUDPSndWorkers = 1;
+   m_iUDPSndSpin = 100;
+   m_bUDPRcvHugePages = false;
+   m_iRcvBorrowMax = 256;
+   m_bUDPGSO = false;
+   m_bUDPGRO = false;
+   m_bUDPIoUring = false;
+   m_iUDPShards = 1;
+   m_bUDPRcvTimestamp = false;
+   m_sUDPImpair = "";
    m_iSockType = UDT_DGRAM;
    m_iIPversion = AF_INET;
    m_bRendezvous = false;
@@ -240,6 +255,7 @@ CUDT::CUDT()
    m_bDataSender = false;       //Sender only if true: does not recv data
    m_bTwoWayData = false;
    m_bOPT_TsbPd = true;        //Enable TsbPd on sender
+   m_bOPT_TsbPdShared = false;
    m_iOPT_TsbPdDelay = SRT_LIVE_DEF_LATENCY_MS;
    m_iOPT_PeerTsbPdDelay = 0;       //Peer's TsbPd delay as receiver (here is its minimum value, if used)
    m_bOPT_TLPktDrop = true;
@@ -281,6 +297,18 @@ CUDT::CUDT(const CUDT& ancestor)
    m_Linger = ancestor.m_Linger;
    m_iUDPSndBufSize = ancestor.m_iUDPSndBufSize;
    m_iUDPRcvBufSize = ancestor.m_iUDPRcvBufSize;
+   m_iUDPRcvBatch = ancestor.m_iUDPRcvBatch;
+   m_iUDPSndBatch = ancestor.m_iUDPSndBatch;
+   m_iUDPSndWorkers = ancestor.m_iUDPSndWorkers;
+   m_iUDPSndSpin = ancestor.m_iUDPSndSpin;
+   m_bUDPRcvHugePages = ancestor.m_bUDPRcvHugePages;
+   m_iRcvBorrowMax = ancestor.m_iRcvBorrowMax;
+   m_bUDPGSO = ancestor.m_bUDPGSO;
+   m_bUDPGRO = ancestor.m_bUDPGRO;
+   m_bUDPIoUring = ancestor.m_bUDPIoUring;
+   m_iUDPShards = ancestor.m_iUDPShards;
+   m_bUDPRcvTimestamp = ancestor.m_bUDPRcvTimestamp;
+   m_sUDPImpair = ancestor.m_sUDPImpair;
    m_iSockType = ancestor.m_iSockType;
    m_iIPversion = ancestor.m_iIPversion;
    m_bRendezvous = ancestor.m_bRendezvous;
@@ -300,6 +328,7 @@ CUDT::CUDT(const CUDT& ancestor)
    m_bDataSender = ancestor.m_bDataSender;
    m_bTwoWayData = ancestor.m_bTwoWayData;
    m_bOPT_TsbPd = ancestor.m_bOPT_TsbPd;
+   m_bOPT_TsbPdShared = ancestor.m_bOPT_TsbPdShared;
    m_iOPT_TsbPdDelay = ancestor.m_iOPT_TsbPdDelay;
    m_iOPT_PeerTsbPdDelay = ancestor.m_iOPT_PeerTsbPdDelay;
    m_bOPT_TLPktDrop = ancestor.m_bOPT_TLPktDrop;
@@ -339,6 +368,12 @@ CUDT::~CUDT()
    delete m_pPeerAddr;
    delete m_pSNode;
    delete m_pRNode;
+
+   if (m_pTsbPdNode)
+   {
+      s_UDTUnited.m_TsbPdQueue.remove(m_pTsbPdNode);
+      delete m_pTsbPdNode;
+   }
 }
 
 // This function is to make it possible for both C and C++
@@ -476,6 +511,123 @@ void CUDT::setOpt(SRT_SOCKOPT optName, const void* optval, int optlen)
 
         break;
 
+    case SRTO_UDP_RCVBATCH:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        if (*(int*)optval < 1 || *(int*)optval > CChannel::MAX_BATCH)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+        m_iUDPRcvBatch = *(int*)optval;
+        break;
+
+    case SRTO_UDP_SNDBATCH:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        if (*(int*)optval < 1 || *(int*)optval > CChannel::MAX_BATCH)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+        m_iUDPSndBatch = *(int*)optval;
+        break;
+
+    case SRTO_UDP_SNDWORKERS:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        if (*(int*)optval < 1 || *(int*)optval > CSndQueue::MAX_WORKERS)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+        m_iUDPSndWorkers = *(int*)optval;
+        break;
+
+    case SRTO_UDP_SNDSPIN:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        if (*(int*)optval < 0)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+        m_iUDPSndSpin = *(int*)optval;
+        break;
+
+    case SRTO_UDP_RCVHUGEPAGES:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        m_bUDPRcvHugePages = bool_int_value(optval, optlen);
+        break;
+
+    case SRTO_RCVBORROWMAX:
+        if (*(int*)optval < 0)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+        m_iRcvBorrowMax = *(int*)optval;
+        break;
+
+    case SRTO_UDP_GSO:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        m_bUDPGSO = bool_int_value(optval, optlen);
+        break;
+
+    case SRTO_UDP_GRO:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        m_bUDPGRO = bool_int_value(optval, optlen);
+        break;
+
+    case SRTO_UDP_IOURING:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        m_bUDPIoUring = bool_int_value(optval, optlen);
+        break;
+
+    case SRTO_UDP_SHARDS:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        if (*(int*)optval < 1 || *(int*)optval > CUDTUnited::MAX_SHARDS)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+#ifndef SO_REUSEPORT
+        // Sharing the port isn't possible here.
+        if (*(int*)optval > 1)
+            throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+#endif
+
+        m_iUDPShards = *(int*)optval;
+        break;
+
+    case SRTO_UDP_RCVTIMESTAMP:
+        if (m_bOpened)
+            throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+        m_bUDPRcvTimestamp = bool_int_value(optval, optlen);
+        break;
+
+    case SRTO_UDP_IMPAIR:
+        {
+            if (m_bOpened)
+                throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
+
+            string spec;
+            if (optlen == -1)
+                spec = (const char*)optval;
+            else
+                spec.assign((const char*)optval, optlen);
+
+            CImpairment::Config cfg;
+            if (!CImpairment::parse(spec, Ref(cfg)))
+                throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+            m_sUDPImpair = spec;
+        }
+        break;
+
     case SRTO_RENDEZVOUS:
         if (m_bConnecting || m_bConnected)
             throw CUDTException(MJ_NOTSUP, MN_ISBOUND, 0);
@@ -556,6 +708,12 @@ void CUDT::setOpt(SRT_SOCKOPT optName, const void* optval, int optlen)
         m_bOPT_TsbPd = bool_int_value(optval, optlen);
         break;
 
+    case SRTO_TSBPDSHARED:
+        if (m_bConnected)
+            throw CUDTException(MJ_NOTSUP, MN_ISCONNECTED, 0);
+        m_bOPT_TsbPdShared = bool_int_value(optval, optlen);
+        break;
+
     case SRTO_TSBPDDELAY:
         if (m_bConnected)
             throw CUDTException(MJ_NOTSUP, MN_ISCONNECTED, 0);
@@ -873,6 +1031,70 @@ void CUDT::getOpt(SRT_SOCKOPT optName, void* optval, int& optlen)
       optlen = sizeof(int);
       break;
 
+   case SRTO_UDP_RCVBATCH:
+      *(int*)optval = m_iUDPRcvBatch;
+      optlen = sizeof(int);
+      break;
+
+   case SRTO_UDP_SNDBATCH:
+      *(int*)optval = m_iUDPSndBatch;
+      optlen = sizeof(int);
+      break;
+
+   case SRTO_UDP_SNDWORKERS:
+      *(int*)optval = m_iUDPSndWorkers;
+      optlen = sizeof(int);
+      break;
+
+   case SRTO_UDP_SNDSPIN:
+      *(int*)optval = m_iUDPSndSpin;
+      optlen = sizeof(int);
+      break;
+
+   case SRTO_UDP_RCVHUGEPAGES:
+      *(bool*)optval = m_bUDPRcvHugePages;
+      optlen = sizeof(bool);
+      break;
+
+   case SRTO_RCVBORROWMAX:
+      *(int*)optval = m_iRcvBorrowMax;
+      optlen = sizeof(int);
+      break;
+
+   case SRTO_UDP_GSO:
+      // Reports whether it's really in use, if already bound.
+      *(bool*)optval = m_pSndQueue ? m_pSndQueue->m_pChannel->getGSO() : m_bUDPGSO;
+      optlen = sizeof(bool);
+      break;
+
+   case SRTO_UDP_GRO:
+      *(bool*)optval = m_pRcvQueue ? m_pRcvQueue->m_pChannel->getGRO() : m_bUDPGRO;
+      optlen = sizeof(bool);
+      break;
+
+   case SRTO_UDP_IOURING:
+      *(bool*)optval = m_pRcvQueue ? m_pRcvQueue->m_pChannel->getIoUring() : m_bUDPIoUring;
+      optlen = sizeof(bool);
+      break;
+
+   case SRTO_UDP_SHARDS:
+      *(int*)optval = m_iUDPShards;
+      optlen = sizeof(int);
+      break;
+
+   case SRTO_UDP_RCVTIMESTAMP:
+      *(bool*)optval = m_pRcvQueue ? m_pRcvQueue->m_pChannel->getRcvTimestamp() : m_bUDPRcvTimestamp;
+      optlen = sizeof(bool);
+      break;
+
+   case SRTO_UDP_IMPAIR:
+      if (size_t(optlen) < m_sUDPImpair.size()+1)
+          throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+      strcpy((char*)optval, m_sUDPImpair.c_str());
+      optlen = m_sUDPImpair.size();
+      break;
+
    case SRTO_RENDEZVOUS:
       *(bool *)optval = m_bRendezvous;
       optlen = sizeof(bool);
@@ -969,6 +1191,11 @@ void CUDT::getOpt(SRT_SOCKOPT optName, void* optval, int& optlen)
       optlen = sizeof(int32_t);
       break;
 
+   case SRTO_TSBPDSHARED:
+      *(int32_t*)optval = m_bOPT_TsbPdShared;
+      optlen = sizeof(int32_t);
+      break;
+
    case SRTO_TSBPDDELAY:
    case SRTO_RCVLATENCY:
       *(int32_t*)optval = m_iTsbPdDelay_ms;
@@ -1133,6 +1360,7 @@ void CUDT::clearData()
    m_iTraceSndDrop          = 0;
    m_iRcvDropTotal          = 0;
    m_iTraceRcvDrop          = 0;
+   m_iRcvShedTotal          = 0;
 
    m_iRcvUndecryptTotal        = 0;
    m_iTraceRcvUndecrypt        = 0;
@@ -1187,6 +1415,7 @@ void CUDT::open()
    m_pRNode->m_pUDT = this;
    m_pRNode->m_llTimeStamp_tk = 1;
    m_pRNode->m_pPrev = m_pRNode->m_pNext = NULL;
+   m_pRNode->m_iSlot = -1;
    m_pRNode->m_bOnList = false;
 
    m_iRTT = 10 * COMM_SYN_INTERVAL_US;
@@ -3619,6 +3848,13 @@ EConnectStatus CUDT::postConnect(const CPacket& response, bool rendezvous, CUDTE
 
     setupCC();
 
+    // The peer has responded only now, however long the handshake took:
+    // the timers of the connection start from here.
+    uint64_t currtime_tk;
+    CTimer::rdtsc(currtime_tk);
+    m_ullLastRspTime_tk = currtime_tk;
+    m_ullLastRspAckTime_tk = currtime_tk;
+
     // And, I am connected too.
     m_bConnecting = false;
     m_bConnected = true;
@@ -4057,144 +4293,172 @@ void* CUDT::tsbpd(void* param)
    self->m_bTsbPdAckWakeup = true;
    while (!self->m_bClosing)
    {
-      int32_t current_pkt_seq = 0;
-      uint64_t tsbpdtime = 0;
-      bool rxready = false;
+      uint64_t tsbpdtime = self->tsbpdCheck();
+      THREAD_PAUSED();
+      if (tsbpdtime != 0)
+      {
+         int64_t timediff = int64_t(tsbpdtime) - int64_t(CTimer::getTime());
+         CTimer::condTimedWaitUS(&self->m_RcvTsbPdCond, &self->m_RecvLock, timediff);
+      }
+      else
+      {
+         pthread_cond_wait(&self->m_RcvTsbPdCond, &self->m_RecvLock);
+      }
+      THREAD_RESUMED();
+   }
+   CGuard::leaveCS(self->m_RecvLock);
+   THREAD_EXIT();
+   HLOGC(tslog.Debug, log << self->CONID() << "tsbpd: EXITING");
+   return NULL;
+}
+
+/*
+* One round of the TsbPd thread, also run by the shared TSBPD workers.
+* Signal the reader and EPOLL_IN if a packet is ready to play, drop the
+* packets that are too late. Called with m_RecvLock locked.
+* Returns the time when the packet at the head of the queue is to be played,
+* or 0 if nothing is to be done until the next kickTsbPd().
+*/
+uint64_t CUDT::tsbpdCheck()
+{
+   int32_t current_pkt_seq = 0;
+   uint64_t tsbpdtime = 0;
+   bool rxready = false;
 
-      CGuard::enterCS(self->m_AckLock);
+   CGuard::enterCS(m_AckLock);
 
 #ifdef SRT_ENABLE_RCVBUFSZ_MAVG
-      self->m_pRcvBuffer->updRcvAvgDataSize(CTimer::getTime());
+   m_pRcvBuffer->updRcvAvgDataSize(CTimer::getTime());
 #endif
 
-      if (self->m_bTLPktDrop)
-      {
-          int32_t skiptoseqno = -1;
-          bool passack = true; //Get next packet to wait for even if not acked
-
-          rxready = self->m_pRcvBuffer->getRcvFirstMsg(Ref(tsbpdtime), Ref(passack), Ref(skiptoseqno), Ref(current_pkt_seq));
-          /*
-           * VALUES RETURNED:
-           *
-           * rxready:     if true, packet at head of queue ready to play
-           * tsbpdtime:   timestamp of packet at head of queue, ready or not. 0 if none.
-           * passack:     if true, ready head of queue not yet acknowledged
-           * skiptoseqno: sequence number of packet at head of queue if ready to play but
-           *              some preceeding packets are missing (need to be skipped). -1 if none. 
-           */
-          if (rxready)
-          {
-             /* Packet ready to play according to time stamp but... */
-             int seqlen = CSeqNo::seqoff(self->m_iRcvLastSkipAck, skiptoseqno);
+   if (m_bTLPktDrop)
+   {
+       int32_t skiptoseqno = -1;
+       bool passack = true; //Get next packet to wait for even if not acked
 
-             if (skiptoseqno != -1 && seqlen > 0)
-             {
-                /* 
-                * skiptoseqno != -1,
-                * packet ready to play but preceeded by missing packets (hole).
-                */
+       rxready = m_pRcvBuffer->getRcvFirstMsg(Ref(tsbpdtime), Ref(passack), Ref(skiptoseqno), Ref(current_pkt_seq));
+       /*
+        * VALUES RETURNED:
+        *
+        * rxready:     if true, packet at head of queue ready to play
+        * tsbpdtime:   timestamp of packet at head of queue, ready or not. 0 if none.
+        * passack:     if true, ready head of queue not yet acknowledged
+        * skiptoseqno: sequence number of packet at head of queue if ready to play but
+        *              some preceeding packets are missing (need to be skipped). -1 if none. 
+        */
+       if (rxready)
+       {
+          /* Packet ready to play according to time stamp but... */
+          int seqlen = CSeqNo::seqoff(m_iRcvLastSkipAck, skiptoseqno);
 
-                /* Update drop/skip stats */
-                self->m_iRcvDropTotal += seqlen;
-                self->m_iTraceRcvDrop += seqlen;
-                /* Estimate dropped/skipped bytes from average payload */
-                int avgpayloadsz = self->m_pRcvBuffer->getRcvAvgPayloadSize();
-                self->m_ullRcvBytesDropTotal += seqlen * avgpayloadsz;
-                self->m_ullTraceRcvBytesDrop += seqlen * avgpayloadsz;
+          if (skiptoseqno != -1 && seqlen > 0)
+          {
+             /* 
+             * skiptoseqno != -1,
+             * packet ready to play but preceeded by missing packets (hole).
+             */
+
+             /* Update drop/skip stats */
+             m_iRcvDropTotal += seqlen;
+             m_iTraceRcvDrop += seqlen;
+             /* Estimate dropped/skipped bytes from average payload */
+             int avgpayloadsz = m_pRcvBuffer->getRcvAvgPayloadSize();
+             m_ullRcvBytesDropTotal += seqlen * avgpayloadsz;
+             m_ullTraceRcvBytesDrop += seqlen * avgpayloadsz;
 
-                self->unlose(self->m_iRcvLastSkipAck, CSeqNo::decseq(skiptoseqno)); //remove(from,to-inclusive)
-                self->m_pRcvBuffer->skipData(seqlen);
+             unlose(m_iRcvLastSkipAck, CSeqNo::decseq(skiptoseqno)); //remove(from,to-inclusive)
+             m_pRcvBuffer->skipData(seqlen);
 
-                self->m_iRcvLastSkipAck = skiptoseqno;
+             m_iRcvLastSkipAck = skiptoseqno;
 
 #if ENABLE_LOGGING
-                int64_t timediff = 0;
-                if ( tsbpdtime )
-                     timediff = int64_t(tsbpdtime) - int64_t(CTimer::getTime());
+             int64_t timediff = 0;
+             if ( tsbpdtime )
+                  timediff = int64_t(tsbpdtime) - int64_t(CTimer::getTime());
 #if ENABLE_HEAVY_LOGGING
-                HLOGC(tslog.Debug, log << self->CONID() << "tsbpd: DROPSEQ: up to seq=" << CSeqNo::decseq(skiptoseqno)
-                    << " (" << seqlen << " packets) playable at " << logging::FormatTime(tsbpdtime) << " delayed "
-                    << (timediff/1000) << "." << (timediff%1000) << " ms");
+             HLOGC(tslog.Debug, log << CONID() << "tsbpd: DROPSEQ: up to seq=" << CSeqNo::decseq(skiptoseqno)
+                 << " (" << seqlen << " packets) playable at " << logging::FormatTime(tsbpdtime) << " delayed "
+                 << (timediff/1000) << "." << (timediff%1000) << " ms");
 #endif
-                LOGC(dlog.Debug, log << "RCV-DROPPED packet delay=" << (timediff%1000) << "ms");
+             LOGC(dlog.Debug, log << "RCV-DROPPED packet delay=" << (timediff%1000) << "ms");
 #endif
 
-                tsbpdtime = 0; //Next sent ack will unblock
-                rxready = false;
-             }
-             else if (passack)
-             {
-                /* Packets ready to play but not yet acknowledged (should occurs withing 10ms) */
-                rxready = false;
-                tsbpdtime = 0; //Next sent ack will unblock
-             } /* else packet ready to play */
-          } /* else packets not ready to play */
-      }
-      else
-      {
-          rxready = self->m_pRcvBuffer->isRcvDataReady(Ref(tsbpdtime), Ref(current_pkt_seq));
-      }
-      CGuard::leaveCS(self->m_AckLock);
+             tsbpdtime = 0; //Next sent ack will unblock
+             rxready = false;
+          }
+          else if (passack)
+          {
+             /* Packets ready to play but not yet acknowledged (should occurs withing 10ms) */
+             rxready = false;
+             tsbpdtime = 0; //Next sent ack will unblock
+          } /* else packet ready to play */
+       } /* else packets not ready to play */
+   }
+   else
+   {
+       rxready = m_pRcvBuffer->isRcvDataReady(Ref(tsbpdtime), Ref(current_pkt_seq));
+   }
+   CGuard::leaveCS(m_AckLock);
 
-      if (rxready)
+   if (rxready)
+   {
+       HLOGC(tslog.Debug, log << CONID() << "tsbpd: PLAYING PACKET seq=" << current_pkt_seq
+           << " (belated " << ((CTimer::getTime() - tsbpdtime)/1000.0) << "ms)");
+      /*
+      * There are packets ready to be delivered
+      * signal a waiting "recv" call if there is any data available
+      */
+      if (m_bSynRecving)
       {
-          HLOGC(tslog.Debug, log << self->CONID() << "tsbpd: PLAYING PACKET seq=" << current_pkt_seq
-              << " (belated " << ((CTimer::getTime() - tsbpdtime)/1000.0) << "ms)");
-         /*
-         * There are packets ready to be delivered
-         * signal a waiting "recv" call if there is any data available
-         */
-         if (self->m_bSynRecving)
-         {
-             pthread_cond_signal(&self->m_RecvDataCond);
-         }
-         /*
-         * Set EPOLL_IN to wakeup any thread waiting on epoll
-         */
-         self->s_UDTUnited.m_EPoll.update_events(self->m_SocketID, self->m_sPollID, UDT_EPOLL_IN, true);
-         CTimer::triggerEvent();
-         tsbpdtime = 0;
+          pthread_cond_signal(&m_RecvDataCond);
       }
+      /*
+      * Set EPOLL_IN to wakeup any thread waiting on epoll
+      */
+      s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, true);
+      CTimer::triggerEvent();
+      tsbpdtime = 0;
+   }
 
-      if (tsbpdtime != 0)
-      {
-         int64_t timediff = int64_t(tsbpdtime) - int64_t(CTimer::getTime());
-         /*
-         * Buffer at head of queue is not ready to play.
-         * Schedule wakeup when it will be.
-         */
-          self->m_bTsbPdAckWakeup = false;
-          THREAD_PAUSED();
-          HLOGC(tslog.Debug, log << self->CONID() << "tsbpd: FUTURE PACKET seq=" << current_pkt_seq
-              << " T=" << logging::FormatTime(tsbpdtime) << " - waiting " << (timediff/1000.0) << "ms");
-          CTimer::condTimedWaitUS(&self->m_RcvTsbPdCond, &self->m_RecvLock, timediff);
-          THREAD_RESUMED();
-      }
-      else
-      {
-         /*
-         * We have just signaled epoll; or
-         * receive queue is empty; or
-         * next buffer to deliver is not in receive queue (missing packet in sequence).
-         *
-         * Block until woken up by one of the following event:
-         * - All ready-to-play packets have been pulled and EPOLL_IN cleared (then loop to block until next pkt time if any)
-         * - New buffers ACKed
-         * - Closing the connection
-         */
-         HLOGC(tslog.Debug, log << self->CONID() << "tsbpd: no data, scheduling wakeup at ack");
-         self->m_bTsbPdAckWakeup = true;
-         THREAD_PAUSED();
-         pthread_cond_wait(&self->m_RcvTsbPdCond, &self->m_RecvLock);
-         THREAD_RESUMED();
-      }
+   if (tsbpdtime != 0)
+   {
+      /*
+      * Buffer at head of queue is not ready to play.
+      * Schedule wakeup when it will be.
+      */
+       m_bTsbPdAckWakeup = false;
+#if ENABLE_HEAVY_LOGGING
+       int64_t timediff = int64_t(tsbpdtime) - int64_t(CTimer::getTime());
+       HLOGC(tslog.Debug, log << CONID() << "tsbpd: FUTURE PACKET seq=" << current_pkt_seq
+           << " T=" << logging::FormatTime(tsbpdtime) << " - waiting " << (timediff/1000.0) << "ms");
+#endif
+       return tsbpdtime;
    }
-   CGuard::leaveCS(self->m_RecvLock);
-   THREAD_EXIT();
-   HLOGC(tslog.Debug, log << self->CONID() << "tsbpd: EXITING");
-   return NULL;
+
+   /*
+   * We have just signaled epoll; or
+   * receive queue is empty; or
+   * next buffer to deliver is not in receive queue (missing packet in sequence).
+   *
+   * Block until woken up by one of the following event:
+   * - All ready-to-play packets have been pulled and EPOLL_IN cleared (then loop to block until next pkt time if any)
+   * - New buffers ACKed
+   * - Closing the connection
+   */
+   HLOGC(tslog.Debug, log << CONID() << "tsbpd: no data, scheduling wakeup at ack");
+   m_bTsbPdAckWakeup = true;
+   return 0;
+}
+
+void CUDT::kickTsbPd()
+{
+   if (m_pTsbPdNode)
+      s_UDTUnited.m_TsbPdQueue.schedule(m_pTsbPdNode, 0);
+   else
+      pthread_cond_signal(&m_RcvTsbPdCond);
 }
 
+
 bool CUDT::prepareConnectionObjects(const CHandShake& hs, HandshakeSide hsd, CUDTException* eout)
 {
     // This will be lazily created due to being the common
@@ -4582,7 +4846,7 @@ void CUDT::close()
 
    // remove this socket from the snd queue
    if (m_bConnected)
-      m_pSndQueue->m_pSndUList->remove(this);
+      m_pSndQueue->getSndUList(this)->remove(this);
 
    /*
     * update_events below useless
@@ -4652,7 +4916,12 @@ void CUDT::close()
       m_bConnected = false;
    }
 
-   if ( m_bTsbPd  && !pthread_equal(m_RcvTsbPdThread, pthread_t()))
+   if (m_pTsbPdNode)
+   {
+       HLOGC(mglog.Debug, log << "CLOSING, removing from the shared TSBPD queue");
+       s_UDTUnited.m_TsbPdQueue.remove(m_pTsbPdNode);
+   }
+   else if ( m_bTsbPd  && !pthread_equal(m_RcvTsbPdThread, pthread_t()))
    {
        HLOGC(mglog.Debug, log << "CLOSING, joining TSBPD thread...");
        void* retval;
@@ -4725,14 +4994,13 @@ int CUDT::send(const char* data, int len)
               }
               else
               {
+                  // getTime() isn't the wall clock, so the deadline for the
+                  // condition variable is counted from now on each round.
                   uint64_t exptime = CTimer::getTime() + m_iSndTimeOut * 1000ULL;
-                  timespec locktime;
+                  uint64_t now;
 
-                  locktime.tv_sec = exptime / 1000000;
-                  locktime.tv_nsec = (exptime % 1000000) * 1000;
-
-                  while (stillConnected() && (sndBuffersLeft() <= 0) && m_bPeerHealth && (CTimer::getTime() < exptime))
-                      pthread_cond_timedwait(&m_SendBlockCond, &m_SendBlockLock, &locktime);
+                  while (stillConnected() && (sndBuffersLeft() <= 0) && m_bPeerHealth && ((now = CTimer::getTime()) < exptime))
+                      CTimer::condTimedWaitUS(&m_SendBlockCond, &m_SendBlockLock, exptime - now);
               }
           }
 
@@ -4767,7 +5035,7 @@ int CUDT::send(const char* data, int len)
    m_pSndBuffer->addBuffer(data, size); // inorder=false, ttl=-1
 
    // insert this socket to snd list if it is not on the list yet
-   m_pSndQueue->m_pSndUList->update(this, CSndUList::DONT_RESCHEDULE);
+   m_pSndQueue->getSndUList(this)->update(this, CSndUList::DONT_RESCHEDULE);
 
    if (sndBuffersLeft() <= 0)
    {
@@ -4868,7 +5136,7 @@ int CUDT::receiveBuffer(char* data, int len)
     if (m_bTsbPd)
     {
         HLOGP(tslog.Debug, "Ping TSBPD thread to schedule wakeup");
-        pthread_cond_signal(&m_RcvTsbPdCond);
+        kickTsbPd();
     }
 
 
@@ -4945,6 +5213,9 @@ void CUDT::checkNeedDrop(ref_t<bool> bCongestion)
         }
         *bCongestion = true;
         CGuard::leaveCS(m_AckLock);
+
+        // Outside m_AckLock, which the sender worker takes with the list locked.
+        releaseRetired();
     }
     else if (timespan_ms > (m_iPeerTsbPdDelay_ms/2))
     {
@@ -4963,7 +5234,49 @@ int CUDT::sendmsg(const char* data, int len, int msttl, bool inorder, uint64_t s
     return this->sendmsg2(data, len, Ref(mctrl));
 }
 
-int CUDT::sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
+void CUDT::releaseRetired()
+{
+    std::vector<CSndCompletion> done;
+    std::vector<char*> freed;
+    if (m_pSndBuffer->takeRetired(done, freed))
+        m_pSndQueue->getSndUList(this)->addCompletions(done, m_pSndBuffer->getPool(), freed);
+}
+
+// Total size of the segments, or -1 if they can't be used.
+static int SegmentsLength(const SRT_SEGMENT* segs, int nsegs)
+{
+    if (!segs || nsegs <= 0)
+        return -1;
+
+    int64_t len = 0;
+    for (int i = 0; i < nsegs; ++ i)
+    {
+        if (segs[i].len < 0 || (segs[i].len > 0 && !segs[i].data))
+            return -1;
+        len += segs[i].len;
+    }
+
+    return len > std::numeric_limits<int>::max() ? -1 : int(len);
+}
+
+int CUDT::sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl, const CSndCompletion* done)
+{
+    SRT_SEGMENT seg;
+    seg.data = const_cast<char*>(data);
+    seg.len = len;
+    return sendSegments(&seg, len, r_mctrl, done);
+}
+
+int CUDT::sendmsgv(const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> r_mctrl)
+{
+    int len = SegmentsLength(segs, nsegs);
+    if (len < 0)
+        throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+    return sendSegments(segs, len, r_mctrl, NULL);
+}
+
+int CUDT::sendSegments(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> r_mctrl, const CSndCompletion* done)
 {
     SRT_MSGCTRL& mctrl = *r_mctrl;
     bool bCongestion = false;
@@ -4995,10 +5308,14 @@ int CUDT::sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
             mn = MN_INVALBUFFERAPI;
         }
 
-        if (!m_Smoother->checkTransArgs(api, Smoother::STAD_SEND, data, len, msttl, inorder))
+        if (!m_Smoother->checkTransArgs(api, Smoother::STAD_SEND, segs[0].data, len, msttl, inorder))
             throw CUDTException(MJ_NOTSUP, mn, 0);
     }
 
+    // The caller's buffer can't be given back after a part of it.
+    if (done && !m_bMessageAPI)
+        throw CUDTException(MJ_NOTSUP, MN_INVALBUFFERAPI, 0);
+
     // NOTE: the length restrictions differ in STREAM API and in MESSAGE API:
 
     // - STREAM API:
@@ -5140,12 +5457,25 @@ int CUDT::sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
         size = min(len, sndBuffersLeft() * m_iMaxSRTPayloadSize);
     }
 
-    // insert the user buffer into the sending list
-    m_pSndBuffer->addBuffer(data, size, mctrl.msgttl, mctrl.inorder, mctrl.srctime, Ref(mctrl.msgno));
+    // insert the user buffer into the sending list; the packets are
+    // encrypted in place, so an encrypted message is always copied
+    // The source time comes in the system time.
+    uint64_t srctime = CTimer::fromRealTime(mctrl.srctime);
+    bool zerocopy = done && m_pCryptoControl->getSndCryptoFlags() == EK_NOENC;
+    if (zerocopy)
+    {
+        m_pSndBuffer->addBufferRef(segs[0].data, size, mctrl.msgttl, mctrl.inorder, srctime, *done, Ref(mctrl.msgno));
+    }
+    else
+    {
+        reserveSndBuffer(size, m_bSynSending ? m_iSndTimeOut : 0);
+        if (!m_pSndBuffer->addBufferV(segs, size, mctrl.msgttl, mctrl.inorder, srctime, Ref(mctrl.msgno)))
+            throw CUDTException(MJ_AGAIN, MN_WRAVAIL, 0);
+    }
     HLOGC(dlog.Debug, log << CONID() << "sock:SENDING srctime: " << mctrl.srctime << "us DATA SIZE: " << size);
 
     // insert this socket to the snd list if it is not on the list yet
-    m_pSndQueue->m_pSndUList->update(this, CSndUList::rescheduleIf(bCongestion));
+    m_pSndQueue->getSndUList(this)->update(this, CSndUList::rescheduleIf(bCongestion));
 
     if (sndBuffersLeft() < 1) // XXX Not sure if it should test if any space in the buffer, or as requried.
     {
@@ -5153,6 +5483,9 @@ int CUDT::sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
         s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, false);
     }
 
+    if (done && !zerocopy)
+        done->run();
+
 #ifdef SRT_ENABLE_ECN
     if (bCongestion)
         throw CUDTException(MJ_AGAIN, MN_CONGESTION, 0);
@@ -5160,6 +5493,57 @@ int CUDT::sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
     return size;
 }
 
+void CUDT::reserveSndBuffer(int len, int timeout_ms)
+{
+    if (m_pSndBuffer->reserve(len, 0))
+        return;
+
+    if (timeout_ms == 0)
+    {
+        // Not writable until the pool gets some blocks back. Registered
+        // before trying again, so that a release in between isn't missed.
+        s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, false);
+        m_pSndBuffer->getPool()->addStarved(m_SocketID);
+        if (m_pSndBuffer->reserve(len, 0))
+        {
+            s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, true);
+            return;
+        }
+        throw CUDTException(MJ_AGAIN, MN_WRAVAIL, 0);
+    }
+
+    HLOGC(dlog.Debug, log << CONID() << "reserveSndBuffer: the block pool is exhausted, waiting for " << len << " bytes");
+
+    // Waiting in slices, so that a broken connection isn't noticed late.
+    const uint64_t slice_us = 100000;
+    uint64_t exptime = timeout_ms < 0 ? 0 : CTimer::getTime() + timeout_ms * 1000ULL;
+    for (;;)
+    {
+        if (m_bBroken || m_bClosing)
+            throw CUDTException(MJ_CONNECTION, MN_CONNLOST, 0);
+        else if (!m_bConnected)
+            throw CUDTException(MJ_CONNECTION, MN_NOCONN, 0);
+
+        uint64_t wait_us = slice_us;
+        if (exptime)
+        {
+            uint64_t now = CTimer::getTime();
+            if (now >= exptime)
+                throw CUDTException(MJ_AGAIN, MN_XMTIMEOUT, 0);
+            wait_us = min(slice_us, exptime - now);
+        }
+
+        if (m_pSndBuffer->reserve(len, wait_us))
+            return;
+    }
+}
+
+void CUDT::sndPoolReleased(const vector<int32_t>& ids)
+{
+    for (vector<int32_t>::const_iterator i = ids.begin(); i != ids.end(); ++ i)
+        s_UDTUnited.m_EPoll.update_events(*i, UDT_EPOLL_OUT, true);
+}
+
 int CUDT::recv(char* data, int len)
 {
     if (!m_bConnected || !m_Smoother.ready())
@@ -5219,17 +5603,106 @@ int CUDT::recvmsg2(char* data, int len, ref_t<SRT_MSGCTRL> mctrl)
     return receiveBuffer(data, len);
 }
 
+int CUDT::borrowmsg(ref_t<SRT_BORROWED> r_msg)
+{
+    SRT_BORROWED& msg = *r_msg;
+    if (!m_bConnected || !m_Smoother.ready())
+        throw CUDTException(MJ_CONNECTION, MN_NOCONN, 0);
+
+    if (!m_bMessageAPI)
+        throw CUDTException(MJ_NOTSUP, MN_INVALBUFFERAPI, 0);
+
+    msg.mctrl = srt_msgctrl_default;
+    CRcvBorrowed* borrowed = NULL;
+    int res = receiveMessage(NULL, std::numeric_limits<int>::max(), Ref(msg.mctrl), &borrowed);
+    if (!borrowed)
+        return 0;
+
+    // The index is shifted so that a zeroed handle is never valid.
+    msg.handle = (void*)intptr_t(borrowed->m_iIndex + 1);
+    msg.segments = &borrowed->m_vSegments[0];
+    msg.nsegments = borrowed->m_vSegments.size();
+    msg.len = res;
+    return res;
+}
+
+void CUDT::releasemsg(ref_t<SRT_BORROWED> r_msg)
+{
+    SRT_BORROWED& msg = *r_msg;
+    CGuard recvguard(m_RecvLock);
+
+    if (!m_pRcvBuffer || !m_pRcvBuffer->releaseMsg(int(intptr_t(msg.handle)) - 1))
+        throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+
+    msg.handle = NULL;
+    msg.segments = NULL;
+    msg.nsegments = 0;
+    msg.len = 0;
+}
+
+int CUDT::recvmsgv(const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> mctrl)
+{
+    if (!m_bConnected || !m_Smoother.ready())
+        throw CUDTException(MJ_CONNECTION, MN_NOCONN, 0);
+
+    int len = SegmentsLength(segs, nsegs);
+    if (len <= 0)
+    {
+        LOGC(dlog.Error, log << "Invalid segments supplied to srt_recvmsgv.");
+        throw CUDTException(MJ_NOTSUP, MN_INVAL, 0);
+    }
+
+    if (!m_bMessageAPI)
+        throw CUDTException(MJ_NOTSUP, MN_INVALBUFFERAPI, 0);
+
+    return receiveMessage(segs, len, mctrl);
+}
+
+int CUDT::readMsg(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> r_mctrl, CRcvBorrowed** r_borrowed)
+{
+    int res;
+    if (!r_borrowed)
+    {
+        res = m_pRcvBuffer->readMsgV(segs, len, r_mctrl);
+    }
+    else
+    {
+        *r_borrowed = m_pRcvBuffer->borrowMsg(r_mctrl);
+        res = *r_borrowed ? (*r_borrowed)->m_iLength : 0;
+    }
+
+    // The source time goes out in the system time.
+    SRT_MSGCTRL& mctrl = *r_mctrl;
+    mctrl.srctime = CTimer::toRealTime(mctrl.srctime);
+    return res;
+}
+
 int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
+{
+    SRT_SEGMENT seg;
+    seg.data = data;
+    seg.len = len;
+    return receiveMessage(&seg, len, r_mctrl);
+}
+
+int CUDT::receiveMessage(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> r_mctrl, CRcvBorrowed** r_borrowed)
 {
     SRT_MSGCTRL& mctrl = *r_mctrl;
     // Recvmsg isn't restricted to the smoother type, it's the most
     // basic method of passing the data. You can retrieve data as
     // they come in, however you need to match the size of the buffer.
-    if (!m_Smoother->checkTransArgs(Smoother::STA_MESSAGE, Smoother::STAD_RECV, data, len, -1, false))
+    if (!m_Smoother->checkTransArgs(Smoother::STA_MESSAGE, Smoother::STAD_RECV, segs ? segs[0].data : NULL, len, -1, false))
         throw CUDTException(MJ_NOTSUP, MN_INVALMSGAPI, 0);
 
     CGuard recvguard(m_RecvLock);
 
+    if (r_borrowed && m_pRcvBuffer->getBorrowedUnits() >= m_iRcvBorrowMax)
+    {
+        HLOGC(dlog.Debug, log << CONID() << "recvmsg: " << m_pRcvBuffer->getBorrowedUnits()
+                << " units lent already, SRTO_RCVBORROWMAX reached");
+        throw CUDTException(MJ_SYSTEMRES, MN_MEMORY, 0);
+    }
+
     /* XXX DEBUG STUFF - enable when required
        char charbool[2] = {'0', '1'};
        char ptrn [] = "RECVMSG/BEGIN BROKEN 1 CONN 1 CLOSING 1 SYNCR 1 NMSG                                ";
@@ -5245,12 +5718,12 @@ int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
 
     if (m_bBroken || m_bClosing)
     {
-        int res = m_pRcvBuffer->readMsg(data, len);
+        int res = readMsg(segs, len, r_mctrl, r_borrowed);
         mctrl.srctime = 0;
 
         /* Kick TsbPd thread to schedule next wakeup (if running) */
         if (m_bTsbPd)
-            pthread_cond_signal(&m_RcvTsbPdCond);
+            kickTsbPd();
 
         if (!m_pRcvBuffer->isRcvDataReady())
         {
@@ -5271,14 +5744,14 @@ int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
     if (!m_bSynRecving)
     {
 
-        int res = m_pRcvBuffer->readMsg(data, len, r_mctrl);
+        int res = readMsg(segs, len, r_mctrl, r_borrowed);
         if (res == 0)
         {
             // read is not available any more
 
             // Kick TsbPd thread to schedule next wakeup (if running)
             if (m_bTsbPd)
-                pthread_cond_signal(&m_RcvTsbPdCond);
+                kickTsbPd();
 
             // Shut up EPoll if no more messages in non-blocking mode
             s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, false);
@@ -5290,7 +5763,7 @@ int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
             {
                 // Kick TsbPd thread to schedule next wakeup (if running)
                 if (m_bTsbPd)
-                    pthread_cond_signal(&m_RcvTsbPdCond);
+                    kickTsbPd();
 
                 // Shut up EPoll if no more messages in non-blocking mode
                 s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, false);
@@ -5316,7 +5789,7 @@ int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
             if (m_bTsbPd)
             {
                 HLOGP(tslog.Debug, "recvmsg: KICK tsbpd()");
-                pthread_cond_signal(&m_RcvTsbPdCond);
+                kickTsbPd();
             }
 
             do
@@ -5340,7 +5813,7 @@ int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
                 << " NMSG " << m_pRcvBuffer->getRcvMsgNum());
                 */
 
-        res = m_pRcvBuffer->readMsg(data, len, r_mctrl);
+        res = readMsg(segs, len, r_mctrl, r_borrowed);
 
         if (m_bBroken || m_bClosing)
         {
@@ -5365,7 +5838,7 @@ int CUDT::receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> r_mctrl)
         if (m_bTsbPd)
         {
             HLOGP(tslog.Debug, "recvmsg: KICK tsbpd() (buffer empty)");
-            pthread_cond_signal(&m_RcvTsbPdCond);
+            kickTsbPd();
         }
 
         // Shut up EPoll if no more messages in non-blocking mode
@@ -5476,6 +5949,7 @@ int64_t CUDT::sendfile(fstream& ifs, int64_t& offset, int64_t size, int block)
         if (m_pSndBuffer->getCurrBufSize() == 0)
             m_llSndDurationCounter = CTimer::getTime();
 
+        reserveSndBuffer(unitsize, m_iSndTimeOut);
         int64_t sentsize = m_pSndBuffer->addBufferFromFile(ifs, unitsize);
 
         if (sentsize > 0)
@@ -5485,7 +5959,7 @@ int64_t CUDT::sendfile(fstream& ifs, int64_t& offset, int64_t size, int block)
         }
 
         // insert this socket to snd list if it is not on the list yet
-        m_pSndQueue->m_pSndUList->update(this, CSndUList::DONT_RESCHEDULE);
+        m_pSndQueue->getSndUList(this)->update(this, CSndUList::DONT_RESCHEDULE);
     }
 
     if (sndBuffersLeft() <= 0)
@@ -5501,7 +5975,11 @@ int64_t CUDT::recvfile(fstream& ofs, int64_t& offset, int64_t size, int block)
 {
     if (!m_bConnected || !m_Smoother.ready())
         throw CUDTException(MJ_CONNECTION, MN_NOCONN, 0);
-    else if ((m_bBroken || m_bClosing) && !m_pRcvBuffer->isRcvDataReady())
+
+    // The receiver buffer is resized under this lock.
+    CGuard recvguard(m_RecvLock);
+
+    if ((m_bBroken || m_bClosing) && !m_pRcvBuffer->isRcvDataReady())
     {
         if (!m_bMessageAPI && m_bShutdown)
             return 0;
@@ -5520,8 +5998,6 @@ int64_t CUDT::recvfile(fstream& ofs, int64_t& offset, int64_t size, int block)
         throw CUDTException(MJ_NOTSUP, MN_INVALBUFFERAPI, 0);
     }
 
-    CGuard recvguard(m_RecvLock);
-
     // Well, actually as this works over a FILE (fstream), not just a stream,
     // the size can be measured anyway and predicted if setting the offset might
     // have a chance to work or not.
@@ -5579,10 +6055,10 @@ int64_t CUDT::recvfile(fstream& ofs, int64_t& offset, int64_t size, int block)
             throw CUDTException(MJ_FILESYSTEM, MN_WRITEFAIL);
         }
 
-        pthread_mutex_lock(&m_RecvDataLock);
+        // Wait with m_RecvLock released, so that the buffer can grow for
+        // the arriving packets; as in recv(), check the connection each 1 sec.
         while (stillConnected() && !m_pRcvBuffer->isRcvDataReady())
-            pthread_cond_wait(&m_RecvDataCond, &m_RecvDataLock);
-        pthread_mutex_unlock(&m_RecvDataLock);
+            CTimer::condTimedWaitUS(&m_RecvDataCond, &m_RecvLock, 1000000ULL);
 
         if (!m_bConnected)
             throw CUDTException(MJ_CONNECTION, MN_NOCONN, 0);
@@ -5763,6 +6239,7 @@ void CUDT::bstats(CBytePerfMon* perf, bool clear, bool instantaneous)
 #endif
    perf->pktSndDropTotal = m_iSndDropTotal;
    perf->pktRcvDropTotal = m_iRcvDropTotal + m_iRcvUndecryptTotal;
+   perf->pktRcvShedTotal = m_iRcvShedTotal;
    perf->byteSndDropTotal = m_ullSndBytesDropTotal + (m_iSndDropTotal * pktHdrSize);
    perf->byteRcvDropTotal = m_ullRcvBytesDropTotal + (m_iRcvDropTotal * pktHdrSize) + m_ullRcvBytesUndecryptTotal;
    perf->pktRcvUndecryptTotal = m_iRcvUndecryptTotal;
@@ -5785,6 +6262,10 @@ void CUDT::bstats(CBytePerfMon* perf, bool clear, bool instantaneous)
    perf->msSndTsbPdDelay = m_bPeerTsbPd ? m_iPeerTsbPdDelay_ms : 0;
    perf->msRcvTsbPdDelay = m_bTsbPd ? m_iTsbPdDelay_ms : 0;
    perf->byteMSS = m_iMSS;
+   perf->pktRcvBatchAvg = m_pRcvQueue ? m_pRcvQueue->getRcvBatchAvg() : 0;
+   perf->pktSndBatchAvg = m_pSndQueue ? m_pSndQueue->getSndBatchAvg() : 0;
+   perf->usSndWakeupErrAvg = m_pSndQueue ? m_pSndQueue->getWakeupErrAvg() : 0;
+   perf->usSndWakeupErrMax = m_pSndQueue ? m_pSndQueue->getWakeupErrMax() : 0;
 
    perf->mbpsMaxBW = m_llMaxBW > 0 ? Bps2Mbps(m_llMaxBW)
        : m_Smoother.ready() ? Bps2Mbps(m_Smoother->sndBandwidth())
@@ -5797,6 +6278,8 @@ void CUDT::bstats(CBytePerfMon* perf, bool clear, bool instantaneous)
 
    if (pthread_mutex_trylock(&m_ConnectionLock) == 0)
    {
+      perf->byteBufMem = (m_pSndBuffer ? m_pSndBuffer->getMemUsed() : 0) + (m_pRcvBuffer ? m_pRcvBuffer->getMemUsed() : 0);
+
       if (m_pSndBuffer)
       {
 #ifdef SRT_ENABLE_SNDBUFSZ_MAVG
@@ -5830,6 +6313,8 @@ void CUDT::bstats(CBytePerfMon* perf, bool clear, bool instantaneous)
       if (m_pRcvBuffer)
       {
          perf->byteAvailRcvBuf = m_pRcvBuffer->getAvailBufSize() * m_iMSS;
+         perf->pktRcvBufCapacity = m_pRcvBuffer->getCapacity();
+         perf->pktRcvBufHighWater = m_pRcvBuffer->getHighWater();
          //new>
 #ifdef SRT_ENABLE_RCVBUFSZ_MAVG
          if (instantaneous) //no need for historical API for Rcv side
@@ -5848,6 +6333,8 @@ void CUDT::bstats(CBytePerfMon* perf, bool clear, bool instantaneous)
       else
       {
          perf->byteAvailRcvBuf = 0;
+         perf->pktRcvBufCapacity = 0;
+         perf->pktRcvBufHighWater = 0;
          //new>
          perf->pktRcvBuf = 0;
          perf->byteRcvBuf = 0;
@@ -5861,6 +6348,9 @@ void CUDT::bstats(CBytePerfMon* perf, bool clear, bool instantaneous)
    {
       perf->byteAvailSndBuf = 0;
       perf->byteAvailRcvBuf = 0;
+      perf->pktRcvBufCapacity = 0;
+      perf->pktRcvBufHighWater = 0;
+      perf->byteBufMem = 0;
       //new>
       perf->pktSndBuf = 0;
       perf->byteSndBuf = 0;
@@ -6018,16 +6508,16 @@ void CUDT::updateCC(ETransmissionEvent evt, EventVariant arg)
 void CUDT::initSynch()
 {
       pthread_mutex_init(&m_SendBlockLock, NULL);
-      pthread_cond_init(&m_SendBlockCond, NULL);
+      CGuard::createCond(m_SendBlockCond);
       pthread_mutex_init(&m_RecvDataLock, NULL);
-      pthread_cond_init(&m_RecvDataCond, NULL);
+      CGuard::createCond(m_RecvDataCond);
       pthread_mutex_init(&m_SendLock, NULL);
       pthread_mutex_init(&m_RecvLock, NULL);
       pthread_mutex_init(&m_RcvLossLock, NULL);
       pthread_mutex_init(&m_AckLock, NULL);
       pthread_mutex_init(&m_ConnectionLock, NULL);
       memset(&m_RcvTsbPdThread, 0, sizeof m_RcvTsbPdThread);
-      pthread_cond_init(&m_RcvTsbPdCond, NULL);
+      CGuard::createCond(m_RcvTsbPdCond);
 }
 
 void CUDT::destroySynch()
@@ -6062,6 +6552,8 @@ void CUDT::releaseSynch()
     pthread_mutex_lock(&m_RecvLock);
     pthread_cond_signal(&m_RcvTsbPdCond);
     pthread_mutex_unlock(&m_RecvLock);
+    if (m_pTsbPdNode)
+        s_UDTUnited.m_TsbPdQueue.remove(m_pTsbPdNode);
     if (!pthread_equal(m_RcvTsbPdThread, pthread_t())) 
     {
         pthread_join(m_RcvTsbPdThread, NULL);
@@ -6192,7 +6684,7 @@ void CUDT::sendCtrl(UDTMessageType pkttype, void* lparam, void* rparam, int size
              /* Newly acknowledged data, signal TsbPD thread */
              pthread_mutex_lock(&m_RecvLock);
              if (m_bTsbPdAckWakeup)
-                pthread_cond_signal(&m_RcvTsbPdCond);
+                kickTsbPd();
              pthread_mutex_unlock(&m_RecvLock);
          }
          else
@@ -6282,11 +6774,14 @@ void CUDT::sendCtrl(UDTMessageType pkttype, void* lparam, void* rparam, int size
 
          ctrlpkt.m_iID = m_PeerID;
          ctrlpkt.m_iTimeStamp = int(CTimer::getTime() - m_StartTime);
-         nbsent = m_pSndQueue->sendto(m_pPeerAddr, ctrlpkt);
-         DebugAck("sendCtrl: " + CONID(), local_prevack, ack);
 
+         // Record the ACK before sending it; with the kernel receive
+         // timestamps the ACKACK may be stamped before sendto() returns.
          m_ACKWindow.store(m_iAckSeqNo, m_iRcvLastAck);
 
+         nbsent = m_pSndQueue->sendto(m_pPeerAddr, ctrlpkt);
+         DebugAck("sendCtrl: " + CONID(), local_prevack, ack);
+
          ++ m_iSentACK;
          ++ m_iSentACKTotal;
       }
@@ -6590,8 +7085,11 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
       // acknowledde any waiting epolls to write
       s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, true);
 
+      // give back the zero-copy messages that the ACK has retired
+      releaseRetired();
+
       // insert this socket to snd list if it is not on the list yet
-      m_pSndQueue->m_pSndUList->update(this, CSndUList::DONT_RESCHEDULE);
+      m_pSndQueue->getSndUList(this)->update(this, CSndUList::DONT_RESCHEDULE);
 
       size_t acksize = ctrlpkt.getLength(); // TEMPORARY VALUE FOR CHECKING
       bool wrongsize = 0 != (acksize % ACKD_FIELD_SIZE);
@@ -6679,7 +7177,7 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
       int rtt = -1;
 
       // update RTT
-      rtt = m_ACKWindow.acknowledge(ctrlpkt.getAckSeqNo(), ack);
+      rtt = m_ACKWindow.acknowledge(ctrlpkt.getAckSeqNo(), ack, ctrlpkt.getArrivalTime());
       if (rtt <= 0)
       {
           LOGC(mglog.Error, log << "IPE: ACK node overwritten when acknowledging " <<
@@ -6702,7 +7200,7 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
       // inaccurate. Additionally it won't lock if TSBPD mode is off, and
       // won't update anything. Note that if you set TSBPD mode and use
       // srt_recvfile (which doesn't make any sense), you'll have e deadlock.
-      m_pRcvBuffer->addRcvTsbPdDriftSample(ctrlpkt.getMsgTimeStamp(), m_RecvLock);
+      m_pRcvBuffer->addRcvTsbPdDriftSample(ctrlpkt.getMsgTimeStamp(), m_RecvLock, ctrlpkt.getArrivalTime());
 
       // update last ACK that has been received by the sender
       if (CSeqNo::seqcmp(ack, m_iRcvLastAckAck) > 0)
@@ -6793,7 +7291,7 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
       }
 
       // the lost packet (retransmission) should be sent out immediately
-      m_pSndQueue->m_pSndUList->update(this, CSndUList::DO_RESCHEDULE);
+      m_pSndQueue->getSndUList(this)->update(this, CSndUList::DO_RESCHEDULE);
 
       ++ m_iRecvNAK;
       ++ m_iRecvNAKTotal;
@@ -7332,7 +7830,7 @@ void CUDT::processClose()
     {
         HLOGP(mglog.Debug, "processClose: lock-and-signal TSBPD");
         CGuard rl(m_RecvLock);
-        pthread_cond_signal(&m_RcvTsbPdCond);
+        kickTsbPd();
     }
 
     // Signal the sender and recver if they are waiting for data.
@@ -7358,13 +7856,29 @@ int CUDT::processData(CUnit* unit)
    m_ullLastRspTime_tk = currtime_tk;
 
    /* We are receiver, start tsbpd thread if TsbPd is enabled */
-   if (m_bTsbPd && pthread_equal(m_RcvTsbPdThread, pthread_t()))
+   if (m_bTsbPd && m_bOPT_TsbPdShared)
+   {
+       if (!m_pTsbPdNode)
+       {
+           HLOGP(mglog.Debug, "Adding to the shared TSBPD queue");
+           CGuard recvguard(m_RecvLock);
+           m_pTsbPdNode = new CTsbPdNode;
+           m_pTsbPdNode->m_pUDT = this;
+           m_pTsbPdNode->m_ullPlayTime = 0;
+           m_pTsbPdNode->m_iHeapLoc = -1;
+           m_pTsbPdNode->m_iBusy = 0;
+           m_pTsbPdNode->m_bRemoved = false;
+           m_bTsbPdAckWakeup = true;
+           s_UDTUnited.m_TsbPdQueue.schedule(m_pTsbPdNode, 0);
+       }
+   }
+   else if (m_bTsbPd && pthread_equal(m_RcvTsbPdThread, pthread_t()))
    {
        HLOGP(mglog.Debug, "Spawning TSBPD thread");
        int st = 0;
        {
            ThreadName tn("SRT:TsbPd");
-           st = pthread_create(&m_RcvTsbPdThread, NULL, CUDT::tsbpd, this);
+           st = CThreadConfig::create(&m_RcvTsbPdThread, SRT_THREAD_TSBPD, CUDT::tsbpd, this);
        }
        if ( st != 0 )
            return -1;
@@ -7413,20 +7927,34 @@ int CUDT::processData(CUnit* unit)
    ++ m_iPktCount;
 
    int pktsz = packet.getLength();
-   // update time information
-   m_RcvTimeWindow.onPktArrival(pktsz);
+   // update time information (the kernel receive time, if known)
+   uint64_t arrtime = packet.getArrivalTime();
+   m_RcvTimeWindow.onPktArrival(pktsz, arrtime);
 
    // check if it is probing packet pair
    if ((packet.m_iSeqNo & PUMASK_SEQNO_PROBE) == 0)
-      m_RcvTimeWindow.probe1Arrival();
+      m_RcvTimeWindow.probe1Arrival(arrtime);
    else if ((packet.m_iSeqNo & PUMASK_SEQNO_PROBE) == 1)
-      m_RcvTimeWindow.probe2Arrival(pktsz);
+      m_RcvTimeWindow.probe2Arrival(pktsz, arrtime);
 
    m_ullTraceBytesRecv += pktsz;
    m_ullBytesRecvTotal += pktsz;
    ++ m_llTraceRecv;
    ++ m_llRecvTotal;
 
+   {
+      // The receiver buffer grows as the packets in flight need it. It's
+      // resized with the readers locked out, which can't be done under
+      // m_AckLock; the offset can only get smaller until then.
+      int32_t offset = CSeqNo::seqoff(m_iRcvLastSkipAck, packet.m_iSeqNo);
+      if (offset >= 0 && offset < m_pRcvBuffer->getAvailBufSize() && m_pRcvBuffer->needsGrowth(offset))
+      {
+         CGuard recvguard(m_RecvLock);
+         if (!m_pRcvBuffer->grow(offset))
+            LOGC(mglog.Error, log << CONID() << "processData: can't grow the receiver buffer from " << m_pRcvBuffer->getCapacity());
+      }
+   }
+
    {
       /*
       * Start of offset protected section
@@ -7492,6 +8020,32 @@ int CUDT::processData(CUnit* unit)
 
           }
 
+          // The buffer couldn't grow for it above: with no memory for
+          // the packet, it's dropped as if there was no room for it.
+          if (m_pRcvBuffer->needsGrowth(offset))
+          {
+              ++ m_iRcvDropTotal;
+              ++ m_iTraceRcvDrop;
+              m_ullRcvBytesDropTotal += pktsz;
+              m_ullTraceRcvBytesDrop += pktsz;
+              LOGC(mglog.Error, log << CONID() << "No memory to store incoming packet: offset="
+                      << offset << " capacity=" << m_pRcvBuffer->getCapacity()
+                      << " pkt.seq=" << packet.m_iSeqNo);
+              return -1;
+          }
+
+          // Near the memory limit, a receiver holding more than its share
+          // keeps only the packet that the reading waits for; the others
+          // are recovered as lost, or dropped in live mode.
+          bool awaited = offset == 0 && m_pRcvBuffer->getRcvDataSize() == 0;
+          if (!awaited && CMemBudget::shouldShed(m_pRcvBuffer->getMemUsed(), m_pRcvBuffer->getQueueFreeMem()))
+          {
+              ++ m_iRcvShedTotal;
+              HLOGC(mglog.Debug, log << CONID() << "processData: memory limit, shedding seq=" << packet.m_iSeqNo
+                      << " holding " << m_pRcvBuffer->getMemUsed() << " bytes");
+              return -1;
+          }
+
           if (m_pRcvBuffer->addData(unit, offset) < 0)
           {
               // addData returns -1 if at the m_iLastAckPos+offset position there already is a packet.
@@ -7615,7 +8169,7 @@ int CUDT::processData(CUnit* unit)
        if (m_bTsbPd)
        {
            pthread_mutex_lock(&m_RecvLock);
-           pthread_cond_signal(&m_RcvTsbPdCond);
+           kickTsbPd();
            pthread_mutex_unlock(&m_RecvLock);
        }
    }
@@ -7985,7 +8539,7 @@ int32_t CUDT::bake(const sockaddr* addr, int32_t current_cookie, int correction)
 //
 // XXX Make this function return EConnectStatus enum type (extend if needed),
 // and this will be directly passed to the caller.
-int CUDT::processConnectRequest(const sockaddr* addr, CPacket& packet)
+int CUDT::processConnectRequest(const sockaddr* addr, CPacket& packet, const CRcvQueue* rq)
 {
     // XXX ASSUMPTIONS:
     // [[using assert(packet.m_iID == 0)]]
@@ -8160,7 +8714,7 @@ int CUDT::processConnectRequest(const sockaddr* addr, CPacket& packet)
    }
    else
    {
-       int result = s_UDTUnited.newConnection(m_SocketID, addr, &hs, packet);
+       int result = s_UDTUnited.newConnection(m_SocketID, addr, &hs, packet, rq);
        // --->
        //        (global.) CUDTUnited::updateListenerMux
        //        (new Socket.) CUDT::acceptAndRespond
@@ -8228,6 +8782,62 @@ void CUDT::addLossRecord(std::vector<int32_t>& lr, int32_t lo, int32_t hi)
     }
 }
 
+uint64_t CUDT::getNextExpTime_tk()
+{
+    if (m_Smoother->RTO())
+        return m_ullLastRspTime_tk + m_Smoother->RTO() * m_ullCPUFrequency;
+
+    uint64_t exp_int_tk = (m_iEXPCount * (m_iRTT + 4 * m_iRTTVar) + COMM_SYN_INTERVAL_US) * m_ullCPUFrequency;
+    if (exp_int_tk < m_iEXPCount * m_ullMinExpInt_tk)
+        exp_int_tk = m_iEXPCount * m_ullMinExpInt_tk;
+    return m_ullLastRspTime_tk + exp_int_tk;
+}
+
+bool CUDT::isFastRexmitTimed()
+{
+    return m_Smoother->rexmitMethod() == Smoother::SRM_FASTREXMIT
+            // XXX Still, if neither FASTREXMIT nor LATEREXMIT part is executed, then
+            // there's no "blind rexmit" done at all. The only other rexmit method
+            // than LOSSREPORT-based is then NAKREPORT (the receiver sends LOSSREPORT
+            // again after it didn't get a "response" for the previous one). MIND that
+            // probably some method of "blind rexmit" MUST BE DONE, when TLPKTDROP is off.
+            &&  !m_bPeerNakReport
+            &&  m_pSndBuffer->getCurrBufSize() > 0;
+}
+
+// The earliest time when checkTimers() may have something to do, other than
+// what is triggered by incoming packets (these call it anyway). Sockets that
+// are about to be removed from the receiver queue are due immediately.
+uint64_t CUDT::getNextCheckTime_tk()
+{
+    uint64_t currtime_tk;
+    CTimer::rdtsc(currtime_tk);
+
+    if (!m_bConnected || m_bBroken || m_bClosing)
+        return currtime_tk;
+
+    // Nothing waits longer than a keepalive period.
+    uint64_t next_tk = m_ullLastSndTime_tk + COMM_KEEPALIVE_PERIOD_US * m_ullCPUFrequency;
+    next_tk = std::min(next_tk, currtime_tk + COMM_KEEPALIVE_PERIOD_US * m_ullCPUFrequency);
+
+    // ACK is repeated until the peer confirms it with ACKACK.
+    if (m_iRcvLastAckAck != CSeqNo::incseq(m_iRcvCurrSeqNo))
+        next_tk = std::min(next_tk, m_ullNextACKTime_tk);
+
+    if (m_bRcvNakReport && m_pRcvLossList->getLossLength() > 0)
+        next_tk = std::min(next_tk, m_ullNextNAKTime_tk);
+
+    next_tk = std::min(next_tk, getNextExpTime_tk());
+
+    if (isFastRexmitTimed())
+    {
+        uint64_t exp_int = (m_iReXmitCount * (m_iRTT + 4 * m_iRTTVar + 2 * COMM_SYN_INTERVAL_US) + COMM_SYN_INTERVAL_US) * m_ullCPUFrequency;
+        next_tk = std::min(next_tk, m_ullLastRspAckTime_tk + exp_int);
+    }
+
+    return next_tk;
+}
+
 void CUDT::checkTimers()
 {
     // update CC parameters
@@ -8263,6 +8873,12 @@ void CUDT::checkTimers()
 
         m_iPktCount = 0;
         m_iLightACKCount = 1;
+
+        if (m_pRcvBuffer->isShrinkDue(CTimer::getTime()))
+        {
+            CGuard recvguard(m_RecvLock);
+            m_pRcvBuffer->shrink();
+        }
     }
     // Or the transfer rate is so high that the number of packets
     // have reached the value of SelfClockInterval * LightACKCount before
@@ -8309,18 +8925,7 @@ void CUDT::checkTimers()
     // In UDT the m_bUserDefinedRTO and m_iRTO were in CCC class.
     // There's nothing in the original code that alters these values.
 
-    uint64_t next_exp_time_tk;
-    if (m_Smoother->RTO())
-    {
-        next_exp_time_tk = m_ullLastRspTime_tk + m_Smoother->RTO() * m_ullCPUFrequency;
-    }
-    else
-    {
-        uint64_t exp_int_tk = (m_iEXPCount * (m_iRTT + 4 * m_iRTTVar) + COMM_SYN_INTERVAL_US) * m_ullCPUFrequency;
-        if (exp_int_tk < m_iEXPCount * m_ullMinExpInt_tk)
-            exp_int_tk = m_iEXPCount * m_ullMinExpInt_tk;
-        next_exp_time_tk = m_ullLastRspTime_tk + exp_int_tk;
-    }
+    uint64_t next_exp_time_tk = getNextExpTime_tk();
 
     if (currtime_tk > next_exp_time_tk)
     {
@@ -8340,7 +8945,7 @@ void CUDT::checkTimers()
             m_iBrokenCounter = 30;
 
             // update snd U list to remove this socket
-            m_pSndQueue->m_pSndUList->update(this, CSndUList::DO_RESCHEDULE);
+            m_pSndQueue->getSndUList(this)->update(this, CSndUList::DO_RESCHEDULE);
 
             releaseSynch();
 
@@ -8394,7 +8999,7 @@ void CUDT::checkTimers()
                 updateCC(TEV_CHECKTIMER, TEV_CHT_REXMIT);
 
                 // immediately restart transmission
-                m_pSndQueue->m_pSndUList->update(this, CSndUList::DO_RESCHEDULE);
+                m_pSndQueue->getSndUList(this)->update(this, CSndUList::DO_RESCHEDULE);
             }
             else
             {
@@ -8422,14 +9027,7 @@ void CUDT::checkTimers()
     // sender: Insert some packets sent after last received acknowledgement into the sender loss list.
     //         This handles retransmission on timeout for lost NAK for peer sending only one NAK when loss detected.
     //         Not required if peer send Periodic NAK Reports.
-    if (m_Smoother->rexmitMethod() == Smoother::SRM_FASTREXMIT
-            // XXX Still, if neither FASTREXMIT nor LATEREXMIT part is executed, then
-            // there's no "blind rexmit" done at all. The only other rexmit method
-            // than LOSSREPORT-based is then NAKREPORT (the receiver sends LOSSREPORT
-            // again after it didn't get a "response" for the previous one). MIND that
-            // probably some method of "blind rexmit" MUST BE DONE, when TLPKTDROP is off.
-            &&  !m_bPeerNakReport
-            &&  m_pSndBuffer->getCurrBufSize() > 0)
+    if (isFastRexmitTimed())
     {
         uint64_t exp_int = (m_iReXmitCount * (m_iRTT + 4 * m_iRTTVar + 2 * COMM_SYN_INTERVAL_US) + COMM_SYN_INTERVAL_US) * m_ullCPUFrequency;
 
@@ -8461,7 +9059,7 @@ void CUDT::checkTimers()
             updateCC(TEV_CHECKTIMER, TEV_CHT_FASTREXMIT);
 
             // immediately restart transmission
-            m_pSndQueue->m_pSndUList->update(this, CSndUList::DO_RESCHEDULE);
+            m_pSndQueue->getSndUList(this)->update(this, CSndUList::DO_RESCHEDULE);
         }
     }
 
@@ -150,7 +150,8 @@ class CUDT
     friend class CSndQueue;
     friend class CRcvQueue;
     friend class CSndUList;
-    friend class CRcvUList;
+    friend class CTimerWheel;
+    friend class CTsbPdQueue;
 
 private: // constructor and desctructor
 
@@ -179,8 +180,12 @@ public: //API
     static int recv(SRTSOCKET u, char* buf, int len, int flags);
     static int sendmsg(SRTSOCKET u, const char* buf, int len, int ttl = -1, bool inorder = false, uint64_t srctime = 0LL);
     static int recvmsg(SRTSOCKET u, char* buf, int len, uint64_t& srctime);
-    static int sendmsg2(SRTSOCKET u, const char* buf, int len, ref_t<SRT_MSGCTRL> mctrl);
+    static int sendmsg2(SRTSOCKET u, const char* buf, int len, ref_t<SRT_MSGCTRL> mctrl, const CSndCompletion* done = NULL);
     static int recvmsg2(SRTSOCKET u, char* buf, int len, ref_t<SRT_MSGCTRL> mctrl);
+    static int sendmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> mctrl);
+    static int recvmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> mctrl);
+    static int borrowmsg(SRTSOCKET u, ref_t<SRT_BORROWED> msg);
+    static int releasemsg(SRTSOCKET u, ref_t<SRT_BORROWED> msg);
     static int64_t sendfile(SRTSOCKET u, std::fstream& ifs, int64_t& offset, int64_t size, int block = SRT_DEFAULT_SENDFILE_BLOCK);
     static int64_t recvfile(SRTSOCKET u, std::fstream& ofs, int64_t& offset, int64_t size, int block = SRT_DEFAULT_RECVFILE_BLOCK);
     static int select(int nfds, ud_set* readfds, ud_set* writefds, ud_set* exceptfds, const timeval* timeout);
@@ -356,6 +361,10 @@ private:
 
     void checkNeedDrop(ref_t<bool> bCongestion);
 
+    /// Pass the zero-copy messages retired from the sender buffer to the
+    /// sender worker, which gives the buffers back.
+    void releaseRetired();
+
     /// Connect to a UDT entity listening at address "peer", which has sent "hs" request.
     /// @param peer [in] The address of the listening UDT entity.
     /// @param hs [in/out] The handshake information sent by the peer side (in), negotiated value (out).
@@ -397,13 +406,64 @@ private:
     /// @param len [in] size of the buffer.
     /// @return Actual size of data received.
 
-    SRT_ATR_NODISCARD int sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> m);
+    /// @param done [in] if not NULL, the message isn't copied (see srt_sendmsg_zc())
+    /// and this gives the buffer back.
+
+    SRT_ATR_NODISCARD int sendmsg2(const char* data, int len, ref_t<SRT_MSGCTRL> m, const CSndCompletion* done = NULL);
+
+    /// Send a message given in pieces (see srt_sendmsgv()).
+    /// @param segs [in] the segments.
+    /// @param nsegs [in] number of segments.
+    /// @return Actual size of data sent.
+
+    SRT_ATR_NODISCARD int sendmsgv(const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> m);
+    SRT_ATR_NODISCARD int sendSegments(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> m, const CSndCompletion* done);
+
+    /// Take the memory for len bytes of the sender buffer from the block
+    /// pool shared by all sockets, waiting for it if the pool is limited
+    /// (see srt_setsndbufpool()).
+    /// @param len [in] size of the data to be added.
+    /// @param timeout_ms [in] how long to wait, -1 for no limit, 0 for not at all.
+    /// When not waiting, the socket isn't writable for epoll until the pool
+    /// releases some blocks (see sndPoolReleased()).
+
+    void reserveSndBuffer(int len, int timeout_ms);
+
+    /// Make the sockets that found the block pool exhausted writable
+    /// again, when the pool releases blocks.
+
+    static void sndPoolReleased(const std::vector<int32_t>& ids);
 
     SRT_ATR_NODISCARD int recvmsg(char* data, int len, uint64_t& srctime);
 
     SRT_ATR_NODISCARD int recvmsg2(char* data, int len, ref_t<SRT_MSGCTRL> m);
 
+    /// Receive a message into a buffer given in pieces (see srt_recvmsgv()).
+    /// @param segs [in] the segments, filled in turn.
+    /// @param nsegs [in] number of segments.
+    /// @return Actual size of data received.
+
+    SRT_ATR_NODISCARD int recvmsgv(const SRT_SEGMENT* segs, int nsegs, ref_t<SRT_MSGCTRL> m);
+
+    /// Lend the next message to the application (see srt_recvmsg_borrow()).
+    /// @param msg [out] the message.
+    /// @return Size of the message.
+
+    SRT_ATR_NODISCARD int borrowmsg(ref_t<SRT_BORROWED> msg);
+
+    /// Give back a message lent by borrowmsg().
+    /// @param msg [in,out] the message; cleared on return.
+
+    void releasemsg(ref_t<SRT_BORROWED> msg);
+
     SRT_ATR_NODISCARD int receiveMessage(char* data, int len, ref_t<SRT_MSGCTRL> m);
+
+    /// @param segs [in] where to put the message, len bytes together.
+    /// @param borrowed [out] if not NULL, the message is lent instead of
+    /// copied into segs (see CRcvBuffer::borrowMsg()).
+
+    SRT_ATR_NODISCARD int receiveMessage(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> m, CRcvBorrowed** borrowed = NULL);
+    int readMsg(const SRT_SEGMENT* segs, int len, ref_t<SRT_MSGCTRL> m, CRcvBorrowed** borrowed);
     SRT_ATR_NODISCARD int receiveBuffer(char* data, int len);
 
     /// Request UDT to send out a file described as "fd", starting from "offset", with size of "size".
@@ -499,6 +559,8 @@ private:
 
     // TSBPD thread main function.
     static void* tsbpd(void* param);
+    uint64_t tsbpdCheck();
+    void kickTsbPd();
 
     static CUDTUnited s_UDTUnited;               // UDT global management base
 
@@ -524,6 +586,18 @@ private: // Identification
     linger m_Linger;                             // Linger information on close
     int m_iUDPSndBufSize;                        // UDP sending buffer size
     int m_iUDPRcvBufSize;                        // UDP receiving buffer size
+    int m_iUDPRcvBatch;                          // Max number of UDP datagrams read in one system call
+    int m_iUDPSndBatch;                          // Max number of UDP datagrams sent in one system call
+    int m_iUDPSndWorkers;                        // Number of sender threads of the multiplexer
+    int m_iUDPSndSpin;                           // Time before a packet is due from which the sender spins, in microseconds
+    bool m_bUDPRcvHugePages;                     // Keep the receiver units of the multiplexer in huge pages
+    int m_iRcvBorrowMax;                         // Max number of units lent to the application by srt_recvmsg_borrow
+    bool m_bUDPGSO;                              // Use UDP GSO for batched sending
+    bool m_bUDPGRO;                              // Use UDP GRO for batched reading
+    bool m_bUDPIoUring;                          // Use io_uring for the UDP transfer
+    int m_iUDPShards;                            // Number of SO_REUSEPORT multiplexers of a listener
+    bool m_bUDPRcvTimestamp;                     // Use kernel receive timestamps for the arrival time
+    std::string m_sUDPImpair;                    // Impairment of the incoming packets, for testing
     int m_iIPversion;                            // IP version
     bool m_bRendezvous;                          // Rendezvous connection mode
 #ifdef SRT_ENABLE_CONNTIMEO
@@ -555,6 +629,7 @@ private: // Identification
 
     bool m_bMessageAPI;
     bool m_bOPT_TsbPd;               // Whether AGENT will do TSBPD Rx (whether peer does, is not agent's problem)
+    bool m_bOPT_TsbPdShared;         // Whether the TSBPD Rx is done by the shared workers instead of a thread of its own
     int m_iOPT_TsbPdDelay;           // Agent's Rx latency
     int m_iOPT_PeerTsbPdDelay;       // Peer's Rx latency for the traffic made by Agent's Tx.
     bool m_bOPT_TLPktDrop;            // Whether Agent WILL DO TLPKTDROP on Rx.
@@ -695,7 +770,7 @@ private: // Generation and processing of packets
     int packData(CPacket& packet, uint64_t& ts);
     int processData(CUnit* unit);
     void processClose();
-    int processConnectRequest(const sockaddr* addr, CPacket& packet);
+    int processConnectRequest(const sockaddr* addr, CPacket& packet, const CRcvQueue* rq);
     static void addLossRecord(std::vector<int32_t>& lossrecord, int32_t lo, int32_t hi);
     int32_t bake(const sockaddr* addr, int32_t previous_cookie = 0, int correction = 0);
 
@@ -712,6 +787,7 @@ private: // Trace
     int m_iRecvNAKTotal;                         // total number of received NAK packets
     int m_iSndDropTotal;
     int m_iRcvDropTotal;
+    int m_iRcvShedTotal;                         // packets dropped on arrival because of srt_setmemlimit()
     uint64_t m_ullBytesSentTotal;                // total number of bytes sent,  including retransmissions
     uint64_t m_ullBytesRecvTotal;                // total number of received bytes
     uint64_t m_ullRcvBytesLossTotal;             // total number of loss bytes (estimate)
@@ -777,6 +853,9 @@ private: // Timers
     uint64_t m_ullTargetTime_tk;			// scheduled time of next packet sending
 
     void checkTimers();
+    uint64_t getNextCheckTime_tk();
+    uint64_t getNextExpTime_tk();
+    bool isFastRexmitTimed();
 
 public: // For the use of CCryptoControl
     // HaiCrypt configuration
@@ -790,7 +869,8 @@ private: // for UDP multiplexer
     sockaddr* m_pPeerAddr;			// peer address
     uint32_t m_piSelfIP[4];			// local UDP IP address
     CSNode* m_pSNode;				// node information for UDT list used in snd queue
-    CRNode* m_pRNode;                            // node information for UDT list used in rcv queue
+    CRNode* m_pRNode;                            // node information for the timer wheel used in rcv queue
+    CTsbPdNode* m_pTsbPdNode;                    // node information for the shared TSBPD queue, if used
 
 public: // For smoother
     const CSndQueue* sndQueue() { return m_pSndQueue; }
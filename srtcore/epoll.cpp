@@ -594,3 +594,20 @@ int CEPoll::update_events(const SRTSOCKET& uid, std::set<int>& eids, int events,
 
    return 0;
 }
+
+int CEPoll::update_events(const SRTSOCKET& uid, int events, bool enable)
+{
+   CGuard pg(m_EPollLock);
+
+   for (map<int, CEPollDesc>::iterator p = m_mPolls.begin(); p != m_mPolls.end(); ++ p)
+   {
+      if ((events & UDT_EPOLL_IN) != 0)
+         update_epoll_sets(uid, p->second.m_sUDTSocksIn, p->second.m_sUDTReads, enable);
+      if ((events & UDT_EPOLL_OUT) != 0)
+         update_epoll_sets(uid, p->second.m_sUDTSocksOut, p->second.m_sUDTWrites, enable);
+      if ((events & UDT_EPOLL_ERR) != 0)
+         update_epoll_sets(uid, p->second.m_sUDTSocksEx, p->second.m_sUDTExcepts, enable);
+   }
+
+   return 0;
+}
@@ -163,6 +163,15 @@ public: // for CUDT to acknowledge IO status
 
    int update_events(const SRTSOCKET& uid, std::set<int>& eids, int events, bool enable);
 
+      /// Update events available for a UDT socket in all EPolls watching
+      /// it, for when the socket's own set of EPoll IDs isn't at hand.
+      /// @param [in] uid UDT socket ID.
+      /// @param [in] events Combination of events to update
+      /// @param [in] enable true -> enable, otherwise disable
+      /// @return 0 if success, otherwise an error number
+
+   int update_events(const SRTSOCKET& uid, int events, bool enable);
+
 private:
    int m_iIDSeed;                            // seed to generate a new ID
    pthread_mutex_t m_SeedLock;
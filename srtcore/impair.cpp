@@ -0,0 +1,216 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include "impair.h"
+#include "logging.h"
+
+using namespace std;
+
+extern logging::Logger mglog;
+
+CImpairment::Config::Config():
+seed(1),
+loss(0),
+burst_enter(0),
+burst_exit(100),
+delay_ms(0),
+jitter_ms(0),
+reorder(0),
+dup(0),
+rate_kbps(0),
+queue_ms(1000)
+{
+}
+
+bool CImpairment::parse(const string& spec, ref_t<Config> r_cfg)
+{
+   Config& cfg = *r_cfg;
+   cfg = Config();
+
+   size_t pos = 0;
+   while (pos < spec.size())
+   {
+      size_t end = spec.find(',', pos);
+      if (end == string::npos)
+         end = spec.size();
+
+      string item = spec.substr(pos, end - pos);
+      pos = end + 1;
+
+      size_t eq = item.find('=');
+      if (eq == string::npos)
+         return false;
+
+      string key = item.substr(0, eq);
+      string val = item.substr(eq + 1);
+      char* stop;
+      double v = strtod(val.c_str(), &stop);
+      if (val.empty() || *stop != '\0' || v < 0)
+         return false;
+
+      if (key == "seed")
+         cfg.seed = uint64_t(v);
+      else if (key == "loss")
+         cfg.loss = v;
+      else if (key == "burst_enter")
+         cfg.burst_enter = v;
+      else if (key == "burst_exit")
+         cfg.burst_exit = v;
+      else if (key == "delay")
+         cfg.delay_ms = int(v);
+      else if (key == "jitter")
+         cfg.jitter_ms = int(v);
+      else if (key == "reorder")
+         cfg.reorder = v;
+      else if (key == "dup")
+         cfg.dup = v;
+      else if (key == "rate")
+         cfg.rate_kbps = int(v);
+      else if (key == "queue")
+         cfg.queue_ms = int(v);
+      else
+         return false;
+   }
+
+   return cfg.loss <= 100 && cfg.burst_enter <= 100 && cfg.burst_exit <= 100
+      && cfg.reorder <= 100 && cfg.dup <= 100;
+}
+
+CImpairment::CImpairment(const Config& cfg):
+m_Config(cfg),
+m_ullRandom(cfg.seed),
+m_bBurst(false),
+m_ullLinkFree(0),
+m_ullOrder(0),
+m_Held(),
+m_vFree()
+{
+}
+
+CImpairment::~CImpairment()
+{
+   while (!m_Held.empty())
+   {
+      delete m_Held.top();
+      m_Held.pop();
+   }
+   for (size_t i = 0; i < m_vFree.size(); ++ i)
+      delete m_vFree[i];
+}
+
+// splitmix64: small, fast and the same everywhere.
+double CImpairment::random()
+{
+   uint64_t z = (m_ullRandom += 0x9E3779B97F4A7C15ULL);
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   z ^= z >> 31;
+   return double(z >> 11) / double(1ULL << 53);
+}
+
+void CImpairment::submit(const sockaddr_any& addr, const CPacket& packet, uint64_t now)
+{
+   // Gilbert-Elliott: everything is lost inside a burst.
+   if (m_bBurst ? chance(m_Config.burst_exit) : chance(m_Config.burst_enter))
+      m_bBurst = !m_bBurst;
+
+   if (m_bBurst || chance(m_Config.loss))
+   {
+      HLOGC(mglog.Debug, log << "IMPAIR: dropping %" << packet.m_iID << " seq=" << packet.m_iSeqNo
+            << (m_bBurst ? " (burst)" : ""));
+      return;
+   }
+
+   // The emulated link sends one packet at a time at the given rate,
+   // and drops those that would have to wait too long for it.
+   uint64_t sent = now;
+   if (m_Config.rate_kbps > 0)
+   {
+      uint64_t bits = (CPacket::UDP_HDR_SIZE + CPacket::HDR_SIZE + packet.getLength()) * 8;
+      uint64_t start = max(now, m_ullLinkFree);
+      if (start - now > uint64_t(m_Config.queue_ms) * 1000)
+      {
+         HLOGC(mglog.Debug, log << "IMPAIR: queue full, dropping %" << packet.m_iID << " seq=" << packet.m_iSeqNo);
+         return;
+      }
+      sent = start + bits * 1000 / m_Config.rate_kbps;
+      m_ullLinkFree = sent;
+   }
+
+   int copies = chance(m_Config.dup) ? 2 : 1;
+   for (int i = 0; i < copies; ++ i)
+   {
+      uint64_t due = sent;
+      if (!chance(m_Config.reorder))
+      {
+         due += uint64_t(m_Config.delay_ms) * 1000;
+         if (m_Config.jitter_ms > 0)
+            due += uint64_t(random() * m_Config.jitter_ms * 1000);
+      }
+      hold(addr, packet, due);
+   }
+}
+
+void CImpairment::hold(const sockaddr_any& addr, const CPacket& packet, uint64_t due)
+{
+   CEntry* e;
+   if (m_vFree.empty())
+   {
+      e = new CEntry;
+   }
+   else
+   {
+      e = m_vFree.back();
+      m_vFree.pop_back();
+   }
+
+   e->m_ullDue = due;
+   e->m_ullOrder = ++ m_ullOrder;
+   e->m_Addr = addr;
+   e->m_Data.resize(CPacket::HDR_SIZE + packet.getLength());
+   memcpy(&e->m_Data[0], const_cast<CPacket&>(packet).getHeader(), CPacket::HDR_SIZE);
+   memcpy(&e->m_Data[0] + CPacket::HDR_SIZE, packet.m_pcData, packet.getLength());
+   m_Held.push(e);
+}
+
+bool CImpairment::take(uint64_t now, sockaddr_any* addr, CPacket& packet)
+{
+   if (m_Held.empty() || m_Held.top()->m_ullDue > now)
+      return false;
+
+   CEntry* e = m_Held.top();
+   m_Held.pop();
+   m_vFree.push_back(e);
+
+   size_t len = e->m_Data.size() - CPacket::HDR_SIZE;
+   if (len > packet.getLength())
+   {
+      // Can't happen as long as all units have the same size.
+      packet.setLength(-1);
+      return true;
+   }
+
+   *addr = e->m_Addr;
+   memcpy(packet.getHeader(), &e->m_Data[0], CPacket::HDR_SIZE);
+   memcpy(packet.m_pcData, &e->m_Data[0] + CPacket::HDR_SIZE, len);
+   packet.setLength(len);
+   // The arrival is now, not when the socket got it.
+   packet.setArrivalTime(0);
+   return true;
+}
+
+uint64_t CImpairment::nextDue() const
+{
+   return m_Held.empty() ? 0 : m_Held.top()->m_ullDue;
+}
@@ -0,0 +1,118 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef INC__IMPAIR_H
+#define INC__IMPAIR_H
+
+// Network impairment model applied by CChannel to the incoming packets
+// (SRTO_UDP_IMPAIR), for reproducible tests without tc/netem. Every packet
+// read from the socket is passed through the model, which may drop it,
+// duplicate it or hold it for a while; the receiver then gets the packets
+// that are due. All random decisions come from one seeded generator, so
+// the same sequence of packets gets the same treatment every time.
+//
+// The model is driven exclusively by the receiver worker thread.
+
+#include <string>
+#include <vector>
+#include <queue>
+#include "packet.h"
+#include "netinet_any.h"
+
+class CImpairment
+{
+public:
+
+   struct Config
+   {
+      uint64_t seed;            // seed of the random generator
+      double loss;              // random loss, percent
+      double burst_enter;       // chance to start a loss burst per packet, percent
+      double burst_exit;        // chance to end a loss burst per packet, percent
+      int delay_ms;             // fixed delay
+      int jitter_ms;            // random extra delay, 0 to jitter_ms
+      double reorder;           // packets that skip the delay, percent
+      double dup;               // packets delivered twice, percent
+      int rate_kbps;            // bandwidth limit in kbit/s, 0 = none
+      int queue_ms;             // max queueing delay at the bandwidth limit, then tail drop
+
+      Config();
+   };
+
+      /// Parse the impairment specification.
+      /// @param [in] spec comma separated key=value pairs: seed, loss, burst_enter,
+      /// burst_exit, delay, jitter, reorder, dup, rate, queue. Empty means no impairment.
+      /// @param [out] r_cfg the configuration.
+      /// @return false if the specification is invalid.
+
+   static bool parse(const std::string& spec, ref_t<Config> r_cfg);
+
+   CImpairment(const Config& cfg);
+   ~CImpairment();
+
+      /// Pass a received packet through the model. The packet is copied,
+      /// if it's going to be delivered.
+      /// @param [in] addr source address.
+      /// @param [in] packet the packet, in host order.
+      /// @param [in] now current time.
+
+   void submit(const sockaddr_any& addr, const CPacket& packet, uint64_t now);
+
+      /// Take the next packet that is due.
+      /// @param [in] now current time.
+      /// @param [out] addr source address.
+      /// @param [in,out] packet the packet to fill; its length is the space available.
+      /// @return false if no packet is due.
+
+   bool take(uint64_t now, sockaddr_any* addr, CPacket& packet);
+
+      /// Check when the next packet is due.
+      /// @return the time, or 0 if no packet is held.
+
+   uint64_t nextDue() const;
+
+private:
+   struct CEntry
+   {
+      uint64_t m_ullDue;
+      uint64_t m_ullOrder;        // keeps packets due at the same time in order
+      sockaddr_any m_Addr;
+      std::vector<char> m_Data;   // header and payload
+   };
+
+   struct CLater
+   {
+      bool operator()(const CEntry* a, const CEntry* b) const
+      {
+         if (a->m_ullDue != b->m_ullDue)
+            return a->m_ullDue > b->m_ullDue;
+         return a->m_ullOrder > b->m_ullOrder;
+      }
+   };
+
+   double random();
+   bool chance(double percent) { return percent > 0 && random() * 100 < percent; }
+   void hold(const sockaddr_any& addr, const CPacket& packet, uint64_t due);
+
+private:
+   Config m_Config;
+   uint64_t m_ullRandom;          // generator state
+   bool m_bBurst;                 // inside a loss burst
+   uint64_t m_ullLinkFree;        // when the emulated link finishes sending the last packet
+   uint64_t m_ullOrder;
+   std::priority_queue<CEntry*, std::vector<CEntry*>, CLater> m_Held;
+   std::vector<CEntry*> m_vFree;  // entries to reuse
+
+private:
+   CImpairment(const CImpairment&);
+   CImpairment& operator=(const CImpairment&);
+};
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "inproc.h"
+
+#ifndef WIN32
+
+#include <sched.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "channel.h"
+
+#define INPROC_LOAD(p, order) __atomic_load_n((p), __ATOMIC_##order)
+#define INPROC_STORE(p, v, order) __atomic_store_n((p), (v), __ATOMIC_##order)
+
+// SRT_INPROC_ADDR, 0.0.0.1: no real socket can use it.
+static const uint32_t INPROC_IPV4 = 0x00000001;
+
+// First port given to the rings bound to port 0.
+static const int INPROC_EPHEMERAL_PORT = 49152;
+
+namespace
+{
+
+// The binding of a port number. These are never deleted, so that
+// a sender can look one up without taking a lock. The ring bound
+// to it can be replaced only after all senders have left it.
+struct CInprocPort
+{
+   CInprocRing* m_pRing;
+   int m_iUsers;                // senders currently delivering to m_pRing
+};
+
+CInprocPort* s_apPorts[65536];
+pthread_mutex_t s_PortLock = PTHREAD_MUTEX_INITIALIZER;
+int s_iNextEphemeral = INPROC_EPHEMERAL_PORT;
+
+}
+
+bool CInprocRing::isInprocAddr(const sockaddr* addr)
+{
+   return addr && addr->sa_family == AF_INET
+      && ((const sockaddr_in*)addr)->sin_addr.s_addr == htonl(INPROC_IPV4);
+}
+
+CInprocRing* CInprocRing::bind(int port, int cells, const CChannel* owner)
+{
+   if (port < 0 || port > 65535)
+      return NULL;
+
+   CGuard cg(s_PortLock);
+
+   if (port == 0)
+   {
+      // Take the next free one, round robin, as the system does with UDP.
+      int range = 65536 - INPROC_EPHEMERAL_PORT;
+      for (int i = 0; i < range && port == 0; ++ i)
+      {
+         int p = s_iNextEphemeral;
+         s_iNextEphemeral = (p == 65535) ? INPROC_EPHEMERAL_PORT : p + 1;
+         if (!s_apPorts[p] || !s_apPorts[p]->m_pRing)
+            port = p;
+      }
+
+      if (port == 0)
+         return NULL;
+   }
+   else if (s_apPorts[port] && s_apPorts[port]->m_pRing)
+   {
+      return NULL;
+   }
+
+   if (!s_apPorts[port])
+   {
+      CInprocPort* p = new CInprocPort;
+      p->m_pRing = NULL;
+      p->m_iUsers = 0;
+      INPROC_STORE(&s_apPorts[port], p, RELEASE);
+   }
+
+   CInprocRing* ring = new CInprocRing(port, cells, owner);
+   INPROC_STORE(&s_apPorts[port]->m_pRing, ring, SEQ_CST);
+   return ring;
+}
+
+bool CInprocRing::send(int dstport, int srcport, const iovec* iov, int iovcnt)
+{
+   if (dstport <= 0 || dstport > 65535)
+      return false;
+
+   CInprocPort* p = INPROC_LOAD(&s_apPorts[dstport], ACQUIRE);
+   if (!p)
+      return false;
+
+   // Announce the use before looking at the ring, so that unbind() either
+   // sees this sender and waits for it, or this sender sees no ring.
+   __atomic_add_fetch(&p->m_iUsers, 1, __ATOMIC_SEQ_CST);
+   CInprocRing* ring = INPROC_LOAD(&p->m_pRing, SEQ_CST);
+   bool delivered = ring && ring->push(srcport, iov, iovcnt);
+   __atomic_sub_fetch(&p->m_iUsers, 1, __ATOMIC_RELEASE);
+
+   return delivered;
+}
+
+CInprocRing::CInprocRing(int port, int cells, const CChannel* owner):
+m_iPort(port),
+m_pOwner(owner),
+m_pCells(NULL),
+m_zMask(0),
+m_zTail(0),
+m_zHead(0),
+m_iWaiting(0)
+{
+   size_t n = 1;
+   while (n * 2 <= size_t(cells))
+      n *= 2;
+
+   m_pCells = new CCell[n];
+   m_zMask = n - 1;
+   for (size_t i = 0; i < n; ++ i)
+      m_pCells[i].m_zSeq = i;
+}
+
+CInprocRing::~CInprocRing()
+{
+   unbind();
+   delete [] m_pCells;
+}
+
+void CInprocRing::unbind()
+{
+   CGuard cg(s_PortLock);
+
+   CInprocPort* p = s_apPorts[m_iPort];
+   if (!p || p->m_pRing != this)
+      return;
+
+   INPROC_STORE(&p->m_pRing, (CInprocRing*)NULL, SEQ_CST);
+   while (INPROC_LOAD(&p->m_iUsers, SEQ_CST) > 0)
+      sched_yield();
+}
+
+bool CInprocRing::push(int srcport, const iovec* iov, int iovcnt)
+{
+   size_t len = 0;
+   for (int i = 0; i < iovcnt; ++ i)
+      len += iov[i].iov_len;
+   if (len > MAX_DATAGRAM)
+      return false;
+
+   // Claim a cell: it's free when its sequence equals the position.
+   size_t pos = INPROC_LOAD(&m_zTail, RELAXED);
+   CCell* cell;
+   for (;;)
+   {
+      cell = &m_pCells[pos & m_zMask];
+      size_t seq = INPROC_LOAD(&cell->m_zSeq, ACQUIRE);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0)
+      {
+         if (__atomic_compare_exchange_n(&m_zTail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+      }
+      else if (diff < 0)
+      {
+         return false; // full
+      }
+      else
+      {
+         pos = INPROC_LOAD(&m_zTail, RELAXED);
+      }
+   }
+
+   char* dst = cell->m_acData;
+   for (int i = 0; i < iovcnt; ++ i)
+   {
+      memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+      dst += iov[i].iov_len;
+   }
+   cell->m_iSrcPort = srcport;
+   cell->m_iLength = int(len);
+
+   // Ordered with the check of m_iWaiting, see prepareWait().
+   INPROC_STORE(&cell->m_zSeq, pos + 1, SEQ_CST);
+
+   // Wake up the reader if it's waiting, once.
+   if (INPROC_LOAD(&m_iWaiting, SEQ_CST) && __atomic_exchange_n(&m_iWaiting, 0, __ATOMIC_SEQ_CST))
+      m_pOwner->interrupt();
+
+   return true;
+}
+
+int CInprocRing::recv(ref_t<int> r_srcport, const iovec* iov, int iovcnt, ref_t<int> r_flags)
+{
+   CCell* cell = &m_pCells[m_zHead & m_zMask];
+   if (INPROC_LOAD(&cell->m_zSeq, ACQUIRE) != m_zHead + 1)
+      return -1;
+
+   int len = cell->m_iLength;
+   const char* src = cell->m_acData;
+   int left = len;
+   for (int i = 0; i < iovcnt && left > 0; ++ i)
+   {
+      size_t n = std::min(size_t(left), iov[i].iov_len);
+      memcpy(iov[i].iov_base, src, n);
+      src += n;
+      left -= int(n);
+   }
+
+   *r_srcport = cell->m_iSrcPort;
+   *r_flags = left > 0 ? MSG_TRUNC : 0;
+
+   // Give the cell back to the producers, for the next round.
+   INPROC_STORE(&cell->m_zSeq, m_zHead + m_zMask + 1, RELEASE);
+   ++ m_zHead;
+
+   return len - left;
+}
+
+bool CInprocRing::prepareWait()
+{
+   INPROC_STORE(&m_iWaiting, 1, SEQ_CST);
+
+   // A datagram pushed before the flag was seen wouldn't wake us up.
+   CCell* cell = &m_pCells[m_zHead & m_zMask];
+   if (INPROC_LOAD(&cell->m_zSeq, SEQ_CST) == m_zHead + 1)
+   {
+      INPROC_STORE(&m_iWaiting, 0, RELAXED);
+      return false;
+   }
+   return true;
+}
+
+void CInprocRing::endWait()
+{
+   INPROC_STORE(&m_iWaiting, 0, RELAXED);
+}
+
+#else // WIN32
+
+bool CInprocRing::isInprocAddr(const sockaddr*) { return false; }
+CInprocRing* CInprocRing::bind(int, int, const CChannel*) { return NULL; }
+bool CInprocRing::send(int, int, const iovec*, int) { return false; }
+CInprocRing::~CInprocRing() {}
+void CInprocRing::unbind() {}
+int CInprocRing::recv(ref_t<int>, const iovec*, int, ref_t<int>) { return -1; }
+bool CInprocRing::prepareWait() { return false; }
+void CInprocRing::endWait() {}
+
+#endif
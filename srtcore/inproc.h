@@ -0,0 +1,115 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef INC__INPROC_H
+#define INC__INPROC_H
+
+// In-process ports, used by CChannel instead of a UDP socket when bound
+// to SRT_INPROC_ADDR. A datagram sent to SRT_INPROC_ADDR:port is copied
+// straight into the ring of the port bound there, from which its receiver
+// worker reads. Any number of threads may send to a ring at the same time,
+// while only one reads from it; neither of them takes a lock. Not available
+// on Windows; bind() always fails there.
+
+#include <cstddef>
+#include "packet.h"
+#include "utilities.h"
+
+class CChannel;
+
+class CInprocRing
+{
+public:
+
+      /// Max size of a datagram (SRT header and payload), as an Ethernet
+      /// MTU allows for UDP. Longer datagrams are dropped.
+
+   static const size_t MAX_DATAGRAM = CPacket::ETH_MAX_MTU_SIZE - CPacket::UDP_HDR_SIZE;
+
+      /// Check if the address is the in-process one (SRT_INPROC_ADDR).
+      /// @param [in] addr the address, possibly NULL.
+      /// @return true if a channel bound to it should use the in-process ports.
+
+   static bool isInprocAddr(const sockaddr* addr);
+
+      /// Create a ring and bind it to a port.
+      /// @param [in] port port number, 0 = any free one.
+      /// @param [in] cells number of datagrams the ring can hold (rounded to a power of 2).
+      /// @param [in] owner the channel whose waitRead() is interrupted by incoming datagrams.
+      /// @return the ring, or NULL if the port is in use.
+
+   static CInprocRing* bind(int port, int cells, const CChannel* owner);
+
+      /// Send a datagram to a port. As with UDP, it's lost if there's no
+      /// ring bound to the port or the ring is full.
+      /// @param [in] dstport destination port.
+      /// @param [in] srcport source port.
+      /// @param [in] iov @a iovcnt buffers that make up the datagram.
+      /// @return true if the datagram has been delivered to the ring.
+
+   static bool send(int dstport, int srcport, const iovec* iov, int iovcnt);
+
+   ~CInprocRing();
+
+      /// Unbind the ring from its port, after which nothing is delivered
+      /// into it. The ring stays readable until deleted.
+
+   void unbind();
+
+   int port() const { return m_iPort; }
+
+      /// Take the oldest datagram from the ring. Only one thread may do it.
+      /// @param [out] r_srcport the source port.
+      /// @param [in] iov @a iovcnt buffers to read into.
+      /// @param [out] r_flags MSG_TRUNC if the datagram didn't fit, 0 otherwise.
+      /// @return size of the datagram, -1 if the ring is empty.
+
+   int recv(ref_t<int> r_srcport, const iovec* iov, int iovcnt, ref_t<int> r_flags);
+
+      /// Announce that the reader is about to wait, so that the next datagram
+      /// interrupts the owner channel.
+      /// @return false if there are datagrams already, so don't wait.
+
+   bool prepareWait();
+
+      /// Announce that the reader has stopped waiting.
+
+   void endWait();
+
+private:
+   CInprocRing(int port, int cells, const CChannel* owner);
+   bool push(int srcport, const iovec* iov, int iovcnt);
+
+   struct CCell
+   {
+      size_t m_zSeq;            // position in the ring, at which the cell is ready for a producer (== pos) or the consumer (== pos + 1)
+      int m_iSrcPort;
+      int m_iLength;
+      char m_acData[MAX_DATAGRAM];
+   };
+
+private:
+   int m_iPort;
+   const CChannel* m_pOwner;
+   CCell* m_pCells;
+   size_t m_zMask;              // number of cells - 1
+
+   char m_acPad0[64];
+   size_t m_zTail;              // next position to produce, shared by the senders
+   char m_acPad1[64];
+   size_t m_zHead;              // next position to consume, used by the reader only
+   int m_iWaiting;              // the reader is (about to be) waiting in CChannel::waitRead()
+
+private:
+   CInprocRing(const CInprocRing&);
+   CInprocRing& operator=(const CInprocRing&);
+};
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <new>
+#include <cstring>
+#include <algorithm>
+
+#include "mempool.h"
+#include "common.h"
+#include "logging.h"
+
+using namespace std;
+
+extern logging::Logger mglog;
+
+char* CPageAlloc::allocate(size_t size, bool huge)
+{
+#ifdef _WIN32
+   (void)huge;
+   char* p = new (nothrow) char [size];
+   if (p)
+      memset(p, 0, size);
+   return p;
+#else
+   void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+   if (huge)
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+   if (p != MAP_FAILED)
+      return (char*)p;
+
+   if (!huge)
+   {
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      return p == MAP_FAILED ? NULL : (char*)p;
+   }
+
+   // No huge pages reserved: leave it to the kernel, which can only use them
+   // for the memory aligned to the huge page size.
+   p = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (p == MAP_FAILED)
+      return NULL;
+
+   char* begin = (char*)p;
+   char* aligned = (char*)((uintptr_t(begin) + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1));
+   if (aligned > begin)
+      munmap(begin, aligned - begin);
+   munmap(aligned + size, begin + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+   madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+   return aligned;
+#endif
+}
+
+void CPageAlloc::release(char* p, size_t size)
+{
+#ifdef _WIN32
+   (void)size;
+   delete [] p;
+#else
+   munmap(p, size);
+#endif
+}
+
+pthread_mutex_t CMemBudget::s_Lock = PTHREAD_MUTEX_INITIALIZER;
+int64_t CMemBudget::s_llLimit = 0;
+int64_t CMemBudget::s_llUsed = 0;
+int CMemBudget::s_iReceivers = 0;
+
+void CMemBudget::setLimit(int64_t maxbytes)
+{
+   CGuard cg(s_Lock);
+   s_llLimit = maxbytes;
+}
+
+int64_t CMemBudget::getUsed()
+{
+   CGuard cg(s_Lock);
+   return s_llUsed;
+}
+
+bool CMemBudget::charge(int64_t bytes, bool force)
+{
+   CGuard cg(s_Lock);
+   if (!force && s_llLimit > 0 && s_llUsed + bytes > s_llLimit)
+      return false;
+
+   s_llUsed += bytes;
+   return true;
+}
+
+void CMemBudget::refund(int64_t bytes)
+{
+   CGuard cg(s_Lock);
+   s_llUsed -= bytes;
+}
+
+void CMemBudget::addReceiver()
+{
+   CGuard cg(s_Lock);
+   ++ s_iReceivers;
+}
+
+void CMemBudget::removeReceiver()
+{
+   CGuard cg(s_Lock);
+   -- s_iReceivers;
+}
+
+// When less than a quarter of the limit is left, the part of its share that
+// a receiver can hold without shedding goes down with what's left, to none:
+// the receivers holding the most shed first, and all of them at the limit.
+bool CMemBudget::shouldShed(int64_t held, int64_t spare)
+{
+   CGuard cg(s_Lock);
+   if (s_llLimit <= 0)
+      return false;
+
+   int64_t left = s_llLimit - s_llUsed + spare;
+   if (left * 4 >= s_llLimit)
+      return false;
+
+   double share = double(s_llLimit) / max(s_iReceivers, 1);
+   return held > share * max(left, int64_t(0)) / (s_llLimit / 4);
+}
+
+pthread_mutex_t CSndBlockPool::s_Lock = PTHREAD_MUTEX_INITIALIZER;
+map<int, CSndBlockPool*> CSndBlockPool::s_Pools;
+int64_t CSndBlockPool::s_llMaxBytes = 0;
+int64_t CSndBlockPool::s_llBytes = 0;
+bool CSndBlockPool::s_bHugePages = false;
+CSndBlockPool::ReleaseHook* CSndBlockPool::s_pReleaseHook = NULL;
+
+CSndBlockPool* CSndBlockPool::get(int blocksize)
+{
+   // Keep the blocks aligned to cache lines, and big enough to link them.
+   blocksize = (blocksize + 63) & ~63;
+
+   CGuard cg(s_Lock);
+   CSndBlockPool*& pool = s_Pools[blocksize];
+   if (!pool)
+      pool = new CSndBlockPool(blocksize);
+   return pool;
+}
+
+void CSndBlockPool::configure(int64_t maxbytes, bool hugepages)
+{
+   CGuard cg(s_Lock);
+   s_llMaxBytes = maxbytes;
+   s_bHugePages = hugepages;
+}
+
+CSndBlockPool::CSndBlockPool(int blocksize):
+m_iBlockSize(blocksize),
+m_iFreeBlocks(0),
+m_Lock(),
+m_ReleaseCond(),
+m_iWaiting(0),
+m_vStarved(),
+m_Slabs(),
+m_Avail(),
+m_iEmptySlabs(0)
+{
+   pthread_mutex_init(&m_Lock, NULL);
+   CGuard::createCond(m_ReleaseCond);
+}
+
+CSndBlockPool::~CSndBlockPool()
+{
+   for (map<char*, Slab*>::iterator i = m_Slabs.begin(); i != m_Slabs.end(); ++ i)
+   {
+      CPageAlloc::release(i->second->m_pcData, i->second->m_zSize);
+      delete i->second;
+   }
+   pthread_cond_destroy(&m_ReleaseCond);
+   pthread_mutex_destroy(&m_Lock);
+}
+
+void CSndBlockPool::cleanup()
+{
+   CGuard cg(s_Lock);
+   for (map<int, CSndBlockPool*>::iterator i = s_Pools.begin(); i != s_Pools.end(); )
+   {
+      CSndBlockPool* pool = i->second;
+      if (pool->m_iEmptySlabs < int(pool->m_Slabs.size()))
+      {
+         // Still used by some buffer.
+         ++ i;
+         continue;
+      }
+
+      for (map<char*, Slab*>::iterator s = pool->m_Slabs.begin(); s != pool->m_Slabs.end(); ++ s)
+      {
+         s_llBytes -= int64_t(s->second->m_zSize);
+         CMemBudget::refund(s->second->m_zSize);
+      }
+      delete pool;
+      s_Pools.erase(i ++);
+   }
+}
+
+bool CSndBlockPool::grow(int n)
+{
+   size_t slabsize;
+   bool huge;
+   int nslabs;
+   {
+      CGuard cg(s_Lock);
+      huge = s_bHugePages;
+      slabsize = huge ? CPageAlloc::HUGE_PAGE_SIZE : 256*1024;
+      while (slabsize < size_t(m_iBlockSize))
+         slabsize *= 2;
+
+      int perslab = slabsize / m_iBlockSize;
+      nslabs = (n - m_iFreeBlocks + perslab - 1) / perslab;
+      if (s_llMaxBytes > 0 && s_llBytes + int64_t(nslabs) * int64_t(slabsize) > s_llMaxBytes)
+         return false;
+
+      if (!CMemBudget::charge(int64_t(nslabs) * int64_t(slabsize)))
+         return false;
+
+      // Counted before mapping, so that the limit holds for
+      // the pools of other block sizes growing at the same time.
+      s_llBytes += int64_t(nslabs) * int64_t(slabsize);
+   }
+
+   for (int i = 0; i < nslabs; ++ i)
+   {
+      char* data = CPageAlloc::allocate(slabsize, huge);
+      if (!data)
+      {
+         LOGC(mglog.Error, log << "CSndBlockPool: can't allocate " << slabsize << " bytes");
+         CGuard cg(s_Lock);
+         s_llBytes -= int64_t(nslabs - i) * int64_t(slabsize);
+         CMemBudget::refund(int64_t(nslabs - i) * int64_t(slabsize));
+         return false;
+      }
+
+      Slab* s = new Slab;
+      s->m_pcData = data;
+      s->m_zSize = slabsize;
+      s->m_iBlocks = slabsize / m_iBlockSize;
+      s->m_iFree = s->m_iBlocks;
+      s->m_pFreeList = NULL;
+      for (int b = s->m_iBlocks - 1; b >= 0; -- b)
+      {
+         char* block = data + b * m_iBlockSize;
+         *(char**)block = s->m_pFreeList;
+         s->m_pFreeList = block;
+      }
+
+      m_Slabs[data] = s;
+      m_Avail[data] = s;
+      m_iFreeBlocks += s->m_iBlocks;
+      ++ m_iEmptySlabs;
+
+      HLOGC(mglog.Debug, log << "CSndBlockPool: new slab of " << s->m_iBlocks << " blocks of " << m_iBlockSize
+            << (huge ? " (huge pages)" : ""));
+   }
+
+   return true;
+}
+
+void CSndBlockPool::deleteSlab(Slab* s)
+{
+   m_Slabs.erase(s->m_pcData);
+   m_Avail.erase(s->m_pcData);
+   m_iFreeBlocks -= s->m_iBlocks;
+   CPageAlloc::release(s->m_pcData, s->m_zSize);
+
+   {
+      CGuard cg(s_Lock);
+      s_llBytes -= int64_t(s->m_zSize);
+   }
+   CMemBudget::refund(s->m_zSize);
+
+   HLOGC(mglog.Debug, log << "CSndBlockPool: released slab of " << s->m_iBlocks << " blocks of " << m_iBlockSize);
+   delete s;
+}
+
+bool CSndBlockPool::acquire(char** blocks, int n, uint64_t timeout_us)
+{
+   CGuard cg(m_Lock);
+
+   if (m_iFreeBlocks < n && !grow(n))
+   {
+      uint64_t deadline = CTimer::getTime() + timeout_us;
+      for (;;)
+      {
+         uint64_t now = CTimer::getTime();
+         if (now >= deadline)
+            return false;
+
+         ++ m_iWaiting;
+         CTimer::condTimedWaitUS(&m_ReleaseCond, &m_Lock, deadline - now);
+         -- m_iWaiting;
+
+         if (m_iFreeBlocks >= n || grow(n))
+            break;
+      }
+   }
+
+   for (int i = 0; i < n; ++ i)
+   {
+      Slab* s = m_Avail.begin()->second;
+      if (s->m_iFree == s->m_iBlocks)
+         -- m_iEmptySlabs;
+
+      blocks[i] = s->m_pFreeList;
+      s->m_pFreeList = *(char**)s->m_pFreeList;
+      if (-- s->m_iFree == 0)
+         m_Avail.erase(m_Avail.begin());
+   }
+   m_iFreeBlocks -= n;
+
+   return true;
+}
+
+void CSndBlockPool::release(char* const* blocks, int n)
+{
+   if (n == 0)
+      return;
+
+   std::vector<int32_t> starved;
+   CGuard cg(m_Lock);
+
+   for (int i = 0; i < n; ++ i)
+   {
+      map<char*, Slab*>::iterator it = m_Slabs.upper_bound(blocks[i]);
+      Slab* s = (-- it)->second;
+
+      *(char**)blocks[i] = s->m_pFreeList;
+      s->m_pFreeList = blocks[i];
+      ++ m_iFreeBlocks;
+
+      if (++ s->m_iFree == 1)
+         m_Avail[s->m_pcData] = s;
+
+      if (s->m_iFree == s->m_iBlocks)
+      {
+         // Keep one free slab, so that the memory isn't mapped and
+         // unmapped all the time around a slab boundary.
+         if (m_iEmptySlabs > 0)
+            deleteSlab(s);
+         else
+            ++ m_iEmptySlabs;
+      }
+   }
+
+   if (m_iWaiting > 0)
+      pthread_cond_broadcast(&m_ReleaseCond);
+
+   if (m_vStarved.empty() || !s_pReleaseHook)
+      return;
+
+   starved.swap(m_vStarved);
+   cg.forceUnlock();
+   (*s_pReleaseHook)(starved);
+}
+
+void CSndBlockPool::addStarved(int32_t id)
+{
+   CGuard cg(m_Lock);
+   if (std::find(m_vStarved.begin(), m_vStarved.end(), id) == m_vStarved.end())
+      m_vStarved.push_back(id);
+}
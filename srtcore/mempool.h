@@ -0,0 +1,171 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef INC__MEMPOOL_H
+#define INC__MEMPOOL_H
+
+// Memory for the packet payloads of the buffers, taken directly from the
+// system, possibly backed with huge pages.
+//
+// CSndBlockPool holds the payload blocks of the sender buffers of all
+// sockets (see srt_setsndbufpool()). A sender buffer takes a block for every
+// packet it stores and gives it back once the packet is acknowledged or
+// dropped, so the memory follows the data in flight rather than the peak
+// size of every buffer. The blocks are carved from slabs, which are returned
+// to the system when they become free, keeping one free slab at hand.
+//
+// CMemBudget counts the memory of the buffers of all sockets against one
+// limit for the whole process (see srt_setmemlimit()): the slabs of the
+// sender pools and the units of the receiver queues.
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include "udt.h"
+
+class CPageAlloc
+{
+public:
+   static const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+
+      /// Allocate zeroed, page-aligned memory directly from the system.
+      /// @param [in] size bytes; a multiple of HUGE_PAGE_SIZE for huge pages.
+      /// @param [in] huge try to back it with huge pages: explicit ones if
+      /// reserved in the system, otherwise transparent ones.
+      /// @return the memory, or NULL if none is available.
+
+   static char* allocate(size_t size, bool huge);
+   static void release(char* p, size_t size);
+};
+
+class CMemBudget
+{
+public:
+
+      /// Set the limit of the memory of all buffers, 0 for none.
+
+   static void setLimit(int64_t maxbytes);
+   static int64_t getUsed();
+
+      /// Count memory in, before it's allocated.
+      /// @param [in] bytes size of the memory.
+      /// @param [in] force count it in even above the limit, for the
+      /// memory without which a socket can't work at all.
+      /// @return false, and nothing counted, if that would exceed the limit.
+
+   static bool charge(int64_t bytes, bool force = false);
+   static void refund(int64_t bytes);
+
+      /// Register a receiver, which gets its share of the limit.
+
+   static void addReceiver();
+   static void removeReceiver();
+
+      /// Check if a receiver should drop the packets it doesn't need right
+      /// away: when less than a quarter of the limit is left and it holds
+      /// more than a part of its share, which gets smaller with what's left.
+      /// @param [in] held memory held by the receiver.
+      /// @param [in] spare memory counted in already, but free for the
+      /// receiver to use: the free units of its multiplexer.
+
+   static bool shouldShed(int64_t held, int64_t spare);
+
+private:
+   static pthread_mutex_t s_Lock;
+   static int64_t s_llLimit;
+   static int64_t s_llUsed;
+   static int s_iReceivers;
+};
+
+class CSndBlockPool
+{
+public:
+
+      /// Get the pool of the blocks of the given size, shared by the whole process.
+
+   static CSndBlockPool* get(int blocksize);
+
+      /// Configure all pools (see srt_setsndbufpool()).
+      /// @param [in] maxbytes limit of the memory of all pools together, 0 for none.
+      /// @param [in] hugepages back the slabs with huge pages.
+
+   static void configure(int64_t maxbytes, bool hugepages);
+
+      /// Delete the pools not used by any buffer, at srt_cleanup().
+
+   static void cleanup();
+
+      /// Take n blocks.
+      /// @param [out] blocks array of n entries for the blocks.
+      /// @param [in] n number of blocks.
+      /// @param [in] timeout_us how long to wait for other buffers to release
+      /// blocks if the limit is reached.
+      /// @return false, and no blocks taken, if that would exceed the limit.
+
+   bool acquire(char** blocks, int n, uint64_t timeout_us);
+
+   void release(char* const* blocks, int n);
+
+      /// Remember a socket that couldn't take blocks without waiting. The
+      /// next release() passes it to the release hook.
+      /// @param [in] id socket ID.
+
+   void addStarved(int32_t id);
+
+      /// Set the function that release() calls, out of the pool lock, with
+      /// the sockets remembered by addStarved() since the last release.
+
+   typedef void ReleaseHook(const std::vector<int32_t>& ids);
+   static void setReleaseHook(ReleaseHook* hook) { s_pReleaseHook = hook; }
+
+   int getBlockSize() const { return m_iBlockSize; }
+
+private:
+   CSndBlockPool(int blocksize);
+   ~CSndBlockPool();
+
+   struct Slab
+   {
+      char* m_pcData;
+      size_t m_zSize;
+      int m_iBlocks;
+      int m_iFree;                      // number of free blocks
+      char* m_pFreeList;                // free blocks, linked through their first bytes
+   };
+
+   bool grow(int n);
+   void deleteSlab(Slab* s);
+
+private:
+   int m_iBlockSize;
+   int m_iFreeBlocks;
+
+   pthread_mutex_t m_Lock;
+   pthread_cond_t m_ReleaseCond;
+   int m_iWaiting;                      // threads waiting in acquire()
+   std::vector<int32_t> m_vStarved;     // sockets to tell at the next release()
+
+   std::map<char*, Slab*> m_Slabs;      // all slabs by address
+   std::map<char*, Slab*> m_Avail;      // slabs with free blocks; taken from the lowest first
+   int m_iEmptySlabs;                   // slabs with all blocks free
+
+   static pthread_mutex_t s_Lock;       // guards the static members
+   static std::map<int, CSndBlockPool*> s_Pools;
+   static int64_t s_llMaxBytes;
+   static int64_t s_llBytes;            // memory of all slabs
+   static bool s_bHugePages;
+   static ReleaseHook* s_pReleaseHook;
+
+private:
+   CSndBlockPool(const CSndBlockPool&);
+   CSndBlockPool& operator=(const CSndBlockPool&);
+};
+
+#endif
@@ -170,6 +170,7 @@ extern logging::Logger mglog;
 CPacket::CPacket():
 __pad(),
 m_data_owned(false),
+m_ullArrivalTime(0),
 m_iSeqNo((int32_t&)(m_nHeader[PH_SEQNO])),
 m_iMsgNo((int32_t&)(m_nHeader[PH_MSGNO])),
 m_iTimeStamp((int32_t&)(m_nHeader[PH_TIMESTAMP])),
@@ -480,6 +481,7 @@ CPacket* CPacket::clone() const
    pkt->m_pcData = new char[m_PacketVector[PV_DATA].iov_len];
    memcpy(pkt->m_pcData, m_pcData, m_PacketVector[PV_DATA].iov_len);
    pkt->m_PacketVector[PV_DATA].iov_len = m_PacketVector[PV_DATA].iov_len;
+   pkt->m_ullArrivalTime = m_ullArrivalTime;
 
    return pkt;
 }
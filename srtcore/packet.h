@@ -192,6 +192,16 @@ public:
 
    void setLength(size_t len);
 
+      /// Read the time when the system received the packet.
+      /// @return time in microseconds, in the CTimer::getTime() base, or 0 if not known.
+
+   uint64_t getArrivalTime() const { return m_ullArrivalTime; }
+
+      /// Set the time when the system received the packet.
+      /// @param t [in] time in microseconds, in the CTimer::getTime() base, 0 = not known.
+
+   void setArrivalTime(uint64_t t) { m_ullArrivalTime = t; }
+
       /// Pack a Control packet.
       /// @param pkttype [in] packet type filed.
       /// @param lparam [in] pointer to the first data structure, explained by the packet type.
@@ -362,6 +372,7 @@ protected:
 
    int32_t __pad;
    bool m_data_owned;
+   uint64_t m_ullArrivalTime;           //< kernel receive timestamp, 0 if none
 
 protected:
    CPacket& operator=(const CPacket&);
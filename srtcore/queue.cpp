@@ -53,6 +53,8 @@ modified by
 #ifdef WIN32
    #include <winsock2.h>
    #include <ws2tcpip.h>
+#else
+   #include <unistd.h>
 #endif
 #include <cstring>
 
@@ -63,6 +65,11 @@ modified by
 #include "logging.h"
 #include "queue.h"
 
+#ifdef LINUX
+#include <sys/prctl.h>
+#endif
+#include <new>
+
 using namespace std;
 
 CUnitQueue::CUnitQueue():
@@ -72,7 +79,9 @@ m_pLastQueue(NULL),
 m_iSize(0),
 m_iCount(0),
 m_iMSS(),
-m_iIPversion()
+m_iIPversion(),
+m_bHugePages(false),
+m_ullRetryIncrease(0)
 {
 }
 
@@ -82,20 +91,64 @@ CUnitQueue::~CUnitQueue()
 
    while (p != NULL)
    {
-      delete [] p->m_pUnit;
-      delete [] p->m_pBuffer;
-
       CQEntry* q = p;
       if (p == m_pLastQueue)
          p = NULL;
       else
          p = p->m_pNext;
-      delete q;
+      freeEntry(q);
+   }
+}
+
+int CUnitQueue::init(int size, int mss, int version, bool hugepages)
+{
+   m_iMSS = mss;
+   m_iIPversion = version;
+   m_bHugePages = hugepages;
+
+   if (hugepages)
+   {
+      // Made by prefault() in the thread that uses the units.
+      m_iSize = size;
+      return 0;
    }
+
+   CQEntry* tempq = allocEntry(size);
+   if (!tempq)
+      return -1;
+
+   chargeEntry(tempq);
+   addEntry(tempq);
+   return 0;
+}
+
+int CUnitQueue::prefault()
+{
+   if (m_pQEntry)
+      return 0;
+
+   CQEntry* tempq = allocEntry(m_iSize);
+   if (!tempq)
+      return -1;
+
+   m_iSize = 0;
+   chargeEntry(tempq);
+   addEntry(tempq);
+   return 0;
 }
 
-int CUnitQueue::init(int size, int mss, int version)
+CUnitQueue::CQEntry* CUnitQueue::allocEntry(int size)
 {
+   if (m_bHugePages)
+   {
+      CQEntry* tempq = allocHugeEntry(size);
+      if (tempq)
+         return tempq;
+
+      LOGC(mglog.Error, log << "CUnitQueue: can't map memory for the units, using the heap");
+      m_bHugePages = false;
+   }
+
    CQEntry* tempq = NULL;
    CUnit* tempu = NULL;
    char* tempb = NULL;
@@ -104,7 +157,7 @@ int CUnitQueue::init(int size, int mss, int version)
    {
       tempq = new CQEntry;
       tempu = new CUnit [size];
-      tempb = new char [size * mss];
+      tempb = new char [size * m_iMSS];
    }
    catch (...)
    {
@@ -112,32 +165,116 @@ int CUnitQueue::init(int size, int mss, int version)
       delete [] tempu;
       delete [] tempb;
 
-      return -1;
+      return NULL;
    }
 
    for (int i = 0; i < size; ++ i)
    {
       tempu[i].m_iFlag = CUnit::FREE;
-      tempu[i].m_Packet.m_pcData = tempb + i * mss;
+      tempu[i].m_Packet.m_pcData = tempb + i * m_iMSS;
    }
    tempq->m_pUnit = tempu;
    tempq->m_pBuffer = tempb;
    tempq->m_iSize = size;
+   tempq->m_zMapped = 0;
+   tempq->m_zCharged = 0;
 
-   m_pQEntry = m_pCurrQueue = m_pLastQueue = tempq;
-   m_pQEntry->m_pNext = m_pQEntry;
+   return tempq;
+}
 
-   m_pAvailUnit = m_pCurrQueue->m_pUnit;
+// The payloads and then the units, filling whole huge pages.
+CUnitQueue::CQEntry* CUnitQueue::allocHugeEntry(int size)
+{
+   const size_t align = 64;
+   const size_t page = CPageAlloc::HUGE_PAGE_SIZE;
 
-   m_iSize = size;
-   m_iMSS = mss;
-   m_iIPversion = version;
+   size = max(size, int((page - align) / (m_iMSS + sizeof(CUnit))));
+   size_t unitoff = (size_t(size) * m_iMSS + align - 1) & ~(align - 1);
+   size_t mapped = (unitoff + size * sizeof(CUnit) + page - 1) / page * page;
 
-   return 0;
+   CQEntry* tempq = new (nothrow) CQEntry;
+   if (!tempq)
+      return NULL;
+
+   char* mem = CPageAlloc::allocate(mapped, true);
+   if (!mem)
+   {
+      delete tempq;
+      return NULL;
+   }
+
+   // Fault in every page now, rather than on the first packets.
+   for (size_t off = 0; off < mapped; off += 4096)
+      ((volatile char*)mem)[off] = 0;
+
+   CUnit* tempu = (CUnit*)(mem + unitoff);
+   for (int i = 0; i < size; ++ i)
+   {
+      new (tempu + i) CUnit;
+      tempu[i].m_iFlag = CUnit::FREE;
+      tempu[i].m_Packet.m_pcData = mem + i * m_iMSS;
+   }
+   tempq->m_pUnit = tempu;
+   tempq->m_pBuffer = mem;
+   tempq->m_iSize = size;
+   tempq->m_zMapped = mapped;
+   tempq->m_zCharged = 0;
+
+   HLOGC(mglog.Debug, log << "CUnitQueue: " << size << " units in " << (mapped / page) << " huge page(s)");
+   return tempq;
+}
+
+// The first part is counted in even above the limit: no packet
+// could be received without it.
+void CUnitQueue::chargeEntry(CQEntry* q)
+{
+   q->m_zCharged = q->m_zMapped ? q->m_zMapped : q->m_iSize * (m_iMSS + sizeof(CUnit));
+   CMemBudget::charge(q->m_zCharged, true);
+}
+
+void CUnitQueue::freeEntry(CQEntry* q)
+{
+   CMemBudget::refund(q->m_zCharged);
+   if (q->m_zMapped)
+   {
+      for (int i = 0; i < q->m_iSize; ++ i)
+         q->m_pUnit[i].~CUnit();
+      CPageAlloc::release(q->m_pBuffer, q->m_zMapped);
+   }
+   else
+   {
+      delete [] q->m_pUnit;
+      delete [] q->m_pBuffer;
+   }
+   delete q;
+}
+
+void CUnitQueue::addEntry(CQEntry* q)
+{
+   if (!m_pQEntry)
+   {
+      m_pQEntry = m_pCurrQueue = m_pLastQueue = q;
+      m_pQEntry->m_pNext = m_pQEntry;
+      m_pAvailUnit = m_pCurrQueue->m_pUnit;
+   }
+   else
+   {
+      m_pLastQueue->m_pNext = q;
+      m_pLastQueue = q;
+      m_pLastQueue->m_pNext = m_pQEntry;
+   }
+
+   m_iSize += q->m_iSize;
 }
 
 int CUnitQueue::increase()
 {
+   // It's called for every packet while the queue is nearly full,
+   // and the scan below is long.
+   uint64_t now = CTimer::getTime();
+   if (now < m_ullRetryIncrease)
+      return -1;
+
    // adjust/correct m_iCount
    int real_count = 0;
    CQEntry* p = m_pQEntry;
@@ -157,43 +294,26 @@ int CUnitQueue::increase()
    if (double(m_iCount) / m_iSize < 0.9)
       return -1;
 
-   CQEntry* tempq = NULL;
-   CUnit* tempu = NULL;
-   char* tempb = NULL;
-
-   // all queues have the same size
-   int size = m_pQEntry->m_iSize;
-
-   try
-   {
-      tempq = new CQEntry;
-      tempu = new CUnit [size];
-      tempb = new char [size * m_iMSS];
-   }
-   catch (...)
+   // All parts have the same size, and so the same memory as the first one.
+   // Above the limit of CMemBudget the queue doesn't grow, and what arrives
+   // when all units are used is dropped.
+   size_t bytes = m_pQEntry->m_zCharged;
+   if (!CMemBudget::charge(bytes))
    {
-      delete tempq;
-      delete [] tempu;
-      delete [] tempb;
-
+      HLOGC(mglog.Debug, log << "CUnitQueue: memory limit reached, staying at " << m_iSize << " units");
+      m_ullRetryIncrease = now + 10000;
       return -1;
    }
 
-   for (int i = 0; i < size; ++ i)
+   CQEntry* tempq = allocEntry(m_pQEntry->m_iSize);
+   if (!tempq)
    {
-      tempu[i].m_iFlag = CUnit::FREE;
-      tempu[i].m_Packet.m_pcData = tempb + i * m_iMSS;
+      CMemBudget::refund(bytes);
+      return -1;
    }
-   tempq->m_pUnit = tempu;
-   tempq->m_pBuffer = tempb;
-   tempq->m_iSize = size;
-
-   m_pLastQueue->m_pNext = tempq;
-   m_pLastQueue = tempq;
-   m_pLastQueue->m_pNext = m_pQEntry;
-
-   m_iSize += size;
+   tempq->m_zCharged = bytes;
 
+   addEntry(tempq);
    return 0;
 }
 
@@ -234,6 +354,32 @@ CUnit* CUnitQueue::getNextAvailUnit()
    return NULL;
 }
 
+int CUnitQueue::getNextAvailUnits(CUnit** units, int n)
+{
+   // getNextAvailUnit() doesn't reserve the unit it returns, so every
+   // unit found is temporarily marked as used, so that the next search
+   // skips it. This is safe because only the receiver worker takes units.
+   int found = 0;
+   while (found < n)
+   {
+      CUnit* u = getNextAvailUnit();
+      if (!u)
+         break;
+
+      u->m_iFlag = CUnit::GOOD;
+      ++ m_iCount;
+      units[found ++] = u;
+   }
+
+   for (int i = 0; i < found; ++ i)
+   {
+      units[i]->m_iFlag = CUnit::FREE;
+      -- m_iCount;
+   }
+
+   return found;
+}
+
 
 CSndUList::CSndUList():
     m_pHeap(NULL),
@@ -242,7 +388,10 @@ CSndUList::CSndUList():
     m_ListLock(),
     m_pWindowLock(NULL),
     m_pWindowCond(NULL),
-    m_pTimer(NULL)
+    m_pTimer(NULL),
+    m_vCompletions(),
+    m_mFreedBlocks(),
+    m_bCompletions(false)
 {
     m_pHeap = new CSNode*[m_iArrayLength];
     pthread_mutex_init(&m_ListLock, NULL);
@@ -250,6 +399,8 @@ CSndUList::CSndUList():
 
 CSndUList::~CSndUList()
 {
+    // The worker has exited, nothing is being sent anymore.
+    runCompletions();
     delete [] m_pHeap;
     pthread_mutex_destroy(&m_ListLock);
 }
@@ -354,6 +505,47 @@ uint64_t CSndUList::getNextProcTime()
    return m_pHeap[0]->m_llTimeStamp_tk;
 }
 
+void CSndUList::addCompletions(std::vector<CSndCompletion>& done, CSndBlockPool* pool, std::vector<char*>& freed)
+{
+   {
+      CGuard listguard(m_ListLock);
+      m_vCompletions.insert(m_vCompletions.end(), done.begin(), done.end());
+      if (!freed.empty())
+      {
+         std::vector<char*>& blocks = m_mFreedBlocks[pool];
+         blocks.insert(blocks.end(), freed.begin(), freed.end());
+      }
+      m_bCompletions = true;
+   }
+   done.clear();
+   freed.clear();
+
+   // Wake up the worker, whether it sleeps until the next packet or waits for sockets.
+   m_pTimer->interrupt();
+   pthread_mutex_lock(m_pWindowLock);
+   pthread_cond_signal(m_pWindowCond);
+   pthread_mutex_unlock(m_pWindowLock);
+}
+
+void CSndUList::runCompletions()
+{
+   std::vector<CSndCompletion> done;
+   std::map<CSndBlockPool*, std::vector<char*> > freed;
+   {
+      CGuard listguard(m_ListLock);
+      done.swap(m_vCompletions);
+      freed.swap(m_mFreedBlocks);
+      m_bCompletions = false;
+   }
+
+   for (size_t i = 0; i < done.size(); ++ i)
+      done[i].run();
+
+   // Given back in one go per pool, to take the pool lock once.
+   for (std::map<CSndBlockPool*, std::vector<char*> >::iterator i = freed.begin(); i != freed.end(); ++ i)
+      i->first->release(&i->second[0], i->second.size());
+}
+
 void CSndUList::insert_(int64_t ts, const CUDT* u)
 {
    CSNode* n = u->m_pSNode;
@@ -441,56 +633,88 @@ void CSndUList::remove_(const CUDT* u)
 
 //
 CSndQueue::CSndQueue():
-m_WorkerThread(),
-m_pSndUList(NULL),
+m_vWorkers(),
 m_pChannel(NULL),
 m_pTimer(NULL),
-m_WindowLock(),
-m_WindowCond(),
+m_iSndBatch(1),
 m_bClosing(false),
 m_ExitCond()
 {
-    pthread_cond_init(&m_WindowCond, NULL);
-    pthread_mutex_init(&m_WindowLock, NULL);
 }
 
 CSndQueue::~CSndQueue()
 {
    m_bClosing = true;
 
-   if(m_pTimer != NULL)
+   for (size_t i = 0; i < m_vWorkers.size(); ++ i)
    {
-        m_pTimer->interrupt();
-   }
+      CWorker* w = m_vWorkers[i];
+      w->m_pTimer->interrupt();
 
-   pthread_mutex_lock(&m_WindowLock);
-   pthread_cond_signal(&m_WindowCond);
-   pthread_mutex_unlock(&m_WindowLock);
-   if (!pthread_equal(m_WorkerThread, pthread_t()))
-       pthread_join(m_WorkerThread, NULL);
-   pthread_cond_destroy(&m_WindowCond);
-   pthread_mutex_destroy(&m_WindowLock);
+      pthread_mutex_lock(&w->m_WindowLock);
+      pthread_cond_signal(&w->m_WindowCond);
+      pthread_mutex_unlock(&w->m_WindowLock);
+   }
 
-   delete m_pSndUList;
+   for (size_t i = 0; i < m_vWorkers.size(); ++ i)
+   {
+      CWorker* w = m_vWorkers[i];
+      if (!pthread_equal(w->m_Thread, pthread_t()))
+         pthread_join(w->m_Thread, NULL);
+      pthread_cond_destroy(&w->m_WindowCond);
+      pthread_mutex_destroy(&w->m_WindowLock);
+
+      if (w->m_pTimer != m_pTimer)
+         delete w->m_pTimer;
+      delete w->m_pSndUList;
+      delete [] w->m_pBatchPkt;
+      delete [] w->m_pBatchAddr;
+      delete w;
+   }
 }
 
-void CSndQueue::init(CChannel* c, CTimer* t)
+void CSndQueue::init(CChannel* c, CTimer* t, int sndbatch, int workers)
 {
    m_pChannel = c;
    m_pTimer = t;
-   m_pSndUList = new CSndUList;
-   m_pSndUList->m_pWindowLock = &m_WindowLock;
-   m_pSndUList->m_pWindowCond = &m_WindowCond;
-   m_pSndUList->m_pTimer = m_pTimer;
+   m_iSndBatch = sndbatch;
 
-   ThreadName tn("SRT:SndQ:worker");
-   if (0 != pthread_create(&m_WorkerThread, NULL, CSndQueue::worker, this))
+   for (int i = 0; i < workers; ++ i)
    {
-	   m_WorkerThread = pthread_t();
-       throw CUDTException(MJ_SYSTEMRES, MN_THREAD);
+      CWorker* w = new CWorker;
+      w->m_pQueue = this;
+      w->m_Thread = pthread_t();
+      w->m_pTimer = (i == 0) ? t : new CTimer;
+      w->m_pTimer->setSpinThreshold(t->getSpinThreshold());
+      w->m_pBatchPkt = new CPacket[m_iSndBatch];
+      w->m_pBatchAddr = new sockaddr*[m_iSndBatch];
+      w->m_ullSndCalls = 0;
+      w->m_ullSndPackets = 0;
+      CGuard::createCond(w->m_WindowCond);
+      pthread_mutex_init(&w->m_WindowLock, NULL);
+      w->m_pSndUList = new CSndUList;
+      w->m_pSndUList->m_pWindowLock = &w->m_WindowLock;
+      w->m_pSndUList->m_pWindowCond = &w->m_WindowCond;
+      w->m_pSndUList->m_pTimer = w->m_pTimer;
+      m_vWorkers.push_back(w);
+
+      ThreadName tn("SRT:SndQ:worker");
+      if (0 != CThreadConfig::create(&w->m_Thread, SRT_THREAD_SNDQ, CSndQueue::worker, w))
+      {
+         w->m_Thread = pthread_t();
+         throw CUDTException(MJ_SYSTEMRES, MN_THREAD);
+      }
    }
 }
 
+CSndUList* CSndQueue::getSndUList(const CUDT* u) const
+{
+   if (m_vWorkers.size() == 1)
+      return m_vWorkers[0]->m_pSndUList;
+
+   return m_vWorkers[u->m_SocketID % m_vWorkers.size()]->m_pSndUList;
+}
+
 #ifdef SRT_ENABLE_IPOPTS
 int CSndQueue::getIpTTL() const
 {
@@ -505,10 +729,17 @@ int CSndQueue::getIpToS() const
 
 void* CSndQueue::worker(void* param)
 {
-    CSndQueue* self = (CSndQueue*)param;
+    CWorker* w = (CWorker*)param;
+    CSndQueue* self = w->m_pQueue;
 
     THREAD_STATE_INIT("SRT:SndQ:worker");
 
+#ifdef LINUX
+    // The default 50us slack of the timed waits would make the
+    // sleeps in CTimer::sleepto() end late; 1us is enough.
+    prctl(PR_SET_TIMERSLACK, 1000);
+#endif
+
 #if defined(SRT_DEBUG_SNDQ_HIGHRATE)
     CTimer::rdtsc(self->m_ullDbgTime);
     self->m_ullDbgPeriod = 5000000LL * CTimer::getCPUFrequency();
@@ -517,7 +748,11 @@ void* CSndQueue::worker(void* param)
 
     while (!self->m_bClosing)
     {
-        uint64_t ts = self->m_pSndUList->getNextProcTime();
+        // Nothing sent in the previous rounds points into these buffers anymore.
+        if (w->m_pSndUList->m_bCompletions)
+            w->m_pSndUList->runCompletions();
+
+        uint64_t ts = w->m_pSndUList->getNextProcTime();
 
 #if   defined(SRT_DEBUG_SNDQ_HIGHRATE)
         self->m_WorkerStats.lIteration++;
@@ -546,7 +781,7 @@ void* CSndQueue::worker(void* param)
             THREAD_PAUSED();
             if (currtime < ts) 
             {
-                self->m_pTimer->sleepto(ts);
+                w->m_pTimer->sleepto(ts);
 
 #if         defined(HAI_DEBUG_SNDQ_HIGHRATE)
                 self->m_WorkerStats.lSleepTo++;
@@ -554,26 +789,45 @@ void* CSndQueue::worker(void* param)
             }
             THREAD_RESUMED();
 
-            // it is time to send the next pkt
-            sockaddr* addr;
-            CPacket pkt;
-            if (self->m_pSndUList->pop(addr, pkt) < 0) 
+            // it is time to send the next pkt; collect all
+            // packets that are due now, up to the batch size
+            int npkts = 0;
+            while (npkts < self->m_iSndBatch)
             {
-                continue;
+                sockaddr*& addr = w->m_pBatchAddr[npkts];
+                CPacket& pkt = w->m_pBatchPkt[npkts];
+                if (w->m_pSndUList->pop(addr, pkt) < 0)
+                    break;
 
+                if ( pkt.isControl() )
+                {
+                    HLOGC(mglog.Debug, log << self->CONID() << "chn:SENDING: " << MessageTypeStr(pkt.getType(), pkt.getExtendedType()));
+                }
+                else
+                {
+                    HLOGC(dlog.Debug, log << self->CONID() << "chn:SENDING SIZE " << pkt.getLength() << " SEQ: " << pkt.getSeqNo());
+                }
+                ++ npkts;
+            }
+
+            if (npkts == 0)
+            {
 #if         defined(SRT_DEBUG_SNDQ_HIGHRATE)
                 self->m_WorkerStats.lNotReadyPop++;
 #endif      /* SRT_DEBUG_SNDQ_HIGHRATE */
+                continue;
             }
-            if ( pkt.isControl() )
-            {
-                HLOGC(mglog.Debug, log << self->CONID() << "chn:SENDING: " << MessageTypeStr(pkt.getType(), pkt.getExtendedType()));
-            }
+
+            // Packets that failed to be sent are gone as if lost in the
+            // network, and are recovered the same way.
+            int nsent;
+            if (npkts == 1)
+                nsent = self->m_pChannel->sendto(w->m_pBatchAddr[0], w->m_pBatchPkt[0]) == -1 ? 0 : 1;
             else
-            {
-                HLOGC(dlog.Debug, log << self->CONID() << "chn:SENDING SIZE " << pkt.getLength() << " SEQ: " << pkt.getSeqNo());
-            }
-            self->m_pChannel->sendto(addr, pkt);
+                nsent = self->m_pChannel->sendto(w->m_pBatchAddr, w->m_pBatchPkt, npkts);
+
+            ++ w->m_ullSndCalls;
+            w->m_ullSndPackets += nsent;
 
 #if      defined(SRT_DEBUG_SNDQ_HIGHRATE)
             self->m_WorkerStats.lSendTo++;
@@ -587,16 +841,16 @@ void* CSndQueue::worker(void* param)
 
             // wait here if there is no sockets with data to be sent
             THREAD_PAUSED();
-            pthread_mutex_lock(&self->m_WindowLock);
-            if (!self->m_bClosing && (self->m_pSndUList->m_iLastEntry < 0)) {
-                pthread_cond_wait(&self->m_WindowCond, &self->m_WindowLock);
+            pthread_mutex_lock(&w->m_WindowLock);
+            if (!self->m_bClosing && (w->m_pSndUList->m_iLastEntry < 0) && !w->m_pSndUList->m_bCompletions) {
+                pthread_cond_wait(&w->m_WindowCond, &w->m_WindowLock);
 
 #if defined(SRT_DEBUG_SNDQ_HIGHRATE)
                 self->m_WorkerStats.lCondWait++;
 #endif         /* SRT_DEBUG_SNDQ_HIGHRATE */
             }
             THREAD_RESUMED();
-            pthread_mutex_unlock(&self->m_WindowLock);
+            pthread_mutex_unlock(&w->m_WindowLock);
         }
     }
 
@@ -611,98 +865,409 @@ int CSndQueue::sendto(const sockaddr* addr, CPacket& packet)
    return packet.getLength();
 }
 
+double CSndQueue::getSndBatchAvg() const
+{
+   uint64_t calls = 0, packets = 0;
+   for (size_t i = 0; i < m_vWorkers.size(); ++ i)
+   {
+      calls += m_vWorkers[i]->m_ullSndCalls;
+      packets += m_vWorkers[i]->m_ullSndPackets;
+   }
+   if (calls == 0)
+      return 0;
+   return double(packets) / calls;
+}
+
+double CSndQueue::getWakeupErrAvg() const
+{
+   double sum = 0;
+   for (size_t i = 0; i < m_vWorkers.size(); ++ i)
+      sum += m_vWorkers[i]->m_pTimer->getWakeupErrAvg();
+   return m_vWorkers.empty() ? 0 : sum / m_vWorkers.size();
+}
+
+double CSndQueue::getWakeupErrMax() const
+{
+   double maxerr = 0;
+   for (size_t i = 0; i < m_vWorkers.size(); ++ i)
+      maxerr = std::max(maxerr, m_vWorkers[i]->m_pTimer->getWakeupErrMax());
+   return maxerr;
+}
+
 
 //
-CRcvUList::CRcvUList():
-m_pUList(NULL),
-m_pLast(NULL)
+CTimerWheel::CTimerWheel():
+m_ullTick_tk(1000 * CTimer::getCPUFrequency()),
+m_ullNow(0),
+m_iCount(0)
 {
+   for (int i = 0; i < SLOTS; ++ i)
+      m_apSlots[i] = NULL;
+
+   uint64_t currtime_tk;
+   CTimer::rdtsc(currtime_tk);
+   m_ullNow = currtime_tk / m_ullTick_tk;
 }
 
-CRcvUList::~CRcvUList()
+CTimerWheel::~CTimerWheel()
 {
 }
 
-void CRcvUList::insert(const CUDT* u)
+void CTimerWheel::schedule(const CUDT* u, uint64_t time_tk)
 {
    CRNode* n = u->m_pRNode;
-   CTimer::rdtsc(n->m_llTimeStamp_tk);
 
-   if (NULL == m_pUList)
+   if (!n->m_bOnList)
+      return;
+
+   if (n->m_iSlot >= 0)
+      unlink_(n);
+
+   n->m_llTimeStamp_tk = time_tk;
+   insert_(n);
+}
+
+void CTimerWheel::remove(const CUDT* u)
+{
+   CRNode* n = u->m_pRNode;
+
+   if (n->m_iSlot >= 0)
+      unlink_(n);
+}
+
+void CTimerWheel::expire(uint64_t currtime_tk, vector<CUDT*>& due)
+{
+   uint64_t last = currtime_tk / m_ullTick_tk;
+
+   while (m_ullNow <= last)
    {
-      // empty list, insert as the single node
-      n->m_pPrev = n->m_pNext = NULL;
-      m_pLast = m_pUList = n;
+      if (m_iCount == 0)
+      {
+         // Nothing to pass by.
+         m_ullNow = last + 1;
+         break;
+      }
 
-      return;
+      int idx = int(m_ullNow & (LEVEL0_SIZE - 1));
+      if (idx == 0)
+      {
+         // A round of the first level has passed, bring in the next one.
+         int idx1 = int((m_ullNow >> LEVEL0_BITS) & (LEVELN_SIZE - 1));
+         cascade_(LEVEL0_SIZE + idx1);
+         if (idx1 == 0)
+            cascade_(LEVEL0_SIZE + LEVELN_SIZE + int((m_ullNow >> (LEVEL0_BITS + LEVELN_BITS)) & (LEVELN_SIZE - 1)));
+      }
+
+      while (CRNode* n = m_apSlots[idx])
+      {
+         unlink_(n);
+         due.push_back(n->m_pUDT);
+      }
+
+      ++ m_ullNow;
+   }
+}
+
+uint64_t CTimerWheel::getNextTime_tk() const
+{
+   if (m_iCount == 0)
+      return 0;
+
+   // Check the rest of the current round only; the slots beyond
+   // it may yet get earlier nodes by cascading.
+   uint64_t end = (m_ullNow | (LEVEL0_SIZE - 1)) + 1;
+   for (uint64_t t = m_ullNow; t < end; ++ t)
+   {
+      if (m_apSlots[t & (LEVEL0_SIZE - 1)])
+         return t * m_ullTick_tk;
    }
 
-   // always insert at the end for RcvUList
-   n->m_pPrev = m_pLast;
-   n->m_pNext = NULL;
-   m_pLast->m_pNext = n;
-   m_pLast = n;
+   return end * m_ullTick_tk;
 }
 
-void CRcvUList::remove(const CUDT* u)
+void CTimerWheel::insert_(CRNode* n)
 {
-   CRNode* n = u->m_pRNode;
+   // Round up, so that the node never expires before its time.
+   uint64_t t = n->m_llTimeStamp_tk / m_ullTick_tk + 1;
+   if (t < m_ullNow)
+      t = m_ullNow;
+   else if (t - m_ullNow >= RANGE)
+      t = m_ullNow + RANGE - 1;
+
+   uint64_t delta = t - m_ullNow;
+   int slot;
+   if (delta < uint64_t(LEVEL0_SIZE))
+      slot = int(t & (LEVEL0_SIZE - 1));
+   else if (delta < uint64_t(LEVEL0_SIZE) * LEVELN_SIZE)
+      slot = LEVEL0_SIZE + int((t >> LEVEL0_BITS) & (LEVELN_SIZE - 1));
+   else
+      slot = LEVEL0_SIZE + LEVELN_SIZE + int((t >> (LEVEL0_BITS + LEVELN_BITS)) & (LEVELN_SIZE - 1));
+
+   n->m_iSlot = slot;
+   n->m_pPrev = NULL;
+   n->m_pNext = m_apSlots[slot];
+   if (n->m_pNext)
+      n->m_pNext->m_pPrev = n;
+   m_apSlots[slot] = n;
+   ++ m_iCount;
+}
 
-   if (!n->m_bOnList)
+void CTimerWheel::unlink_(CRNode* n)
+{
+   if (n->m_pPrev)
+      n->m_pPrev->m_pNext = n->m_pNext;
+   else
+      m_apSlots[n->m_iSlot] = n->m_pNext;
+
+   if (n->m_pNext)
+      n->m_pNext->m_pPrev = n->m_pPrev;
+
+   n->m_pPrev = n->m_pNext = NULL;
+   n->m_iSlot = -1;
+   -- m_iCount;
+}
+
+void CTimerWheel::cascade_(int slot)
+{
+   CRNode* n = m_apSlots[slot];
+   m_apSlots[slot] = NULL;
+
+   while (n)
+   {
+      CRNode* next = n->m_pNext;
+      -- m_iCount;
+      insert_(n);
+      n = next;
+   }
+}
+
+
+// At most this many TSBPD workers are started, but not more than the CPUs.
+static const int MAX_TSBPD_WORKERS = 4;
+
+CTsbPdQueue::CTsbPdQueue():
+m_vHeap(),
+m_vWorkers(),
+m_Lock(),
+m_WorkCond(),
+m_DoneCond(),
+m_bClosing(false)
+{
+   pthread_mutex_init(&m_Lock, NULL);
+   CGuard::createCond(m_WorkCond);
+   CGuard::createCond(m_DoneCond);
+}
+
+CTsbPdQueue::~CTsbPdQueue()
+{
+   stop();
+   pthread_mutex_destroy(&m_Lock);
+   pthread_cond_destroy(&m_WorkCond);
+   pthread_cond_destroy(&m_DoneCond);
+}
+
+void CTsbPdQueue::schedule(CTsbPdNode* n, uint64_t playtime)
+{
+   CGuard cg(m_Lock);
+
+   if (n->m_bRemoved)
       return;
 
-   if (NULL == n->m_pPrev)
+   if (m_vWorkers.empty())
+      start_();
+
+   if (n->m_iHeapLoc >= 0)
    {
-      // n is the first node
-      m_pUList = n->m_pNext;
-      if (NULL == m_pUList)
-         m_pLast = NULL;
-      else
-         m_pUList->m_pPrev = NULL;
+      if (n->m_ullPlayTime <= playtime)
+         return;
+
+      n->m_ullPlayTime = playtime;
+      siftUp_(n->m_iHeapLoc);
+      if (n->m_iHeapLoc == 0)
+         pthread_cond_signal(&m_WorkCond);
+      return;
    }
-   else
+
+   insert_(n, playtime);
+}
+
+void CTsbPdQueue::remove(CTsbPdNode* n)
+{
+   CGuard cg(m_Lock);
+
+   n->m_bRemoved = true;
+   remove_(n);
+
+   while (n->m_iBusy > 0)
+      pthread_cond_wait(&m_DoneCond, &m_Lock);
+}
+
+void CTsbPdQueue::stop()
+{
+   std::vector<pthread_t> workers;
    {
-      n->m_pPrev->m_pNext = n->m_pNext;
-      if (NULL == n->m_pNext)
+      CGuard cg(m_Lock);
+      m_bClosing = true;
+      pthread_cond_broadcast(&m_WorkCond);
+      workers.swap(m_vWorkers);
+   }
+
+   for (size_t i = 0; i < workers.size(); ++ i)
+      pthread_join(workers[i], NULL);
+
+   // Ready to start again, should sockets come after a new startup.
+   CGuard cg(m_Lock);
+   m_bClosing = false;
+}
+
+void CTsbPdQueue::start_()
+{
+   int count = MAX_TSBPD_WORKERS;
+#ifdef _SC_NPROCESSORS_ONLN
+   long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+   if (ncpu > 0 && ncpu < count)
+      count = int(ncpu);
+#endif
+
+   for (int i = 0; i < count; ++ i)
+   {
+      pthread_t t;
+      ThreadName tn("SRT:TsbPd");
+      if (0 != CThreadConfig::create(&t, SRT_THREAD_TSBPD, CTsbPdQueue::worker, this))
+         break;
+      m_vWorkers.push_back(t);
+   }
+
+   if (m_vWorkers.empty())
+      LOGC(mglog.Error, log << "TSBPD: can't start the shared workers, packets won't be delivered");
+}
+
+void* CTsbPdQueue::worker(void* param)
+{
+   CTsbPdQueue* self = (CTsbPdQueue*)param;
+
+   THREAD_STATE_INIT("SRT:TsbPd");
+
+   CGuard::enterCS(self->m_Lock);
+   while (!self->m_bClosing)
+   {
+      if (self->m_vHeap.empty())
       {
-         // n is the last node
-         m_pLast = n->m_pPrev;
+         THREAD_PAUSED();
+         pthread_cond_wait(&self->m_WorkCond, &self->m_Lock);
+         THREAD_RESUMED();
+         continue;
       }
-      else
-         n->m_pNext->m_pPrev = n->m_pPrev;
+
+      CTsbPdNode* n = self->m_vHeap[0];
+      uint64_t now = CTimer::getTime();
+      if (n->m_ullPlayTime > now)
+      {
+         THREAD_PAUSED();
+         CTimer::condTimedWaitUS(&self->m_WorkCond, &self->m_Lock, n->m_ullPlayTime - now);
+         THREAD_RESUMED();
+         continue;
+      }
+
+      self->remove_(n);
+      ++ n->m_iBusy;
+
+      // Let another worker take the next one, if it's due too.
+      if (!self->m_vHeap.empty() && self->m_vHeap[0]->m_ullPlayTime <= now)
+         pthread_cond_signal(&self->m_WorkCond);
+
+      CGuard::leaveCS(self->m_Lock);
+      self->check(n);
+      CGuard::enterCS(self->m_Lock);
+
+      if (-- n->m_iBusy == 0 && n->m_bRemoved)
+         pthread_cond_broadcast(&self->m_DoneCond);
    }
+   CGuard::leaveCS(self->m_Lock);
 
-   n->m_pNext = n->m_pPrev = NULL;
+   THREAD_EXIT();
+   return NULL;
 }
 
-void CRcvUList::update(const CUDT* u)
+void CTsbPdQueue::check(CTsbPdNode* n)
 {
-   CRNode* n = u->m_pRNode;
+   CUDT* u = n->m_pUDT;
 
-   if (!n->m_bOnList)
+   CGuard recvguard(u->m_RecvLock);
+   if (u->m_bClosing)
       return;
 
-   CTimer::rdtsc(n->m_llTimeStamp_tk);
+   uint64_t playtime = u->tsbpdCheck();
+   if (playtime != 0)
+      schedule(n, playtime);
+   // Otherwise the next event that would wake up the TSBPD
+   // thread schedules it, through CUDT::kickTsbPd().
+}
+
+void CTsbPdQueue::insert_(CTsbPdNode* n, uint64_t playtime)
+{
+   n->m_ullPlayTime = playtime;
+   n->m_iHeapLoc = int(m_vHeap.size());
+   m_vHeap.push_back(n);
+   siftUp_(n->m_iHeapLoc);
+
+   // an earlier event has been inserted, wake up a worker
+   if (n->m_iHeapLoc == 0)
+      pthread_cond_signal(&m_WorkCond);
+}
 
-   // if n is the last node, do not need to change
-   if (NULL == n->m_pNext)
+void CTsbPdQueue::remove_(CTsbPdNode* n)
+{
+   int q = n->m_iHeapLoc;
+   if (q < 0)
+      return;
+
+   CTsbPdNode* last = m_vHeap.back();
+   m_vHeap.pop_back();
+   n->m_iHeapLoc = -1;
+   if (last == n)
       return;
 
-   if (NULL == n->m_pPrev)
+   // The last one takes the place, then goes wherever it belongs.
+   m_vHeap[q] = last;
+   last->m_iHeapLoc = q;
+   siftUp_(q);
+   siftDown_(last->m_iHeapLoc);
+}
+
+void CTsbPdQueue::siftUp_(int q)
+{
+   while (q > 0)
    {
-      m_pUList = n->m_pNext;
-      m_pUList->m_pPrev = NULL;
+      int p = (q - 1) >> 1;
+      if (m_vHeap[p]->m_ullPlayTime <= m_vHeap[q]->m_ullPlayTime)
+         break;
+
+      std::swap(m_vHeap[p], m_vHeap[q]);
+      m_vHeap[p]->m_iHeapLoc = p;
+      m_vHeap[q]->m_iHeapLoc = q;
+      q = p;
    }
-   else
+}
+
+void CTsbPdQueue::siftDown_(int q)
+{
+   int last = int(m_vHeap.size()) - 1;
+   for (;;)
    {
-      n->m_pPrev->m_pNext = n->m_pNext;
-      n->m_pNext->m_pPrev = n->m_pPrev;
-   }
+      int p = q * 2 + 1;
+      if (p > last)
+         break;
+      if (p + 1 <= last && m_vHeap[p + 1]->m_ullPlayTime < m_vHeap[p]->m_ullPlayTime)
+         ++ p;
+      if (m_vHeap[q]->m_ullPlayTime <= m_vHeap[p]->m_ullPlayTime)
+         break;
 
-   n->m_pPrev = m_pLast;
-   n->m_pNext = NULL;
-   m_pLast->m_pNext = n;
-   m_pLast = n;
+      std::swap(m_vHeap[p], m_vHeap[q]);
+      m_vHeap[p]->m_iHeapLoc = p;
+      m_vHeap[q]->m_iHeapLoc = q;
+      q = p;
+   }
 }
 
 //
@@ -828,6 +1393,12 @@ void CRendezvousQueue::insert(const SRTSOCKET& id, CUDT* u, int ipv, const socka
    m_lRendezvousID.push_back(r);
 }
 
+bool CRendezvousQueue::empty()
+{
+   CGuard vg(m_RIDVectorLock);
+   return m_lRendezvousID.empty();
+}
+
 void CRendezvousQueue::remove(const SRTSOCKET& id, bool should_lock)
 {
    CGuard vg(m_RIDVectorLock, should_lock);
@@ -998,13 +1569,25 @@ void CRendezvousQueue::updateConnStatus(EReadStatus rst, EConnectStatus cst, con
 CRcvQueue::CRcvQueue():
     m_WorkerThread(),
     m_UnitQueue(),
-    m_pRcvUList(NULL),
+    m_pTimerWheel(NULL),
     m_pHash(NULL),
     m_pChannel(NULL),
     m_pTimer(NULL),
     m_iPayloadSize(),
+    m_iRcvBatch(1),
+    m_vBatchUnits(),
+    m_vBatchPackets(),
+    m_pBatchAddr(NULL),
+    m_iBatchCount(0),
+    m_iBatchPos(0),
+    m_vPostedUnits(),
+    m_pPostedAddr(NULL),
+    m_vReapedSlots(),
+    m_ullRcvCalls(0),
+    m_ullRcvPackets(0),
     m_bClosing(false),
     m_ExitCond(),
+    m_iWorkerStart(0),
     m_LSLock(),
     m_pListener(NULL),
     m_pRendezvousQueue(NULL),
@@ -1015,7 +1598,7 @@ CRcvQueue::CRcvQueue():
     m_PassCond()
 {
     pthread_mutex_init(&m_PassLock, NULL);
-    pthread_cond_init(&m_PassCond, NULL);
+    CGuard::createCond(m_PassCond);
     pthread_mutex_init(&m_LSLock, NULL);
     pthread_mutex_init(&m_IDLock, NULL);
 }
@@ -1023,16 +1606,20 @@ CRcvQueue::CRcvQueue():
 CRcvQueue::~CRcvQueue()
 {
     m_bClosing = true;
-	if (!pthread_equal(m_WorkerThread, pthread_t()))
+    if (m_pChannel)
+        m_pChannel->interrupt();
+    if (!pthread_equal(m_WorkerThread, pthread_t()))
         pthread_join(m_WorkerThread, NULL);
     pthread_mutex_destroy(&m_PassLock);
     pthread_cond_destroy(&m_PassCond);
     pthread_mutex_destroy(&m_LSLock);
     pthread_mutex_destroy(&m_IDLock);
 
-    delete m_pRcvUList;
+    delete m_pTimerWheel;
     delete m_pHash;
     delete m_pRendezvousQueue;
+    delete [] m_pBatchAddr;
+    delete [] m_pPostedAddr;
 
     // remove all queued messages
     for (map<int32_t, std::queue<CPacket*> >::iterator i = m_mBuffer.begin(); i != m_mBuffer.end(); ++ i)
@@ -1047,11 +1634,42 @@ CRcvQueue::~CRcvQueue()
     }
 }
 
-void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* cc, CTimer* t)
+void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* cc, CTimer* t, int rcvbatch, bool hugepages)
 {
     m_iPayloadSize = payload;
 
-    m_UnitQueue.init(qsize, payload, version);
+    m_iRcvBatch = rcvbatch;
+
+    // Every GRO datagram is split into units, so the batch must be able
+    // to hold the largest one. Shorter payloads than the maximum are
+    // coalesced into more segments, up to the kernel's limit.
+    if (cc->getGRO())
+    {
+        m_iRcvBatch = std::min(std::max(m_iRcvBatch, int(CChannel::MAX_GRO_SEGMENTS)), CChannel::MAX_BATCH);
+    }
+
+    // With io_uring there's a receive pending on every slot all the time,
+    // so have enough of them to absorb a burst between two reaps.
+    if (cc->getIoUring())
+    {
+        m_iRcvBatch = std::min(std::max(m_iRcvBatch, 32), CChannel::MAX_BATCH);
+        m_vPostedUnits.resize(m_iRcvBatch);
+        m_vReapedSlots.resize(m_iRcvBatch);
+        m_pPostedAddr = new sockaddr_any[m_iRcvBatch];
+        for (int i = 0; i < m_iRcvBatch; ++ i)
+            m_pPostedAddr[i] = sockaddr_any(version);
+    }
+
+    if (m_iRcvBatch > 1)
+    {
+        m_vBatchUnits.resize(m_iRcvBatch);
+        m_vBatchPackets.resize(m_iRcvBatch);
+        m_pBatchAddr = new sockaddr_any[m_iRcvBatch];
+        for (int i = 0; i < m_iRcvBatch; ++ i)
+            m_pBatchAddr[i] = sockaddr_any(version);
+    }
+
+    m_UnitQueue.init(qsize, payload, version, hugepages);
 
     m_pHash = new CHash;
     m_pHash->init(hsize);
@@ -1059,15 +1677,28 @@ void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* c
     m_pChannel = cc;
     m_pTimer = t;
 
-    m_pRcvUList = new CRcvUList;
+    m_pTimerWheel = new CTimerWheel;
     m_pRendezvousQueue = new CRendezvousQueue;
 
     ThreadName tn("SRT:RcvQ:worker");
-    if (0 != pthread_create(&m_WorkerThread, NULL, CRcvQueue::worker, this))
+    if (0 != CThreadConfig::create(&m_WorkerThread, SRT_THREAD_RCVQ, CRcvQueue::worker, this))
     {
 		m_WorkerThread = pthread_t();
         throw CUDTException(MJ_SYSTEMRES, MN_THREAD);
     }
+
+    // The units are made by the worker (see CUnitQueue::prefault()); without
+    // them the multiplexer can't receive anything, so it must not be used.
+    CGuard passguard(m_PassLock);
+    while (m_iWorkerStart == 0)
+        pthread_cond_wait(&m_PassCond, &m_PassLock);
+    if (m_iWorkerStart == -1)
+    {
+        passguard.forceUnlock();
+        pthread_join(m_WorkerThread, NULL);
+        m_WorkerThread = pthread_t();
+        throw CUDTException(MJ_SYSTEMRES, MN_MEMORY, 0);
+    }
 }
 
 void* CRcvQueue::worker(void* param)
@@ -1078,6 +1709,19 @@ void* CRcvQueue::worker(void* param)
 
    THREAD_STATE_INIT("SRT:RcvQ:worker");
 
+   int prefaulted = self->m_UnitQueue.prefault() == -1 ? -1 : 1;
+   {
+      CGuard passguard(self->m_PassLock);
+      self->m_iWorkerStart = prefaulted;
+      pthread_cond_broadcast(&self->m_PassCond);
+   }
+   if (prefaulted == -1)
+   {
+      LOGC(mglog.Fatal, log << "SRT:RcvQ:worker: no memory for the receiver units");
+      THREAD_EXIT();
+      return NULL;
+   }
+
    CUnit* unit = 0;
    EConnectStatus cst = CONN_AGAIN;
    while (!self->m_bClosing)
@@ -1141,27 +1785,24 @@ void* CRcvQueue::worker(void* param)
        uint64_t currtime_tk;
        CTimer::rdtsc(currtime_tk);
 
-       CRNode* ul = self->m_pRcvUList->m_pUList;
-       uint64_t ctime_tk = currtime_tk - 100000 * CTimer::getCPUFrequency();
-       while ((NULL != ul) && (ul->m_llTimeStamp_tk < ctime_tk))
+       self->m_vExpired.clear();
+       self->m_pTimerWheel->expire(currtime_tk, self->m_vExpired);
+       for (vector<CUDT*>::iterator i = self->m_vExpired.begin(); i != self->m_vExpired.end(); ++ i)
        {
-           CUDT* u = ul->m_pUDT;
+           CUDT* u = *i;
 
            if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
            {
                u->checkTimers();
-               self->m_pRcvUList->update(u);
+               self->m_pTimerWheel->schedule(u, u->getNextCheckTime_tk());
            }
            else
            {
                HLOGC(mglog.Debug, log << CUDTUnited::CONID(u->m_SocketID) << " SOCKET broken, REMOVING FROM RCV QUEUE/MAP.");
-               // the socket must be removed from Hash table first, then RcvUList
+               // the socket is already out of the wheel, now remove it from the Hash table
                self->m_pHash->remove(u->m_SocketID);
-               self->m_pRcvUList->remove(u);
                u->m_pRNode->m_bOnList = false;
            }
-
-           ul = self->m_pRcvUList->m_pUList;
        }
 
        if ( have_received )
@@ -1178,6 +1819,15 @@ void* CRcvQueue::worker(void* param)
        // CUDT::processConnectResponse 
        self->m_pRendezvousQueue->updateConnStatus(rst, cst, unit->m_Packet);
 
+       // Nothing more to read now. Sleep until something arrives,
+       // some timer is due or the queue is interrupted.
+       if (rst == RST_AGAIN && !self->m_bClosing)
+       {
+           THREAD_PAUSED();
+           self->m_pChannel->waitRead(self->worker_WaitTime());
+           THREAD_RESUMED();
+       }
+
        // XXX updateConnStatus may have removed the connector from the list,
        // however there's still m_mBuffer in CRcvQueue for that socket to care about.
    }
@@ -1186,6 +1836,32 @@ void* CRcvQueue::worker(void* param)
    return NULL;
 }
 
+// The time until the worker has to run the timers next time, in microseconds,
+// or -1 if there's nothing to do until a packet comes or it's interrupted.
+int64_t CRcvQueue::worker_WaitTime()
+{
+    // The connecting sockets are checked on every round.
+    if (!m_pRendezvousQueue->empty())
+        return CUDT::COMM_SYN_INTERVAL_US;
+
+    // Free units appear when the application reads; this isn't
+    // signaled, so don't wait long for them with no receive pending.
+    if (m_pChannel->getIoUring()
+            && std::count(m_vPostedUnits.begin(), m_vPostedUnits.end(), (CUnit*)NULL) == int(m_vPostedUnits.size()))
+        return CUDT::COMM_SYN_INTERVAL_US;
+
+    uint64_t next_tk = m_pTimerWheel->getNextTime_tk();
+    if (next_tk == 0)
+        return -1;
+
+    uint64_t currtime_tk;
+    CTimer::rdtsc(currtime_tk);
+    if (next_tk <= currtime_tk)
+        return 0;
+
+    return (next_tk - currtime_tk) / CTimer::getCPUFrequency();
+}
+
 #if ENABLE_LOGGING
 static string PacketInfo(const CPacket& pkt)
 {
@@ -1211,10 +1887,6 @@ static string PacketInfo(const CPacket& pkt)
 
 EReadStatus CRcvQueue::worker_RetrieveUnit(ref_t<int32_t> r_id, ref_t<CUnit*> r_unit, sockaddr* addr)
 {
-#ifdef NO_BUSY_WAITING
-    m_pTimer->tick();
-#endif
-
     // check waiting list, if new socket, insert it to the list
     while (ifNewEntry())
     {
@@ -1222,10 +1894,26 @@ EReadStatus CRcvQueue::worker_RetrieveUnit(ref_t<int32_t> r_id, ref_t<CUnit*> r_
         if (ne)
         {
             HLOGC(mglog.Debug, log << CUDTUnited::CONID(ne->m_SocketID) << " SOCKET pending for connection - ADDING TO RCV QUEUE/MAP");
-            m_pRcvUList->insert(ne);
+            m_pTimerWheel->schedule(ne, 0);
             m_pHash->insert(ne->m_SocketID, ne);
         }
     }
+
+    // Dispatch what has remained from the last batched read first.
+    if (m_iBatchPos < m_iBatchCount)
+        return worker_NextBatchUnit(r_id, r_unit, addr);
+
+    if (m_pChannel->getIoUring())
+        return worker_RetrievePosted(r_id, r_unit, addr);
+
+    if (m_iRcvBatch > 1)
+    {
+        int navail = m_UnitQueue.getNextAvailUnits(&m_vBatchUnits[0], m_iRcvBatch);
+        if (navail > 0)
+            return worker_RetrieveBatch(navail, r_id, r_unit, addr);
+        // Otherwise fall back to the procedure below, which drops the packet.
+    }
+
     // find next available slot for incoming packet
     *r_unit = m_UnitQueue.getNextAvailUnit();
     if (!*r_unit)
@@ -1256,12 +1944,129 @@ EReadStatus CRcvQueue::worker_RetrieveUnit(ref_t<int32_t> r_id, ref_t<CUnit*> r_
 
     if (rst == RST_OK)
     {
+        ++ m_ullRcvCalls;
+        ++ m_ullRcvPackets;
         *r_id = r_unit->m_Packet.m_iID;
         HLOGC(mglog.Debug, log << "INCOMING PACKET: BOUND=" << SockaddrToString(m_pChannel->bindAddress()) << " " << PacketInfo(r_unit->m_Packet));
     }
     return rst;
 }
 
+EReadStatus CRcvQueue::worker_RetrieveBatch(int navail, ref_t<int32_t> r_id, ref_t<CUnit*> r_unit, sockaddr* addr)
+{
+    for (int i = 0; i < navail; ++ i)
+    {
+        m_vBatchUnits[i]->m_Packet.setLength(m_iPayloadSize);
+        m_vBatchPackets[i] = &m_vBatchUnits[i]->m_Packet;
+    }
+
+    // The units stay FREE until they are dispatched, which happens before
+    // the next call to CUnitQueue::getNextAvailUnits.
+    int count = 0;
+    THREAD_PAUSED();
+    EReadStatus rst = m_pChannel->recvfrom(m_pBatchAddr, &m_vBatchPackets[0], navail, Ref(count));
+    THREAD_RESUMED();
+
+    // Leave the first unit as the "current" one, so that it can be
+    // referred to also when nothing was read.
+    *r_unit = m_vBatchUnits[0];
+    if (rst != RST_OK)
+        return rst;
+
+    ++ m_ullRcvCalls;
+    m_ullRcvPackets += count;
+
+    HLOGC(mglog.Debug, log << "INCOMING BATCH: BOUND=" << SockaddrToString(m_pChannel->bindAddress()) << " packets=" << count << "/" << navail);
+
+    m_iBatchPos = 0;
+    m_iBatchCount = count;
+    return worker_NextBatchUnit(r_id, r_unit, addr);
+}
+
+EReadStatus CRcvQueue::worker_NextBatchUnit(ref_t<int32_t> r_id, ref_t<CUnit*> r_unit, sockaddr* addr)
+{
+    while (m_iBatchPos < m_iBatchCount)
+    {
+        int pos = m_iBatchPos ++;
+        CUnit* u = m_vBatchUnits[pos];
+        *r_unit = u;
+
+        // Packets rejected by CChannel have length -1.
+        if (u->m_Packet.getLength() == size_t(-1))
+            continue;
+
+        memcpy(addr, m_pBatchAddr[pos].get(), m_pBatchAddr[pos].size());
+        *r_id = u->m_Packet.m_iID;
+        HLOGC(mglog.Debug, log << "INCOMING PACKET: BOUND=" << SockaddrToString(m_pChannel->bindAddress()) << " " << PacketInfo(u->m_Packet));
+        return RST_OK;
+    }
+
+    return RST_AGAIN;
+}
+
+EReadStatus CRcvQueue::worker_RetrievePosted(ref_t<int32_t> r_id, ref_t<CUnit*> r_unit, sockaddr* addr)
+{
+    // Keep a receive pending on every slot. A unit in use by the kernel
+    // is marked GOOD, so that nobody else takes it in the meantime.
+    for (int i = 0; i < m_iRcvBatch; ++ i)
+    {
+        if (m_vPostedUnits[i])
+            continue;
+
+        CUnit* u = m_UnitQueue.getNextAvailUnit();
+        if (!u)
+            break; // Storage depleted; the datagrams wait in the system buffer.
+
+        u->m_Packet.setLength(m_iPayloadSize);
+        if (!m_pChannel->postRecv(i, m_pPostedAddr + i, &u->m_Packet))
+            break;
+
+        u->m_iFlag = CUnit::GOOD;
+        ++ m_UnitQueue.m_iCount;
+        m_vPostedUnits[i] = u;
+    }
+
+    int count = 0;
+    THREAD_PAUSED();
+    EReadStatus rst = m_pChannel->reapRecv(&m_vReapedSlots[0], m_iRcvBatch, Ref(count));
+    THREAD_RESUMED();
+
+    // The completed units become FREE again and are dispatched as a batch,
+    // the same way as those read by worker_RetrieveBatch.
+    for (int i = 0; i < count; ++ i)
+    {
+        int slot = m_vReapedSlots[i];
+        CUnit* u = m_vPostedUnits[slot];
+        m_vPostedUnits[slot] = NULL;
+        u->m_iFlag = CUnit::FREE;
+        -- m_UnitQueue.m_iCount;
+        m_vBatchUnits[i] = u;
+        m_pBatchAddr[i] = m_pPostedAddr[slot];
+    }
+
+    // Leave some unit as the "current" one, as worker_RetrieveBatch does.
+    *r_unit = m_vBatchUnits[0] ? m_vBatchUnits[0] : m_vPostedUnits[0];
+    if (rst != RST_OK)
+        return rst;
+
+    ++ m_ullRcvCalls;
+    m_ullRcvPackets += count;
+
+    HLOGC(mglog.Debug, log << "INCOMING BATCH (io_uring): BOUND=" << SockaddrToString(m_pChannel->bindAddress()) << " packets=" << count);
+
+    m_iBatchPos = 0;
+    m_iBatchCount = count;
+    return worker_NextBatchUnit(r_id, r_unit, addr);
+}
+
+double CRcvQueue::getRcvBatchAvg() const
+{
+    uint64_t calls = m_ullRcvCalls;
+    if (calls == 0)
+        return 0;
+    return double(m_ullRcvPackets) / calls;
+}
+
 EConnectStatus CRcvQueue::worker_ProcessConnectionRequest(CUnit* unit, const sockaddr* addr)
 {
     HLOGC(mglog.Debug, log << "Got sockID=0 from " << SockaddrToString(addr) << " - trying to resolve it as a connection request...");
@@ -1276,7 +2081,7 @@ EConnectStatus CRcvQueue::worker_ProcessConnectionRequest(CUnit* unit, const soc
         if (m_pListener)
         {
             LOGC(mglog.Note, log << "PASSING request from: " << SockaddrToString(addr) << " to agent:" << m_pListener->socketID());
-            listener_ret = m_pListener->processConnectRequest(addr, unit->m_Packet);
+            listener_ret = m_pListener->processConnectRequest(addr, unit->m_Packet, this);
             // XXX This returns some very significant return value, which
             // is completely ignored here.
             // Actually this is the only place in the code where this
@@ -1356,7 +2161,7 @@ EConnectStatus CRcvQueue::worker_ProcessAddressedPacket(int32_t id, CUnit* unit,
         u->processData(unit);
 
     u->checkTimers();
-    m_pRcvUList->update(u);
+    m_pTimerWheel->schedule(u, u->getNextCheckTime_tk());
 
     return CONN_CONTINUE;
 }
@@ -1430,7 +2235,7 @@ EConnectStatus CRcvQueue::worker_TryAsyncRend_OrStore(int32_t id, CUnit* unit, c
             if (ne)
             {
                 HLOGC(mglog.Debug, log << CUDTUnited::CONID(ne->m_SocketID) << " SOCKET pending for connection - ADDING TO RCV QUEUE/MAP");
-                m_pRcvUList->insert(ne);
+                m_pTimerWheel->schedule(ne, 0);
                 m_pHash->insert(ne->m_SocketID, ne);
 
                 // The current situation is that this has passed processAsyncConnectResponse, but actually
@@ -1545,6 +2350,9 @@ void CRcvQueue::registerConnector(const SRTSOCKET& id, CUDT* u, int ipv, const s
 {
    HLOGC(mglog.Debug, log << "registerConnector: adding %" << id << " addr=" << SockaddrToString(addr) << " TTL=" << ttl);
    m_pRendezvousQueue->insert(id, u, ipv, addr, ttl);
+
+   // It has to start sending the requests now.
+   m_pChannel->interrupt();
 }
 
 void CRcvQueue::removeConnector(const SRTSOCKET& id, bool should_lock)
@@ -1573,6 +2381,9 @@ void CRcvQueue::setNewEntry(CUDT* u)
    HLOGC(mglog.Debug, log << CUDTUnited::CONID(u->m_SocketID) << "setting socket PENDING FOR CONNECTION");
    CGuard listguard(m_IDLock);
    m_vNewEntry.push_back(u);
+
+   // Let the worker add it to the lists and count its timers in.
+   m_pChannel->interrupt();
 }
 
 bool CRcvQueue::ifNewEntry()
@@ -59,6 +59,7 @@ modified by
 #include "packet.h"
 #include "netinet_any.h"
 #include "utilities.h"
+#include "mempool.h"
 #include <list>
 #include <map>
 #include <queue>
@@ -69,8 +70,8 @@ class CUDT;
 struct CUnit
 {
    CPacket m_Packet;		// packet
-   enum Flag { FREE = 0, GOOD = 1, PASSACK = 2, DROPPED = 3 };
-   Flag m_iFlag;			// 0: free, 1: occupied, 2: msg read but not freed (out-of-order), 3: msg dropped
+   enum Flag { FREE = 0, GOOD = 1, PASSACK = 2, DROPPED = 3, BORROWED = 4 };
+   Flag m_iFlag;			// 0: free, 1: occupied, 2: msg read but not freed (out-of-order), 3: msg dropped, 4: lent to the application
 };
 
 class CUnitQueue
@@ -88,9 +89,19 @@ public:
       /// @param [in] size queue size
       /// @param [in] mss maximum segment size
       /// @param [in] version IP version
+      /// @param [in] hugepages keep the units in huge pages, in parts of at
+      /// least a huge page; the first part is then made by prefault().
       /// @return 0: success, -1: failure.
 
-   int init(int size, int mss, int version);
+   int init(int size, int mss, int version, bool hugepages = false);
+
+      /// Make the first part of the units with huge pages, and touch all
+      /// of its memory, so that it's all in place before the first packet.
+      /// It's called by the thread that uses the units, so that the kernel
+      /// puts the memory on the NUMA node of that thread.
+      /// @return 0: success, -1: failure.
+
+   int prefault();
 
       /// Increase (double) the unit queue size.
       /// @return 0: success, -1: failure.
@@ -107,12 +118,26 @@ public:
 
    CUnit* getNextAvailUnit();
 
+      /// find up to n distinct available units for a batch of incoming packets.
+      /// @param [out] units array of at least n entries to store the units.
+      /// @param [in] n maximum number of units requested.
+      /// @return Number of units found; they stay FREE until used.
+
+   int getNextAvailUnits(CUnit** units, int n);
+
+      /// Query the memory of the units not used now.
+      /// @return size in bytes.
+
+   int64_t getFreeMem() const { return int64_t(m_iSize - m_iCount) * (m_iMSS + sizeof(CUnit)); }
+
 private:
    struct CQEntry
    {
       CUnit* m_pUnit;		// unit queue
       char* m_pBuffer;		// data buffer
       int m_iSize;		// size of each queue
+      size_t m_zMapped;		// size of the huge pages holding both, 0 if allocated with new
+      size_t m_zCharged;		// memory counted in CMemBudget
 
       CQEntry* m_pNext;
    }
@@ -120,6 +145,12 @@ private:
    *m_pCurrQueue,		// pointer to the current available queue
    *m_pLastQueue;		// pointer to the last unit queue
 
+   CQEntry* allocEntry(int size);
+   CQEntry* allocHugeEntry(int size);
+   void freeEntry(CQEntry* q);
+   void addEntry(CQEntry* q);
+   void chargeEntry(CQEntry* q);
+
    CUnit* m_pAvailUnit;         // recent available unit
 
    int m_iSize;			// total size of the unit queue, in number of packets
@@ -127,6 +158,8 @@ private:
 
    int m_iMSS;			// unit buffer size
    int m_iIPversion;		// IP version
+   bool m_bHugePages;		// units kept in huge pages
+   uint64_t m_ullRetryIncrease;	// time before which increase() doesn't try again after the memory limit
 
 private:
    CUnitQueue(const CUnitQueue&);
@@ -141,6 +174,18 @@ struct CSNode
    int m_iHeapLoc;		// location on the heap, -1 means not on the heap
 };
 
+// A message lent to the sender buffer (srt_sendmsg_zc()), and what to
+// call to give it back.
+struct CSndCompletion
+{
+   SRT_SEND_DONE_FN* m_pFn;
+   void* m_pOpaque;
+   const char* m_pcData;
+   int m_iLength;
+
+   void run() const { m_pFn(m_pOpaque, m_pcData, m_iLength); }
+};
+
 class CSndUList
 {
 friend class CSndQueue;
@@ -184,6 +229,21 @@ public:
 
    uint64_t getNextProcTime();
 
+      /// Give back the buffers of the retired zero-copy messages and the
+      /// pool blocks of the retired packets. A packet being sent may still
+      /// point into them, so they are given back by the worker only when
+      /// it's done with the current round.
+      /// @param [in,out] done the completions, taken over.
+      /// @param [in] pool where the blocks go back to.
+      /// @param [in,out] freed the blocks, taken over.
+
+   void addCompletions(std::vector<CSndCompletion>& done, CSndBlockPool* pool, std::vector<char*>& freed);
+
+      /// Run the completions and release the blocks added so far; called
+      /// by the worker between the rounds.
+
+   void runCompletions();
+
 private:
    void insert_(int64_t ts, const CUDT* u);
    void remove_(const CUDT* u);
@@ -200,6 +260,10 @@ private:
 
    CTimer* m_pTimer;
 
+   std::vector<CSndCompletion> m_vCompletions;  // to run after the current round
+   std::map<CSndBlockPool*, std::vector<char*> > m_mFreedBlocks; // to release after the current round
+   volatile bool m_bCompletions;
+
 private:
    CSndUList(const CSndUList&);
    CSndUList& operator=(const CSndUList&);
@@ -208,46 +272,141 @@ private:
 struct CRNode
 {
    CUDT* m_pUDT;                // Pointer to the instance of CUDT socket
-   uint64_t m_llTimeStamp_tk;      // Time Stamp
+   uint64_t m_llTimeStamp_tk;      // Time when the timers have to be checked next time
 
-   CRNode* m_pPrev;             // previous link
-   CRNode* m_pNext;             // next link
+   CRNode* m_pPrev;             // previous link in the wheel slot
+   CRNode* m_pNext;             // next link in the wheel slot
+   int m_iSlot;                 // the wheel slot, -1 if not scheduled
 
-   bool m_bOnList;              // if the node is already on the list
+   bool m_bOnList;              // if the socket is in the receiver queue
 };
 
-class CRcvUList
+// Hierarchical timing wheel of the sockets served by a receiver queue,
+// keyed by the time when each socket's timers (ACK, NAK, EXP, keepalive)
+// are due. Scheduling and removal are O(1), and expiration costs only
+// the due sockets, so idle sockets cost nothing until their deadline.
+//
+// The first level has one slot per tick (1ms), the next ones one slot per
+// whole round of the previous level; their contents are redistributed
+// ("cascaded") down when that time comes. Used only by the receiver worker.
+class CTimerWheel
 {
 public:
-   CRcvUList();
-   ~CRcvUList();
+   CTimerWheel();
+   ~CTimerWheel();
 
 public:
 
-      /// Insert a new UDT instance to the list.
+      /// Schedule the timer check of the UDT instance; if it's already
+      /// scheduled, it's moved. Nothing is done if it's not in the queue.
       /// @param [in] u pointer to the UDT instance
+      /// @param [in] time_tk the time of the check; never fired before it
 
-   void insert(const CUDT* u);
+   void schedule(const CUDT* u, uint64_t time_tk);
 
-      /// Remove the UDT instance from the list.
+      /// Remove the UDT instance from the wheel.
       /// @param [in] u pointer to the UDT instance
 
    void remove(const CUDT* u);
 
-      /// Move the UDT instance to the end of the list, if it already exists; otherwise, do nothing.
-      /// @param [in] u pointer to the UDT instance
+      /// Take out all the UDT instances that are due.
+      /// @param [in] currtime_tk current time
+      /// @param [out] due the instances, in the order of their deadlines
+
+   void expire(uint64_t currtime_tk, std::vector<CUDT*>& due);
+
+      /// Get the time when expire() should be called next time.
+      /// @return the time, or 0 if nothing is scheduled.
 
-   void update(const CUDT* u);
+   uint64_t getNextTime_tk() const;
+
+private:
+   static const int LEVEL0_BITS = 8;
+   static const int LEVELN_BITS = 6;
+   static const int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+   static const int LEVELN_SIZE = 1 << LEVELN_BITS;
+   static const int LEVELS = 3;
+   static const int SLOTS = LEVEL0_SIZE + (LEVELS - 1) * LEVELN_SIZE;
+   static const uint64_t RANGE = uint64_t(1) << (LEVEL0_BITS + (LEVELS - 1) * LEVELN_BITS);
+
+   void insert_(CRNode* n);
+   void unlink_(CRNode* n);
+   void cascade_(int slot);
 
+private:
+   CRNode* m_apSlots[SLOTS];     // all levels, one after another
+   uint64_t m_ullTick_tk;        // length of a tick
+   uint64_t m_ullNow;            // the next tick to expire
+   int m_iCount;                 // number of scheduled nodes
+
+private:
+   CTimerWheel(const CTimerWheel&);
+   CTimerWheel& operator=(const CTimerWheel&);
+};
+
+struct CTsbPdNode
+{
+   CUDT* m_pUDT;                // Pointer to the instance of CUDT socket
+   uint64_t m_ullPlayTime;      // time to check the socket next, 0 = as soon as possible
+
+   int m_iHeapLoc;              // location on the heap, -1 means not scheduled
+   int m_iBusy;                 // number of workers checking the socket right now
+   bool m_bRemoved;             // removed for good, never to be scheduled again
+};
+
+// Shared TSBPD delivery (SRTO_TSBPDSHARED): instead of running a TSBPD
+// thread per receiving socket, the sockets are kept on a heap ordered by
+// the time when their next packet is to be played, and a few worker
+// threads check the sockets as they become due. A check does what one
+// round of CUDT::tsbpd() does and the events that wake up that thread
+// schedule the socket for an immediate check instead.
+
+class CTsbPdQueue
+{
 public:
-   CRNode* m_pUList;		// the head node
+   CTsbPdQueue();
+   ~CTsbPdQueue();
+
+public:
+
+      /// Schedule a check of the socket, or move it earlier if it's already
+      /// scheduled. The worker threads are started on the first call.
+      /// @param [in] n the socket's node
+      /// @param [in] playtime time of the check, 0 = as soon as possible
+
+   void schedule(CTsbPdNode* n, uint64_t playtime);
+
+      /// Remove the socket for good, waiting until no worker is checking it.
+      /// Must not be called with the socket's m_RecvLock locked.
+      /// @param [in] n the socket's node
+
+   void remove(CTsbPdNode* n);
+
+      /// Stop and join the worker threads.
+
+   void stop();
 
 private:
-   CRNode* m_pLast;		// the last node
+   static void* worker(void* param);
+   void check(CTsbPdNode* n);
+   void start_();
+   void insert_(CTsbPdNode* n, uint64_t playtime);
+   void remove_(CTsbPdNode* n);
+   void siftUp_(int q);
+   void siftDown_(int q);
 
 private:
-   CRcvUList(const CRcvUList&);
-   CRcvUList& operator=(const CRcvUList&);
+   std::vector<CTsbPdNode*> m_vHeap;    // scheduled sockets, earliest on top
+   std::vector<pthread_t> m_vWorkers;
+
+   pthread_mutex_t m_Lock;
+   pthread_cond_t m_WorkCond;           // the top of the heap has changed, or stopping
+   pthread_cond_t m_DoneCond;           // a worker has finished a check
+   bool m_bClosing;
+
+private:
+   CTsbPdQueue(const CTsbPdQueue&);
+   CTsbPdQueue& operator=(const CTsbPdQueue&);
 };
 
 class CHash
@@ -314,6 +473,11 @@ public:
 
    void updateConnStatus(EReadStatus rst, EConnectStatus, const CPacket& response);
 
+      /// Check if any socket is waiting for a connection.
+      /// @return true if there are no sockets in the queue.
+
+   bool empty();
+
 private:
    struct CRL
    {
@@ -345,11 +509,24 @@ public:
    // Currently just "unimplemented".
    std::string CONID() const { return ""; }
 
+      /// Upper limit for SRTO_UDP_SNDWORKERS.
+
+   static const int MAX_WORKERS = 64;
+
       /// Initialize the sending queue.
       /// @param [in] c UDP channel to be associated to the queue
       /// @param [in] t Timer
+      /// @param [in] sndbatch max number of due packets sent in one system call
+      /// @param [in] workers number of sender worker threads
+
+   void init(CChannel* c, CTimer* t, int sndbatch = 1, int workers = 1);
 
-   void init(CChannel* c, CTimer* t);
+      /// Get the list of the worker that sends the packets of the UDT instance.
+      /// A socket always stays with the same worker, which keeps its packets in order.
+      /// @param [in] u pointer to the UDT instance
+      /// @return the list.
+
+   CSndUList* getSndUList(const CUDT* u) const;
 
       /// Send out a packet to a given address.
       /// @param [in] addr destination address
@@ -374,18 +551,45 @@ public:
    int ioctlQuery(int type) const { return m_pChannel->ioctlQuery(type); }
    int sockoptQuery(int level, int type) const { return m_pChannel->sockoptQuery(level, type); }
 
+      /// Average number of packets sent by the worker per system call so far.
+
+   double getSndBatchAvg() const;
+
+      /// Average and maximum delay of the workers' wakeups for the packets
+      /// due to be sent, in microseconds.
+
+   double getWakeupErrAvg() const;
+   double getWakeupErrMax() const;
+
 private:
+   // A sender thread with its own share of the sockets. All of them
+   // send through the same channel.
+   struct CWorker
+   {
+      CSndQueue* m_pQueue;
+      pthread_t m_Thread;
+      CSndUList* m_pSndUList;           // List of UDT instances for data sending
+      CTimer* m_pTimer;                 // the multiplexer's for the first worker, own for the others
+
+      CPacket* m_pBatchPkt;             // packets collected for the current batch
+      sockaddr** m_pBatchAddr;          // their destination addresses
+
+      uint64_t m_ullSndCalls;           // number of system calls made by the worker
+      uint64_t m_ullSndPackets;         // number of packets sent by these calls
+
+      pthread_mutex_t m_WindowLock;
+      pthread_cond_t m_WindowCond;
+   };
+
    static void* worker(void* param);
-   pthread_t m_WorkerThread;
 
 
 private:
-   CSndUList* m_pSndUList;		// List of UDT instances for data sending
+   std::vector<CWorker*> m_vWorkers;    // sender threads, the sockets are spread among them by ID
    CChannel* m_pChannel;                // The UDP channel for data sending
    CTimer* m_pTimer;			// Timing facility
 
-   pthread_mutex_t m_WindowLock;
-   pthread_cond_t m_WindowCond;
+   int m_iSndBatch;                     // max number of due packets sent in one system call
 
    volatile bool m_bClosing;		// closing the worker
    pthread_cond_t m_ExitCond;
@@ -432,8 +636,10 @@ public:
       /// @param [in] hsize hash table size
       /// @param [in] c UDP channel to be associated to the queue
       /// @param [in] t timer
+      /// @param [in] rcvbatch max number of packets read in one system call
+      /// @param [in] hugepages keep the units in huge pages (see CUnitQueue::init())
 
-   void init(int size, int payload, int version, int hsize, CChannel* c, CTimer* t);
+   void init(int size, int payload, int version, int hsize, CChannel* c, CTimer* t, int rcvbatch = 1, bool hugepages = false);
 
       /// Read a packet for a specific UDT socket id.
       /// @param [in] id Socket ID
@@ -442,11 +648,19 @@ public:
 
    int recvfrom(int32_t id, ref_t<CPacket> packet);
 
+      /// Average number of packets read per system call so far.
+
+   double getRcvBatchAvg() const;
+
 private:
    static void* worker(void* param);
    pthread_t m_WorkerThread;
    // Subroutines of worker
    EReadStatus worker_RetrieveUnit(ref_t<int32_t> id, ref_t<CUnit*> unit, sockaddr* sa);
+   EReadStatus worker_RetrieveBatch(int navail, ref_t<int32_t> id, ref_t<CUnit*> unit, sockaddr* sa);
+   EReadStatus worker_NextBatchUnit(ref_t<int32_t> id, ref_t<CUnit*> unit, sockaddr* sa);
+   EReadStatus worker_RetrievePosted(ref_t<int32_t> id, ref_t<CUnit*> unit, sockaddr* sa);
+   int64_t worker_WaitTime();
    EConnectStatus worker_ProcessConnectionRequest(CUnit* unit, const sockaddr* sa);
    EConnectStatus worker_TryAsyncRend_OrStore(int32_t id, CUnit* unit, const sockaddr* sa);
    EConnectStatus worker_ProcessAddressedPacket(int32_t id, CUnit* unit, const sockaddr* sa);
@@ -454,15 +668,30 @@ private:
 private:
    CUnitQueue m_UnitQueue;		// The received packet queue
 
-   CRcvUList* m_pRcvUList;		// List of UDT instances that will read packets from the queue
+   CTimerWheel* m_pTimerWheel;		// UDT instances that will read packets from the queue, by timer deadline
+   std::vector<CUDT*> m_vExpired;	// instances due in the wheel, reused by the worker
    CHash* m_pHash;			// Hash table for UDT socket looking up
    CChannel* m_pChannel;		// UDP channel for receving packets
    CTimer* m_pTimer;			// shared timer with the snd queue
 
    int m_iPayloadSize;                  // packet payload size
 
+   int m_iRcvBatch;                     // max number of packets read in one system call
+   std::vector<CUnit*> m_vBatchUnits;   // units reserved for the current batch
+   std::vector<CPacket*> m_vBatchPackets;
+   sockaddr_any* m_pBatchAddr;          // source addresses of the batch
+   int m_iBatchCount;                   // number of units filled by the last batched read
+   int m_iBatchPos;                     // next unit of the batch to be dispatched
+   std::vector<CUnit*> m_vPostedUnits;  // units with a receive pending on the io_uring, by slot
+   sockaddr_any* m_pPostedAddr;         // their source addresses
+   std::vector<int> m_vReapedSlots;     // slots completed by the last reap
+
+   uint64_t m_ullRcvCalls;              // number of system calls that delivered packets
+   uint64_t m_ullRcvPackets;            // number of packets delivered by these calls
+
    volatile bool m_bClosing;            // closing the worker
    pthread_cond_t m_ExitCond;
+   int m_iWorkerStart;                  // the worker's prefault() (under m_PassLock): 0 not yet, 1 done, -1 failed
 
 private:
    int setListener(CUDT* u);
@@ -508,6 +737,17 @@ struct CMultiplexer
    int m_iIpToS;
 #endif
    int m_iMSS;			// Maximum Segment Size
+   int m_iRcvBatch;		// Max number of packets read in one system call
+   int m_iSndBatch;		// Max number of packets sent in one system call
+   int m_iSndWorkers;		// Number of sender threads
+   int m_iSndSpin;		// Spin threshold of the sender timers, in microseconds
+   bool m_bGSO;			// UDP GSO for batched sending
+   bool m_bGRO;			// UDP GRO for batched reading
+   bool m_bIoUring;		// io_uring channel backend
+   bool m_bRcvTimestamp;	// kernel receive timestamps
+   bool m_bRcvHugePages;	// receiver units in huge pages
+   bool m_bInproc;		// in-process port instead of a UDP socket
+   std::string m_sImpair;	// impairment of the incoming packets
    int m_iRefCount;		// number of UDT instances that are associated with this multiplexer
    bool m_bReusable;		// if this one can be shared with others
 
@@ -178,7 +178,20 @@ typedef enum SRT_SOCKOPT {
     SRTO_PAYLOADSIZE,
     SRTO_TRANSTYPE,         // Transmission type (set of options required for given transmission type)
     SRTO_KMREFRESHRATE,
-    SRTO_KMPREANNOUNCE
+    SRTO_KMPREANNOUNCE,
+    SRTO_UDP_RCVBATCH,      // Max number of UDP datagrams read by the multiplexer in one system call (1 = no batching)
+    SRTO_UDP_SNDBATCH,      // Max number of due UDP datagrams sent by the multiplexer in one system call (1 = no batching)
+    SRTO_UDP_GSO,           // Use UDP GSO (Linux UDP_SEGMENT) for batches of packets to the same peer
+    SRTO_UDP_GRO,           // Accept coalesced UDP GRO datagrams (Linux UDP_GRO) and split them into packets
+    SRTO_UDP_IOURING,       // Use io_uring (Linux) for receiving and batched sending in the multiplexer
+    SRTO_UDP_SHARDS,        // Number of SO_REUSEPORT multiplexers (threads) opened for a listener's port
+    SRTO_UDP_RCVTIMESTAMP,  // Take the packet arrival time from the kernel (Linux SO_TIMESTAMPNS)
+    SRTO_UDP_IMPAIR,        // Network impairment applied to the incoming packets, for testing (string, key=value,...)
+    SRTO_TSBPDSHARED,       // Deliver the received packets on time by the shared TSBPD workers instead of a thread per socket
+    SRTO_UDP_SNDWORKERS,    // Number of sender threads of the multiplexer, each serving its share of the sockets
+    SRTO_UDP_SNDSPIN,       // Time in microseconds before a packet is due when the sender stops sleeping and spins
+    SRTO_RCVBORROWMAX,      // Max number of received packets the application may hold with srt_recvmsg_borrow
+    SRTO_UDP_RCVHUGEPAGES   // Keep the multiplexer's receiver units in huge pages, on the NUMA node of its receiving thread
 } SRT_SOCKOPT;
 
 // DEPRECATED OPTIONS:
@@ -320,6 +333,15 @@ struct CBytePerfMon
    int     byteRcvBuf;                  // Undelivered bytes of UDT receiver
    int     msRcvBuf;                    // Undelivered timespan (msec) of UDT receiver
    int     msRcvTsbPdDelay;             // Timestamp-based Packet Delivery Delay
+
+   double  pktRcvBatchAvg;              // Average number of UDP datagrams read per system call by the multiplexer
+   double  pktSndBatchAvg;              // Average number of UDP datagrams sent per system call by the multiplexer
+   double  usSndWakeupErrAvg;           // Average delay of the multiplexer's sender after the time a packet is due, in microseconds
+   double  usSndWakeupErrMax;           // Maximum of that delay, in microseconds
+   int     pktRcvBufCapacity;           // Current size of the receiver buffer, which grows up to SRTO_RCVBUF as needed
+   int     pktRcvBufHighWater;          // Most packets held in the receiver buffer at once, including those not acknowledged yet
+   int64_t byteBufMem;                  // Memory held by the buffers of this socket, counted in the limit of srt_setmemlimit()
+   int     pktRcvShedTotal;             // Packets dropped on arrival to keep the memory of the receivers under that limit
    //<
 };
 
@@ -515,6 +537,44 @@ static const int SRT_ERROR = -1;
 SRT_API extern int srt_startup(void);
 SRT_API extern int srt_cleanup(void);
 
+// Placement of the SRT internal threads. The settings apply to the threads
+// started after they are made, so the SRT:GC thread is only affected if they
+// are made before srt_startup().
+typedef enum SRT_THREAD_CLASS
+{
+    SRT_THREAD_SNDQ = 0, // SRT:SndQ:worker, sending for a multiplexer
+    SRT_THREAD_RCVQ,     // SRT:RcvQ:worker, receiving for a multiplexer
+    SRT_THREAD_TSBPD,    // SRT:TsbPd, per socket or shared (SRTO_TSBPDSHARED)
+    SRT_THREAD_GC,       // SRT:GC, closing the sockets
+    SRT_THREAD_E_SIZE
+} SRT_THREAD_CLASS;
+
+// Called in a new internal thread, before it starts its work.
+typedef void SRT_THREAD_HOOK_FN(void* opaque, SRT_THREAD_CLASS tclass, const char* name);
+
+// Pin the threads of the class to the given CPUs (Linux only); no CPUs clears it.
+SRT_API extern int srt_setthreadaffinity(SRT_THREAD_CLASS tclass, const int* cpus, int ncpus);
+// Run the threads of the class with SCHED_OTHER, SCHED_FIFO or SCHED_RR and the priority.
+SRT_API extern int srt_setthreadsched(SRT_THREAD_CLASS tclass, int policy, int priority);
+SRT_API extern void srt_setthreadhook(void* opaque, SRT_THREAD_HOOK_FN* hook);
+
+// The memory for the data in the sender buffers of all sockets comes from a
+// shared pool. Limit it to maxbytes (0 for no limit) and back it with huge
+// pages. Sending waits (or fails with SRT_EASYNCSND) when it's exhausted.
+SRT_API extern int srt_setsndbufpool(int64_t maxbytes, int hugepages);
+
+// Limit the memory of the buffers of all sockets together to maxbytes (0 for
+// no limit). Sending waits (or fails with SRT_EASYNCSND) when it's reached,
+// and the receivers holding more than their share drop the packets they
+// don't need right away. srt_getmemused() tells how much is used now.
+SRT_API extern int srt_setmemlimit(int64_t maxbytes);
+SRT_API extern int64_t srt_getmemused(void);
+
+// Binding to this IPv4 address (or connecting to it) uses an in-process
+// port instead of a UDP socket: packets go directly between the sockets
+// of the same process.
+#define SRT_INPROC_ADDR "0.0.0.1"
+
 // socket operations
 SRT_API extern SRTSOCKET srt_socket(int af, int type, int protocol);
 SRT_API extern SRTSOCKET srt_create_socket();
@@ -570,11 +630,33 @@ SRT_API extern const SRT_MSGCTRL srt_msgctrl_default;
 // compat applications that pass useless 0 there are fixed, this will be
 // removed.
 
+// A piece of a message, for the functions taking the data in several pieces.
+typedef struct SRT_SEGMENT
+{
+    char* data;
+    int len;
+} SRT_SEGMENT;
+
 // Sending
 SRT_API extern int srt_send(SRTSOCKET u, const char* buf, int len);
 SRT_API extern int srt_sendmsg(SRTSOCKET u, const char* buf, int len, int ttl/* = -1*/, int inorder/* = false*/);
 SRT_API extern int srt_sendmsg2(SRTSOCKET u, const char* buf, int len, SRT_MSGCTRL *mctrl);
 
+// Scatter/gather: like srt_sendmsg2, but the data are taken from the segments
+// in turn, as if they were one buffer of their total size.
+SRT_API extern int srt_sendmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, SRT_MSGCTRL *mctrl);
+
+// Zero-copy: the message isn't copied, the packets are sent from the buffer
+// itself. The buffer must stay unchanged until SRT gives it back by calling
+// done(opaque, buf, len), once the last packet is acknowledged or dropped.
+// This is called in an SRT internal thread and must not block. Unless the
+// function returns len (the message is accepted), done isn't called. Message
+// API only; if the connection is encrypted, the message is copied and done is
+// called before this function returns.
+typedef void SRT_SEND_DONE_FN(void* opaque, const char* buf, int len);
+SRT_API extern int srt_sendmsg_zc(SRTSOCKET u, const char* buf, int len, SRT_MSGCTRL *mctrl,
+        SRT_SEND_DONE_FN* done, void* opaque);
+
 // Receiving
 SRT_API extern int srt_recv(SRTSOCKET u, char* buf, int len);
 
@@ -582,6 +664,27 @@ SRT_API extern int srt_recv(SRTSOCKET u, char* buf, int len);
 SRT_API extern int srt_recvmsg(SRTSOCKET u, char* buf, int len);
 SRT_API extern int srt_recvmsg2(SRTSOCKET u, char *buf, int len, SRT_MSGCTRL *mctrl);
 
+// Scatter/gather: like srt_recvmsg2, but the message is written into the
+// segments in turn, as if they were one buffer of their total size.
+// Message API only.
+SRT_API extern int srt_recvmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, SRT_MSGCTRL *mctrl);
+
+// Zero-copy: the next message is lent to the application as it lies in the
+// receiver buffer, one segment per packet, instead of being copied out. The
+// data are read-only and stay valid until srt_recvmsg_release is called for
+// them, or until the socket is closed. Message API only.
+typedef struct SRT_BORROWED
+{
+    void* handle;                 // for SRT internal use
+    const SRT_SEGMENT* segments;  // the message, in order
+    int nsegments;
+    int len;                      // total size of the message
+    SRT_MSGCTRL mctrl;
+} SRT_BORROWED;
+
+SRT_API extern int srt_recvmsg_borrow(SRTSOCKET u, SRT_BORROWED* msg);
+SRT_API extern int srt_recvmsg_release(SRTSOCKET u, SRT_BORROWED* msg);
+
 
 // Special send/receive functions for files only.
 #define SRT_DEFAULT_SENDFILE_BLOCK 364000
@@ -31,6 +31,40 @@ extern "C" {
 int srt_startup() { return CUDT::startup(); }
 int srt_cleanup() { return CUDT::cleanup(); }
 
+int srt_setthreadaffinity(SRT_THREAD_CLASS tclass, const int* cpus, int ncpus)
+{
+    if (!CThreadConfig::setAffinity(tclass, cpus, ncpus))
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+    return 0;
+}
+
+int srt_setthreadsched(SRT_THREAD_CLASS tclass, int policy, int priority)
+{
+    if (!CThreadConfig::setScheduling(tclass, policy, priority))
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+    return 0;
+}
+
+void srt_setthreadhook(void* opaque, SRT_THREAD_HOOK_FN* hook) { CThreadConfig::setHook(opaque, hook); }
+
+int srt_setsndbufpool(int64_t maxbytes, int hugepages)
+{
+    if (maxbytes < 0)
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+    CSndBlockPool::configure(maxbytes, hugepages != 0);
+    return 0;
+}
+
+int srt_setmemlimit(int64_t maxbytes)
+{
+    if (maxbytes < 0)
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+    CMemBudget::setLimit(maxbytes);
+    return 0;
+}
+
+int64_t srt_getmemused() { return CMemBudget::getUsed(); }
+
 SRTSOCKET srt_socket(int af, int type, int protocol) { return CUDT::socket(af, type, protocol); }
 SRTSOCKET srt_create_socket()
 {
@@ -160,6 +194,30 @@ int srt_sendmsg2(SRTSOCKET u, const char * buf, int len, SRT_MSGCTRL *mctrl)
     return CUDT::sendmsg2(u, buf, len, Ref(mignore));
 }
 
+int srt_sendmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, SRT_MSGCTRL *mctrl)
+{
+    if (mctrl)
+        return CUDT::sendmsgv(u, segs, nsegs, Ref(*mctrl));
+    SRT_MSGCTRL mignore = srt_msgctrl_default;
+    return CUDT::sendmsgv(u, segs, nsegs, Ref(mignore));
+}
+
+int srt_sendmsg_zc(SRTSOCKET u, const char* buf, int len, SRT_MSGCTRL *mctrl,
+        SRT_SEND_DONE_FN* done, void* opaque)
+{
+    if (!done)
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+
+    CSndCompletion c;
+    c.m_pFn = done;
+    c.m_pOpaque = opaque;
+    c.m_pcData = buf;
+    c.m_iLength = len;
+
+    SRT_MSGCTRL mignore = srt_msgctrl_default;
+    return CUDT::sendmsg2(u, buf, len, Ref(mctrl ? *mctrl : mignore), &c);
+}
+
 int srt_recvmsg2(SRTSOCKET u, char * buf, int len, SRT_MSGCTRL *mctrl)
 {
     if (mctrl)
@@ -168,6 +226,28 @@ int srt_recvmsg2(SRTSOCKET u, char * buf, int len, SRT_MSGCTRL *mctrl)
     return CUDT::recvmsg2(u, buf, len, Ref(mignore));
 }
 
+int srt_recvmsgv(SRTSOCKET u, const SRT_SEGMENT* segs, int nsegs, SRT_MSGCTRL *mctrl)
+{
+    if (mctrl)
+        return CUDT::recvmsgv(u, segs, nsegs, Ref(*mctrl));
+    SRT_MSGCTRL mignore = srt_msgctrl_default;
+    return CUDT::recvmsgv(u, segs, nsegs, Ref(mignore));
+}
+
+int srt_recvmsg_borrow(SRTSOCKET u, SRT_BORROWED* msg)
+{
+    if (!msg)
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+    return CUDT::borrowmsg(u, Ref(*msg));
+}
+
+int srt_recvmsg_release(SRTSOCKET u, SRT_BORROWED* msg)
+{
+    if (!msg)
+        return CUDT::setError(CUDTException(MJ_NOTSUP, MN_INVAL, 0));
+    return CUDT::releasemsg(u, Ref(*msg));
+}
+
 const char* srt_getlasterror_str() { return UDT::getlasterror().getErrorMessage(); }
 
 int srt_getlasterror(int* loc_errno)
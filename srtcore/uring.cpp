@@ -0,0 +1,271 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include "uring.h"
+
+#ifdef SRT_ENABLE_IOURING
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+// The rings are shared with the kernel, so the indices
+// must be read and published with the proper ordering.
+#define URING_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+CUring::CUring():
+m_iFd(-1),
+m_pSqRing(MAP_FAILED),
+m_zSqRingSize(0),
+m_pCqRing(MAP_FAILED),
+m_zCqRingSize(0),
+m_pSqes((io_uring_sqe*)MAP_FAILED),
+m_zSqesSize(0),
+m_puSqHead(NULL),
+m_puSqTail(NULL),
+m_puSqArray(NULL),
+m_uSqMask(0),
+m_uSqEntries(0),
+m_uSqLocalTail(0),
+m_puCqHead(NULL),
+m_puCqTail(NULL),
+m_uCqMask(0),
+m_pCqes(NULL)
+{
+}
+
+CUring::~CUring()
+{
+   release();
+}
+
+void CUring::release()
+{
+   if (m_pSqes != MAP_FAILED)
+      ::munmap(m_pSqes, m_zSqesSize);
+   if (m_pCqRing != MAP_FAILED)
+      ::munmap(m_pCqRing, m_zCqRingSize);
+   if (m_pSqRing != MAP_FAILED)
+      ::munmap(m_pSqRing, m_zSqRingSize);
+   if (m_iFd != -1)
+      ::close(m_iFd);
+
+   m_pSqes = (io_uring_sqe*)MAP_FAILED;
+   m_pCqRing = MAP_FAILED;
+   m_pSqRing = MAP_FAILED;
+   m_iFd = -1;
+}
+
+bool CUring::init(unsigned entries)
+{
+   io_uring_params p;
+   memset(&p, 0, sizeof p);
+
+   m_iFd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+   if (m_iFd < 0)
+   {
+      m_iFd = -1;
+      return false;
+   }
+
+   // Waiting with a timeout needs IORING_ENTER_EXT_ARG.
+   if (!(p.features & IORING_FEAT_EXT_ARG))
+   {
+      release();
+      return false;
+   }
+
+   m_zSqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   m_zCqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+   m_zSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+   m_pSqRing = ::mmap(NULL, m_zSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_SQ_RING);
+   m_pCqRing = ::mmap(NULL, m_zCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_CQ_RING);
+   m_pSqes = (io_uring_sqe*)::mmap(NULL, m_zSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iFd, IORING_OFF_SQES);
+   if (m_pSqRing == MAP_FAILED || m_pCqRing == MAP_FAILED || m_pSqes == MAP_FAILED)
+   {
+      release();
+      return false;
+   }
+
+   char* sq = (char*)m_pSqRing;
+   m_puSqHead = (unsigned*)(sq + p.sq_off.head);
+   m_puSqTail = (unsigned*)(sq + p.sq_off.tail);
+   m_puSqArray = (unsigned*)(sq + p.sq_off.array);
+   m_uSqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+   m_uSqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+   m_uSqLocalTail = *m_puSqTail;
+
+   char* cq = (char*)m_pCqRing;
+   m_puCqHead = (unsigned*)(cq + p.cq_off.head);
+   m_puCqTail = (unsigned*)(cq + p.cq_off.tail);
+   m_uCqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+   m_pCqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+   return true;
+}
+
+io_uring_sqe* CUring::getSqe()
+{
+   unsigned head = URING_LOAD_ACQUIRE(m_puSqHead);
+   if (m_uSqLocalTail - head >= m_uSqEntries)
+      return NULL;
+
+   unsigned idx = m_uSqLocalTail & m_uSqMask;
+   m_puSqArray[idx] = idx;
+   ++ m_uSqLocalTail;
+
+   io_uring_sqe* sqe = &m_pSqes[idx];
+   memset(sqe, 0, sizeof *sqe);
+   return sqe;
+}
+
+bool CUring::prepRecvMsg(int fd, msghdr* mh, uint64_t tag)
+{
+   io_uring_sqe* sqe = getSqe();
+   if (!sqe)
+      return false;
+
+   sqe->opcode = IORING_OP_RECVMSG;
+   sqe->fd = fd;
+   sqe->addr = (uint64_t)(uintptr_t)mh;
+   sqe->len = 1;
+   sqe->user_data = tag;
+   return true;
+}
+
+bool CUring::prepSendMsg(int fd, const msghdr* mh, uint64_t tag)
+{
+   io_uring_sqe* sqe = getSqe();
+   if (!sqe)
+      return false;
+
+   sqe->opcode = IORING_OP_SENDMSG;
+   sqe->fd = fd;
+   sqe->addr = (uint64_t)(uintptr_t)mh;
+   sqe->len = 1;
+   sqe->user_data = tag;
+   return true;
+}
+
+bool CUring::prepRead(int fd, void* buf, unsigned len, uint64_t tag)
+{
+   io_uring_sqe* sqe = getSqe();
+   if (!sqe)
+      return false;
+
+   sqe->opcode = IORING_OP_READ;
+   sqe->fd = fd;
+   sqe->addr = (uint64_t)(uintptr_t)buf;
+   sqe->len = len;
+   sqe->off = (uint64_t)-1; // current position, as read() does
+   sqe->user_data = tag;
+   return true;
+}
+
+int CUring::submitAndWait(unsigned wait_nr, int64_t timeout_us)
+{
+   unsigned to_submit = m_uSqLocalTail - *m_puSqTail;
+   if (to_submit == 0 && wait_nr == 0)
+      return 0;
+
+   URING_STORE_RELEASE(m_puSqTail, m_uSqLocalTail);
+
+   __kernel_timespec ts;
+   io_uring_getevents_arg arg;
+   memset(&arg, 0, sizeof arg);
+   unsigned flags = 0;
+   if (wait_nr > 0)
+   {
+      flags |= IORING_ENTER_GETEVENTS;
+      if (timeout_us >= 0)
+      {
+         ts.tv_sec = timeout_us / 1000000;
+         ts.tv_nsec = (timeout_us % 1000000) * 1000;
+         arg.ts = (uint64_t)(uintptr_t)&ts;
+         arg.sigmask_sz = _NSIG / 8;
+         flags |= IORING_ENTER_EXT_ARG;
+      }
+   }
+
+   int res = (int)::syscall(__NR_io_uring_enter, m_iFd, to_submit, wait_nr, flags,
+         (flags & IORING_ENTER_EXT_ARG) ? (void*)&arg : NULL,
+         (flags & IORING_ENTER_EXT_ARG) ? sizeof arg : (size_t)0);
+   if (res < 0)
+   {
+      int err = errno;
+      // Time out or a signal just means that nothing has completed yet.
+      if (err == ETIME || err == EINTR || err == EAGAIN || err == EBUSY)
+         return 0;
+      return -err;
+   }
+   return 0;
+}
+
+bool CUring::reap(ref_t<uint64_t> r_tag, ref_t<int> r_res)
+{
+   unsigned head = *m_puCqHead;
+   if (head == URING_LOAD_ACQUIRE(m_puCqTail))
+      return false;
+
+   io_uring_cqe* cqe = &m_pCqes[head & m_uCqMask];
+   *r_tag = cqe->user_data;
+   *r_res = cqe->res;
+   URING_STORE_RELEASE(m_puCqHead, head + 1);
+   return true;
+}
+
+#else // !SRT_ENABLE_IOURING
+
+CUring::CUring():
+m_iFd(-1),
+m_pSqRing(NULL),
+m_zSqRingSize(0),
+m_pCqRing(NULL),
+m_zCqRingSize(0),
+m_pSqes(NULL),
+m_zSqesSize(0),
+m_puSqHead(NULL),
+m_puSqTail(NULL),
+m_puSqArray(NULL),
+m_uSqMask(0),
+m_uSqEntries(0),
+m_uSqLocalTail(0),
+m_puCqHead(NULL),
+m_puCqTail(NULL),
+m_uCqMask(0),
+m_pCqes(NULL)
+{
+}
+
+CUring::~CUring() {}
+void CUring::release() {}
+bool CUring::init(unsigned) { return false; }
+io_uring_sqe* CUring::getSqe() { return NULL; }
+bool CUring::prepRecvMsg(int, msghdr*, uint64_t) { return false; }
+bool CUring::prepSendMsg(int, const msghdr*, uint64_t) { return false; }
+bool CUring::prepRead(int, void*, unsigned, uint64_t) { return false; }
+int CUring::submitAndWait(unsigned, int64_t) { return -ENOSYS; }
+bool CUring::reap(ref_t<uint64_t>, ref_t<int>) { return false; }
+
+#endif
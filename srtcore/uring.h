@@ -0,0 +1,108 @@
+/*
+ * SRT - Secure, Reliable, Transport
+ * Copyright (c) 2018 Haivision Systems Inc.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef INC__URING_H
+#define INC__URING_H
+
+// A minimal io_uring ring, driven directly through the system calls,
+// used by CChannel as an alternative to recvmsg/sendmmsg. Available
+// only on Linux when built with SRT_ENABLE_IOURING; otherwise init()
+// always fails and the channel stays with the plain socket calls.
+
+#include <cstddef>
+#include "utilities.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct msghdr;
+
+class CUring
+{
+public:
+   CUring();
+   ~CUring();
+
+      /// Set up the ring.
+      /// @param [in] entries number of submission queue entries.
+      /// @return true if the system supports everything that is needed.
+
+   bool init(unsigned entries);
+
+      /// Prepare a recvmsg operation.
+      /// @param [in] fd socket descriptor.
+      /// @param [in] mh message header, must stay valid until completed.
+      /// @param [in] tag user data reported with the completion.
+      /// @return false if the submission queue is full.
+
+   bool prepRecvMsg(int fd, msghdr* mh, uint64_t tag);
+
+      /// Prepare a sendmsg operation.
+      /// @param [in] fd socket descriptor.
+      /// @param [in] mh message header, must stay valid until completed.
+      /// @param [in] tag user data reported with the completion.
+      /// @return false if the submission queue is full.
+
+   bool prepSendMsg(int fd, const msghdr* mh, uint64_t tag);
+
+      /// Prepare a read operation.
+      /// @param [in] fd file descriptor.
+      /// @param [out] buf buffer to read into, must stay valid until completed.
+      /// @param [in] len number of bytes to read.
+      /// @param [in] tag user data reported with the completion.
+      /// @return false if the submission queue is full.
+
+   bool prepRead(int fd, void* buf, unsigned len, uint64_t tag);
+
+      /// Submit all prepared entries and wait for completions.
+      /// @param [in] wait_nr number of completions to wait for, 0 = just submit.
+      /// @param [in] timeout_us max time to wait in microseconds, -1 = no limit.
+      /// @return 0 on success or when the time is out, -errno otherwise.
+
+   int submitAndWait(unsigned wait_nr, int64_t timeout_us);
+
+      /// Take the next completion, if any.
+      /// @param [out] r_tag the user data of the completed entry.
+      /// @param [out] r_res the result of the operation.
+      /// @return true if a completion was taken.
+
+   bool reap(ref_t<uint64_t> r_tag, ref_t<int> r_res);
+
+private:
+   void release();
+   io_uring_sqe* getSqe();
+
+private:
+   int m_iFd;                   // ring file descriptor
+
+   void* m_pSqRing;             // submission queue ring mapping
+   size_t m_zSqRingSize;
+   void* m_pCqRing;             // completion queue ring mapping
+   size_t m_zCqRingSize;
+   io_uring_sqe* m_pSqes;       // submission queue entries mapping
+   size_t m_zSqesSize;
+
+   unsigned* m_puSqHead;
+   unsigned* m_puSqTail;
+   unsigned* m_puSqArray;
+   unsigned m_uSqMask;
+   unsigned m_uSqEntries;
+   unsigned m_uSqLocalTail;     // entries prepared, but not yet published
+
+   unsigned* m_puCqHead;
+   unsigned* m_puCqTail;
+   unsigned m_uCqMask;
+   io_uring_cqe* m_pCqes;
+
+private:
+   CUring(const CUring&);
+   CUring& operator=(const CUring&);
+};
+
+#endif
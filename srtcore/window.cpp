@@ -74,8 +74,11 @@ void store(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int32_t s
       r_iTail = (r_iTail + 1) % size;
 }
 
-int acknowledge(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int32_t seq, int32_t& r_ack)
+int acknowledge(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int32_t seq, int32_t& r_ack, uint64_t currtime)
 {
+   if (currtime == 0)
+      currtime = CTimer::getTime();
+
    if (r_iHead >= r_iTail)
    {
       // Head has not exceeded the physical boundary of the window
@@ -89,7 +92,7 @@ int acknowledge(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int3
             r_ack = r_aSeq[i].iACK;
 
             // calculate RTT
-            int rtt = int(CTimer::getTime() - r_aSeq[i].TimeStamp);
+            int rtt = int(currtime - r_aSeq[i].TimeStamp);
 
             if (i + 1 == r_iHead)
             {
@@ -118,7 +121,7 @@ int acknowledge(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int3
          r_ack = r_aSeq[j].iACK;
 
          // calculate RTT
-         int rtt = int(CTimer::getTime() - r_aSeq[j].TimeStamp);
+         int rtt = int(currtime - r_aSeq[j].TimeStamp);
 
          if (j == r_iHead)
          {
@@ -71,7 +71,7 @@ namespace ACKWindowTools
    };
 
    void store(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int32_t seq, int32_t ack);
-   int acknowledge(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int32_t seq, int32_t& r_ack);
+   int acknowledge(Seq* r_aSeq, const size_t size, int& r_iHead, int& r_iTail, int32_t seq, int32_t& r_ack, uint64_t currtime);
 }
 
 template <size_t SIZE>
@@ -100,11 +100,12 @@ public:
       /// Search the ACK-2 "seq" in the window, find out the DATA "ack" and caluclate RTT .
       /// @param [in] seq ACK-2 seq. no.
       /// @param [out] ack the DATA ACK no. that matches the ACK-2 no.
+      /// @param [in] currtime time when the ACK-2 was received, 0 = now.
       /// @return RTT.
 
-   int acknowledge(int32_t seq, int32_t& r_ack)
+   int acknowledge(int32_t seq, int32_t& r_ack, uint64_t currtime = 0)
    {
-       return ACKWindowTools::acknowledge(m_aSeq, SIZE, m_iHead, m_iTail, seq, r_ack);
+       return ACKWindowTools::acknowledge(m_aSeq, SIZE, m_iHead, m_iTail, seq, r_ack, currtime);
    }
 
 private:
@@ -209,12 +210,14 @@ public:
    }
 
    /// Record time information of an arrived packet.
+   /// @param pktsz size of the packet payload.
+   /// @param arrtime time when the system received the packet, 0 = now.
 
-   void onPktArrival(int pktsz = 0)
+   void onPktArrival(int pktsz = 0, uint64_t arrtime = 0)
    {
        CGuard cg(m_lockPktWindow);
 
-       m_CurrArrTime = CTimer::getTime();
+       m_CurrArrTime = arrtime ? arrtime : CTimer::getTime();
 
        // record the packet interval between the current and the last one
        m_aPktWindow[m_iPktWindowPtr] = int(m_CurrArrTime - m_LastArrTime);
@@ -230,20 +233,23 @@ public:
    }
 
    /// Record the arrival time of the first probing packet.
+   /// @param arrtime time when the system received the packet, 0 = now.
 
-   void probe1Arrival()
+   void probe1Arrival(uint64_t arrtime = 0)
    {
-       m_ProbeTime = CTimer::getTime();
+       m_ProbeTime = arrtime ? arrtime : CTimer::getTime();
    }
 
    /// Record the arrival time of the second probing packet and the interval between packet pairs.
+   /// @param pktsz size of the packet payload.
+   /// @param arrtime time when the system received the packet, 0 = now.
 
-   void probe2Arrival(int pktsz = 0)
+   void probe2Arrival(int pktsz = 0, uint64_t arrtime = 0)
    {
        // Lock access to the packet Window
        CGuard cg(m_lockProbeWindow);
 
-       m_CurrArrTime = CTimer::getTime();
+       m_CurrArrTime = arrtime ? arrtime : CTimer::getTime();
 
        // record the probing packets interval
        // Adjust the time for what a complete packet would have take